@@ -11,6 +11,7 @@
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
 #include "nrf_pwr_mgmt.h"
+#include "nrf_soc.h"
 
 #include "buckler.h"
 
@@ -27,18 +28,36 @@
 #include "quaternion_filter.h"
 #include "speech_recognizer_v2.h"
 #include "si7021.h"
+#include "sensor_bus.h"
+#include "sliding_window.h"
+#include "hall_velocity.h"
+#include "hall_capture.h"
+#include "speed_estimator.h"
+#include "orientation.h"
+#include "event_queue.h"
+#include "calibration_store.h"
+#include "mag_calibration.h"
+#include "profiler.h"
+#include "rate_plan.h"
+#include "ride_log.h"
+#include "ble_telemetry.h"
+#include "trip_stats.h"
 #include <math.h>
 
 // Constants:
 
-// Number of AHRS readings that we want to smooth
-#define smooth_num 300
+// Number of AHRS readings that we want to smooth (1.5 s)
+#define smooth_num RATE_PLAN_IMU_SAMPLES(1500)
 
 // Define Pi
 #define PI 3.14159265359
 
-// m/s to MPH
-#define MS_TO_MPH_CONVERSION_FACTOR 2.237
+// Declination in Belmont, California is 13 degrees 20 minutes 2019-11-30
+#define MAGNETIC_DECLINATION 13.2f
+
+// Orientation outputs the dashboard uses: roll for the turn signals, linear
+// acceleration for braking, pitch for the trip's climb
+#define ORIENTATION_FIELDS (ORIENTATION_ROLL | ORIENTATION_PITCH | ORIENTATION_LINEAR_ACCEL)
 
 // Bike wheel radius (in centimeters)
 // I'm assuming standard road bike tires with 622mm diamteter
@@ -50,54 +69,136 @@
 // GPIO defines
 #define LED_PWM NRF_GPIO_PIN_MAP(0, 17)     // GPIO pin to control LED signal
 
+// 1: ignore the calibration stored in flash, calibrate and store a new one
+#define RECALIBRATE_ON_BOOT 0
+
+// Stored calibration, kept up to date by the online magnetometer calibration
+calibration_record_t calibration;
+mag_calibration_t mag_calibration;
+
+// Magnetometer fits are applied right away but only written to flash when they
+// moved far from the stored one and the last write was a while ago, or when
+// parking: every FDS update leaves a dirty record for garbage collection and
+// shares the fstorage queue with the ride log
+#define MAG_CAL_SAVE_INTERVAL_MS 600000     // 10 min
+#define MAG_CAL_SAVE_BIAS_CHANGE 30.0f      // mG
+#define MAG_CAL_SAVE_SCALE_CHANGE 0.05f     // Fraction of the stored scale
+bool mag_calibration_unsaved = false;
+uint32_t mag_calibration_saved_ms = 0;
+
 // Hall sensor pin
 #define HALL_PIN NRF_GPIO_PIN_MAP(0, 11)
 
-#define BRAKING_THRESHOLD -0.7
-#define LEFT_THRESHOLD 14.0
-#define RIGHT_THRESHOLD -1 * LEFT_THRESHOLD
+// Stage rates and decimation, see rate_plan.h
+rate_plan_t rate_plan;
+rate_divider_t fsm_divider;
+rate_divider_t periodic_divider;
+rate_divider_t ride_log_divider;
+rate_divider_t telemetry_divider;
 
-// Main FSM state variable
-states current_system_state = IDLE;
-// Voice recognition state variable
-states voice_recognition_state = IDLE;
-// Kinematics state variable
-states kinematics_state = IDLE;///IDLE or BRAKE
+// Main FSM
+states_fsm_t system_fsm;
+states logged_system_state = IDLE;
 
 /*For now, let's create a single timer that we will use to
 get the velocity from the Hall sensor and get the delta-T for the
 AHRS algo.
 */
 
-// Hall effect variables
-#define HALL_EFFECT_TIME_MS 250 // Update the hall values 2x/second (for now)
-
-volatile int hall_revolutions = 0;
-volatile int hall_revolution_history[4] = {0};
-
-volatile uint32_t hall_revolution_array_index = 0;
+// Readings faster than this are treated as sensor bounce
+#define HALL_MAX_SPEED_MPH 30
 
-volatile float velocity_readings_in_last_callback[100] = {0};
+// 1: count and timestamp hall edges in hardware (1 MHz TIMER capture over PPI,
+// no interrupt per edge, keeps the HFXO running)
+// 0: timestamp edges with the RTC in the GPIO interrupt
+#define HALL_USE_TIMER_CAPTURE 1
 
-volatile float velocity_reading_history[4] = {0};
-volatile uint32_t velocity_reading_array_index = 0;
+hall_velocity_t hall;
+hall_edge_ring_t hall_edges;
 
-volatile int num_readings_in_last_callback = 0;
+// Fused speed and deceleration for brake detection
+#define GRAVITY 9.81f
+#define LONGITUDINAL_ACCEL_SIGN 1.0f // +1 if the IMU's y axis points forward
+speed_estimator_t speed_estimator;
+uint32_t hall_readings_fused = 0;
 
 APP_TIMER_DEF(hall_velocity_calc);
 
-volatile float distance_rotated = 0;
-
 // Display Mode Enum
-#define NUM_DISPLAY_MODES 4
+#define NUM_DISPLAY_MODES 11
 #define DISPLAY_MODE_VELOCITY_MPH 0
 #define DISPLAY_MODE_DISTANCE_METERS 1
 #define DISPLAY_MODE_TEMP 2
 #define DISPLAY_MODE_HUMIDITY 3
+#define DISPLAY_MODE_MAX_SPEED_MPH 4
+#define DISPLAY_MODE_AVG_SPEED_MPH 5
+#define DISPLAY_MODE_MOVING_TIME 6
+#define DISPLAY_MODE_STOPPED_TIME 7
+#define DISPLAY_MODE_CLIMB_METERS 8
+#define DISPLAY_MODE_LEAN_HISTOGRAM 9
+#define DISPLAY_MODE_BRAKE_HISTOGRAM 10
+
+// Trip statistics since boot, shown on the trip display modes
+#define MPH_PER_MPS 2.23694f
+#define MOUNT_PITCH_DEG 0.0f            // Pitch reading on level ground
+#define PITCH_UP_SIGN 1.0f              // +1 if pitch is positive riding uphill
+trip_stats_t trip;
 
 uint8_t si7021_is_init = 0;
+volatile float temperature = 0;
+volatile float humidity = 0;
 int display_mode = DISPLAY_MODE_VELOCITY_MPH;
 
+// Sliding windows over the AHRS output
+SLIDING_WINDOW_DEF(smooth_roll, smooth_num);
+SLIDING_WINDOW_DEF(smooth_lin_y_accel, smooth_num);
+
+// Work posted from interrupts and timers to the main loop
+typedef enum {
+    EVENT_IMU_FIFO,
+    EVENT_HALL_WINDOW,
+    EVENT_SPEECH_COMMAND,
+    EVENT_ENVIRONMENT,
+    EVENT_WAKE_ON_MOTION,
+    EVENT_PROFILE_DUMP,
+    EVENT_BLE_TELEMETRY,
+} dashboard_event_t;
+
+// Press to print (and then clear) the stage timings
+#define PROFILE_DUMP_BUTTON BUCKLER_BUTTON0
+
+// Set while an EVENT_IMU_FIFO is queued, so each batch is posted once
+volatile bool IMU_event_pending = false;
+
+// Set while an EVENT_SPEECH_COMMAND is queued; its handler reads every queued command
+volatile bool speech_event_pending = false;
+
+// 1: stream telemetry to a phone over BLE (enables the SoftDevice)
+#define BLE_TELEMETRY_ENABLED 1
+#define BLE_DEVICE_NAME "Bike"
+
+// Set while an EVENT_BLE_TELEMETRY is queued
+volatile bool telemetry_event_pending = false;
+
+// Parking mode: after PARKING_TIMEOUT_S without hall edges, rotation or voice
+// commands the IMU drops to accelerometer-only wake-on-motion, the strip and
+// displays go dark and only a slow timer keeps the uptime clock going.
+// Motion detection takes up to one LP accelerometer period (32 ms) and
+// resuming the IMU about 50 ms more.
+#define PARKING_TIMEOUT_S 120
+#define PARKING_MOTION_DPS 5.0f         // Any rotation faster than this counts as activity
+#define PARKING_WOM_THRESHOLD_MG 80
+#define PARKING_WOM_ODR 7               // 31.25 Hz
+#define PARKING_TICK_MS 60000           // Well inside the 512 s RTC wrap
+volatile bool parked = false;
+volatile bool wake_event_pending = false;
+uint32_t last_activity_ms = 0;
+mpu9250_fifo_config_t IMU_fifo_config;
+
+// Time spent asleep, for the power report every RATE_PLAN_POWER_REPORT_MS
+uint32_t sleep_ticks = 0;
+uint32_t power_report_start = 0;
+uint32_t hall_window_count = 0;
 
 // Voice Commands Enum
 #define VOICE_COMMAND_NEXT 5
@@ -108,39 +209,92 @@ int display_mode = DISPLAY_MODE_VELOCITY_MPH;
 
 float get_msecs_from_ticks(uint32_t tick_diff);
 
-float hall_last_time = -1;
-float hall_new_time = -1;
-
 void hall_effect_timer_callback(void *p_context) {
-    // in meters
-    distance_rotated += ((float)hall_revolutions * arc_length);
+    event_queue_post(EVENT_HALL_WINDOW, 0);
+}
 
-    if (display_mode == DISPLAY_MODE_DISTANCE_METERS) {
-        displayNum(distance_rotated, 0, false, 0);
-        displayStr("NN", 1);
+void report_power_stats(void);
+uint32_t get_uptime_msecs(void);
+void enter_parking_mode(void);
+
+// Bring in new hall edges and fuse any new speed reading
+void sample_hall_edges(void) {
+#if HALL_USE_TIMER_CAPTURE
+    uint32_t edge_count, last_edge_time;
+    hall_capture_read(&edge_count, &last_edge_time);
+    hall_velocity_edge_batch(&hall, edge_count, last_edge_time);
+#else
+    hall_velocity_process_edges(&hall, &hall_edges);
+#endif
+
+    if (hall.reading_count != hall_readings_fused) {
+        hall_readings_fused = hall.reading_count;
+        last_activity_ms = get_uptime_msecs();
+        speed_estimator_update_speed(&speed_estimator, hall.latest_speed);
     }
+}
 
-    float velocity_sum = 0;
-    for (int i = 0; i < num_readings_in_last_callback; i++) {
-        velocity_sum += velocity_readings_in_last_callback[i];
+// Shows minutes:seconds, or hours:minutes from 100 minutes on
+void display_duration(uint32_t ms, int port_number) {
+    uint32_t seconds = ms / 1000;
+    uint32_t high = seconds / 60;
+    uint32_t low = seconds % 60;
+    if (high >= 100) {
+        high = seconds / 3600;
+        low = (seconds / 60) % 60;
     }
+    // The colon is the point at decimal = 2; the half step keeps the float from rounding down
+    displayNum(high + (low + 0.5f) / 100.0f, 2, false, port_number);
+}
 
-    float avg_velocity;
-
-    if (num_readings_in_last_callback == 0) {
-        avg_velocity = 0;
-    } else {
-        avg_velocity = velocity_sum / num_readings_in_last_callback;
+// The trip display modes, refreshed every hall window
+void display_trip_stats(void) {
+    char label[5];
+    uint32_t page = hall_window_count / rate_plan.display_page_windows;
+
+    if (display_mode == DISPLAY_MODE_MAX_SPEED_MPH) {
+        displayNum(trip.max_speed * MPH_PER_MPS, 2, false, 0);
+        displayStr("HI", 1);
+    } else if (display_mode == DISPLAY_MODE_AVG_SPEED_MPH) {
+        displayNum(trip_stats_average_speed(&trip) * MPH_PER_MPS, 2, false, 0);
+        displayStr("AUE", 1);
+    } else if (display_mode == DISPLAY_MODE_MOVING_TIME) {
+        display_duration(trip.moving_ms, 0);
+        displayStr("on", 1);
+    } else if (display_mode == DISPLAY_MODE_STOPPED_TIME) {
+        display_duration(trip.stopped_ms, 0);
+        displayStr("oFF", 1);
+    } else if (display_mode == DISPLAY_MODE_CLIMB_METERS) {
+        displayNum(trip.climb, 0, false, 0);
+        displayStr("uP", 1);
+    } else if (display_mode == DISPLAY_MODE_LEAN_HISTOGRAM) {
+        // Share of moving time at each lean angle, one bin at a time
+        int bin = page % TRIP_STATS_LEAN_BINS;
+        displayNum(trip_stats_lean_percent(&trip, bin), 0, false, 0);
+        snprintf(label, sizeof(label), "*%d", (int)(bin * TRIP_STATS_LEAN_BIN_DEG));
+        displayStr(label, 1);
+    } else if (display_mode == DISPLAY_MODE_BRAKE_HISTOGRAM) {
+        // Brake events by peak deceleration in m/s^2, one bin at a time
+        int bin = page % TRIP_STATS_BRAKE_BINS;
+        displayNum(trip.brake_events[bin], 0, false, 0);
+        snprintf(label, sizeof(label), "b%d", (int)(bin * TRIP_STATS_BRAKE_BIN_MPS2));
+        displayStr(label, 1);
     }
+}
 
-    
-
-    //printf("Hall Revs: %i\n", hall_revolutions);
-    //displayNum((int)distance_rotated, 0, false, 0);
+void hall_window_event_handler(uint32_t data) {
+    if (parked) {
+        // Only here to keep the uptime clock from wrapping
+        get_uptime_msecs();
+        return;
+    }
 
-    // velocity printout in MPH
-    // float velocity_mph = (float)hall_revolutions * arc_length * MS_TO_MPH_CONVERSION_FACTOR * ((float)HALL_EFFECT_TIME_MS / 1000.0); // Multiply by .5 because we're going by 1/2 sec update
+    sample_hall_edges();
+    float avg_velocity = hall_velocity_close_window(&hall);
+    float distance_rotated = hall_velocity_distance(&hall); // in meters
+    trip_stats_add_window(&trip, avg_velocity / MPH_PER_MPS, distance_rotated, rate_plan.hall_window_ms);
 
+    PROFILE_START(PROFILE_DISPLAY);
     if (display_mode == DISPLAY_MODE_VELOCITY_MPH) {
         displayNum(avg_velocity, 2, false, 0);
         //displayNum(num_readings_in_last_callback, 0, false, 1);
@@ -148,17 +302,20 @@ void hall_effect_timer_callback(void *p_context) {
     } else if (display_mode == DISPLAY_MODE_DISTANCE_METERS) {
         displayNum(distance_rotated, 0, false, 0);
         displayStr("NN", 1);
+    } else {
+        display_trip_stats();
     }
+    PROFILE_END(PROFILE_DISPLAY);
 
-    num_readings_in_last_callback = 0;
+    ble_telemetry_send(get_uptime_msecs());
 
-    //printf("Bike wheel distance: %f\n", distance_rotated);
-    hall_revolution_array_index++;
-    hall_revolution_history[hall_revolution_array_index % 4] = hall_revolutions;
-    hall_revolutions = 0;
+    if (++hall_window_count % rate_plan.power_report_windows == 0) {
+        report_power_stats();
+    }
 
-    velocity_reading_array_index++;
-    velocity_reading_history[velocity_reading_array_index % 4] = avg_velocity;
+    if (get_uptime_msecs() - last_activity_ms > PARKING_TIMEOUT_S * 1000) {
+        enter_parking_mode();
+    }
 }
 
 // General clock callback (not used)
@@ -183,35 +340,18 @@ void init_hall_effect_timer(void) {
     APP_ERROR_CHECK(error_code);
 }
 
-void hall_effect_GPIO_callback(nrfx_gpiote_pin_t pin, nrf_gpiote_polarity_t action) {
-    hall_revolutions += 1;
-
-    hall_last_time = hall_new_time;
-    hall_new_time = app_timer_cnt_get();
-
-    if (hall_last_time != -1) {
-        uint32_t tick_diff = app_timer_cnt_diff_compute(hall_new_time, hall_last_time);
-        float time_diff_msec = get_msecs_from_ticks(tick_diff);
-
-        printf("time diff msec: %f\n", time_diff_msec);
-
-        float velocity_mph = arc_length / time_diff_msec * 1000 * MS_TO_MPH_CONVERSION_FACTOR;
-        printf("velocity: %f\n\n", velocity_mph);
-
-        if (velocity_mph < 30) {
-            velocity_readings_in_last_callback[num_readings_in_last_callback++] = velocity_mph;
-        }
-
-        // if (display_mode == DISPLAY_MODE_VELOCITY_MPH) {
-        //     displayNum(velocity_mph, 2, false, 0);
-        //     displayStr("NNPH", 1);
-        // } else if (display_mode == DISPLAY_MODE_DISTANCE_METERS) {
-        //     displayNum(distance_rotated, 0, false, 0);
-        //     displayStr("NN", 1);
-        // }
+// A wheel turning while parked wakes the dashboard like motion does
+void hall_wake_callback(nrfx_gpiote_pin_t pin, nrf_gpiote_polarity_t action) {
+    if (parked && !wake_event_pending) {
+        wake_event_pending = event_queue_post(EVENT_WAKE_ON_MOTION, app_timer_cnt_get());
     }
 }
 
+void hall_effect_GPIO_callback(nrfx_gpiote_pin_t pin, nrf_gpiote_polarity_t action) {
+    hall_wake_callback(pin, action);
+    hall_edge_ring_push(&hall_edges, app_timer_cnt_get());
+}
+
 // Setup hall effect sensor interrupt callback
 void setup_Hall_GPIO_interrupt(void) {
     nrfx_gpiote_in_config_t hall_config = NRFX_GPIOTE_CONFIG_IN_SENSE_HITOLO(true);
@@ -220,10 +360,38 @@ void setup_Hall_GPIO_interrupt(void) {
     nrfx_gpiote_in_event_enable(HALL_PIN, true);
 }
 
-volatile bool IMU_data_ready = false;
 // IMU interrupt callback function
 void IMU_interrupt_callback(nrfx_gpiote_pin_t pin, nrf_gpiote_polarity_t action) {
-    IMU_data_ready = true;
+    if (parked) {
+        // Wake-on-motion; pass the time on to measure the wake latency
+        if (!wake_event_pending) {
+            wake_event_pending = event_queue_post(EVENT_WAKE_ON_MOTION, app_timer_cnt_get());
+        }
+        return;
+    }
+
+    IMU_fifo_interrupt_handler();
+    if (IMU_fifo_ready() && !IMU_event_pending) {
+        // If the queue is full, the next interrupt tries again
+        IMU_event_pending = event_queue_post(EVENT_IMU_FIFO, 0);
+    }
+}
+
+void profile_button_callback(nrfx_gpiote_pin_t pin, nrf_gpiote_polarity_t action) {
+    event_queue_post(EVENT_PROFILE_DUMP, 0);
+}
+
+void setup_profile_button(void) {
+    nrfx_gpiote_in_config_t button_config = NRFX_GPIOTE_CONFIG_IN_SENSE_HITOLO(false);
+    button_config.pull = NRF_GPIO_PIN_PULLUP;
+    ret_code_t error_code = nrfx_gpiote_in_init(PROFILE_DUMP_BUTTON, &button_config, profile_button_callback);
+    APP_ERROR_CHECK(error_code);
+    nrfx_gpiote_in_event_enable(PROFILE_DUMP_BUTTON, true);
+}
+
+void profile_dump_event_handler(uint32_t data) {
+    profiler_dump();
+    profiler_reset();
 }
 
 // Function to setup read of mpu9250 on an interrupt
@@ -235,14 +403,6 @@ void setup_IMU_interrupt(void) {
     nrfx_gpiote_in_event_enable(BUCKLER_IMU_INTERUPT, true);
 }
 
-// Function for taking sliding average of IMU data arrays
-float sliding_averager_float_array(float *input_array_pointer, int array_size) {
-    float output = 0;
-    for (int i = 0; i < array_size; i++) {
-        output += input_array_pointer[i];
-    }
-    return output / (float)array_size;
-}
 // Function to convert timer ticks to milliseconds
 
 float get_msecs_from_ticks(uint32_t tick_diff) {
@@ -253,14 +413,491 @@ float get_msecs_from_ticks(uint32_t tick_diff) {
     // NOTE: I'm assuing an RTC prescalar of 0 & clock freq of 32768Hz
     return ((float)tick_diff * ((0.0 + 1.0) * 1000.0)) / 32768.0;
 }
+
+// Milliseconds since the RTC started; must be called at least once per RTC wrap (512 s)
+uint32_t get_uptime_msecs(void) {
+    static uint32_t last_ticks = 0;
+    static uint64_t elapsed_ticks = 0;
+    uint32_t now = app_timer_cnt_get();
+    elapsed_ticks += app_timer_cnt_diff_compute(now, last_ticks);
+    last_ticks = now;
+    return (uint32_t)((elapsed_ticks * 1000) / 32768);
+}
+// Si7021 measurement complete (TWI interrupt context)
+void environment_read_callback(float new_temperature, float new_humidity) {
+    temperature = new_temperature;
+    humidity = new_humidity;
+    event_queue_post(EVENT_ENVIRONMENT, 0);
+}
+
+// A voice command arrived (UART interrupt context)
+void speech_command_callback(void) {
+    if (!speech_event_pending) {
+        speech_event_pending = event_queue_post(EVENT_SPEECH_COMMAND, 0);
+    }
+}
+
+// The BLE link can take more telemetry (SoftDevice interrupt context)
+void telemetry_ready_callback(void) {
+    if (!telemetry_event_pending) {
+        telemetry_event_pending = event_queue_post(EVENT_BLE_TELEMETRY, 0);
+    }
+}
+
+void telemetry_event_handler(uint32_t data) {
+    telemetry_event_pending = false;
+    ble_telemetry_send(get_uptime_msecs());
+}
+
+// The SoftDevice owns the clock once BLE is enabled
+void hfclk_start(void) {
+#if BLE_TELEMETRY_ENABLED
+    ret_code_t error_code = sd_clock_hfclk_request();
+    APP_ERROR_CHECK(error_code);
+#else
+    nrfx_clock_hfclk_start();
+#endif
+}
+
+void hfclk_stop(void) {
+#if BLE_TELEMETRY_ENABLED
+    ret_code_t error_code = sd_clock_hfclk_release();
+    APP_ERROR_CHECK(error_code);
+#else
+    nrfx_clock_hfclk_stop();
+#endif
+}
+
+// Madewick algo hyperparameters; do not change during execution
+float GyroMeasError = PI * (4.0f / 180.0f);   // gyroscope measurement error in rads/s; the filter steps in seconds to match
+float beta;
+
+// AHRS state, updated from the IMU FIFO handler
+float q[4] = {1.0f, 0.0f, 0.0f, 0.0f};    // vector to hold quaternion
+float smoothed_roll = 0;
+float smoothed_lin_y_accel = 0;
+uint16_t IMU_read_counter = 0;
+
+// Slow periodic work, every RATE_PLAN_PERIODIC_MS of IMU samples
+void run_periodic_step(void) {
+    //printf("Smoothed Y Accel: %f\n", smoothed_lin_y_accel);
+    // printf("Smoothed roll: %f\n", smoothed_roll); add back
+
+    // Start a background measurement; the result is shown once it arrives
+    if (si7021_is_init == 1) {
+        PROFILE_START(PROFILE_SI7021);
+        si7021_read_async(environment_read_callback);
+        PROFILE_END(PROFILE_SI7021);
+    }
+
+    printf("Speed %f m/s, deceleration %f m/s^2 (confidence %f)\n",
+           speed_estimator_speed(&speed_estimator),
+           speed_estimator_deceleration(&speed_estimator),
+           speed_estimator_confidence(&speed_estimator));
+}
+
+// Runs on every fused sample (or every RATE_PLAN_FSM_DECIMATION samples), at
+// the time the sample was taken rather than when its batch was drained
+void run_fsm_step(uint32_t sample_ms) {
+    states_inputs_t fsm_inputs = {
+        .smoothed_roll = smoothed_roll,
+        .deceleration = speed_estimator_deceleration(&speed_estimator),
+        .confidence = speed_estimator_confidence(&speed_estimator),
+        .now_ms = sample_ms,
+    };
+    states current_system_state = states_fsm_update(&system_fsm, &fsm_inputs);
+    pattern_update_state(current_system_state);
+    trip_stats_add_braking(&trip, current_system_state == BRAKE, fsm_inputs.deceleration);
+
+    if (current_system_state != logged_system_state) {
+        ride_log_record_t record = {
+            .type = RIDE_LOG_STATE,
+            .time_ms = sample_ms,
+            .state = current_system_state,
+        };
+        ride_log_write(&record);
+        ble_telemetry_write(&record);
+        logged_system_state = current_system_state;
+    }
+}
+
+// Write the magnetometer calibration in use to flash
+void save_mag_calibration(void) {
+    for (int i = 0; i < 3; i++) {
+        calibration.imu.mag_bias[i] = mag_calibration.bias[i];
+        calibration.imu.mag_scale[i] = mag_calibration.scale[i];
+    }
+    mag_calibration_saved_ms = get_uptime_msecs();
+    ret_code_t error_code = calibration_store_save(&calibration);
+    if (error_code != NRF_SUCCESS) {
+        // Left queued in the store; the next save or parking tries again
+        printf("Calibration save failed: %lu\n", (unsigned long)error_code);
+        return;
+    }
+    mag_calibration_unsaved = false;
+}
+
+// True if the fit is far enough from the stored calibration to be worth a flash write
+bool mag_fit_needs_saving(const mag_calibration_fit_t* fit) {
+    for (int i = 0; i < 3; i++) {
+        if (fabsf(fit->bias[i] - calibration.imu.mag_bias[i]) > MAG_CAL_SAVE_BIAS_CHANGE ||
+            fabsf(fit->scale[i] - calibration.imu.mag_scale[i]) > MAG_CAL_SAVE_SCALE_CHANGE * calibration.imu.mag_scale[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// One slice of the background magnetometer fit; apply a better fit, and store
+// it if it is a large change and the last write was long enough ago
+void update_mag_calibration(void) {
+    mag_calibration_fit_t fit;
+    if (!mag_calibration_step(&mag_calibration, &fit)) {
+        return;
+    }
+
+    set_IMU_magnetometer_correction(fit.bias, fit.scale);
+    mag_calibration_unsaved = true;
+    if (mag_fit_needs_saving(&fit) && get_uptime_msecs() - mag_calibration_saved_ms >= MAG_CAL_SAVE_INTERVAL_MS) {
+        save_mag_calibration();
+    }
+    printf("Magnetometer recalibrated: bias %.1f %.1f %.1f mG, scale %.3f %.3f %.3f (fit error %.1f%%)\n",
+           fit.bias[0], fit.bias[1], fit.bias[2], fit.scale[0], fit.scale[1], fit.scale[2], 100.0f * fit.residual);
+}
+
+// Drain the IMU FIFO and run the AHRS over the new samples
+void IMU_fifo_event_handler(uint32_t data) {
+    static mpu9250_fifo_batch_t IMU_batch;    // static: too large for the stack
+    mpu9250_sample_t IMU_sample;
+
+    // Variables for AHRS calculation
+    float ax, ay, az, gx, gy, gz, mx, my, mz; // variables to hold latest sensor data values
+    orientation_t orientation;
+    bool rotating = false;
+
+    // Samples that arrive from here on are posted as a new event
+    IMU_event_pending = false;
+    if (!IMU_fifo_ready()) {
+        return;
+    }
+
+    sample_hall_edges();
+
+    PROFILE_START(PROFILE_IMU_READ);
+    read_IMU_fifo_batch(&IMU_batch);
+    PROFILE_END(PROFILE_IMU_READ);
+    if (IMU_batch.overflow) {
+        printf("IMU FIFO overflow (%lu)\n", (unsigned long)IMU_fifo_overflow_count());
+    }
+
+    // Samples are evenly spaced, so integrate over the sensor's sample period
+    float time_diff_sec = (float)IMU_batch.sample_period_us / 1000000.0f;
+    uint32_t batch_ms = get_uptime_msecs();
+
+    for (uint16_t i = 0; i < IMU_batch.count; i++) {
+        convert_IMU_sample(&IMU_batch.samples[i], &IMU_sample);
+        ax = IMU_sample.ax;
+        ay = IMU_sample.ay;
+        az = IMU_sample.az;
+        gx = IMU_sample.gx;
+        gy = IMU_sample.gy;
+        gz = IMU_sample.gz;
+        mx = IMU_sample.mx;
+        my = IMU_sample.my;
+        mz = IMU_sample.mz;
+        IMU_read_counter++;
+
+        if (IMU_sample.mag_valid) {
+            float uncorrected_mag[3];
+            convert_IMU_magnetometer_uncorrected(&IMU_batch.samples[i], uncorrected_mag);
+            mag_calibration_add_sample(&mag_calibration, uncorrected_mag);
+        }
+
+        if (gx * gx + gy * gy + gz * gz > PARKING_MOTION_DPS * PARKING_MOTION_DPS) {
+            rotating = true;
+        }
+
+        // Run Madgwick's algorithm, without the magnetometer if it has no new reading
+        PROFILE_START(PROFILE_MADGWICK);
+        if (IMU_sample.mag_valid) {
+            MadgwickQuaternionUpdateFast(q, beta, time_diff_sec, -ax, ay, az, gx * PI / 180.0f, -gy * PI / 180.0f, -gz * PI / 180.0f,  my,  -mx, mz);
+        } else {
+            MadgwickQuaternionUpdateIMU(q, beta, time_diff_sec, -ax, ay, az, gx * PI / 180.0f, -gy * PI / 180.0f, -gz * PI / 180.0f);
+        }
+        PROFILE_END(PROFILE_MADGWICK);
+
+        // Get the Euler angles and accelerations the dashboard needs
+        float accel[3] = {ax, ay, az};
+        PROFILE_START(PROFILE_ORIENTATION);
+        orientation_compute(q, accel, MAGNETIC_DECLINATION, ORIENTATION_FIELDS, &orientation);
+        PROFILE_END(PROFILE_ORIENTATION);
+        float roll = orientation.roll;
+        float lin_ay = orientation.linear_accel[1];
+
+        speed_estimator_update_accel(&speed_estimator, time_diff_sec, LONGITUDINAL_ACCEL_SIGN * lin_ay * GRAVITY);
+        trip_stats_add_orientation(&trip, roll, orientation.pitch);
+
+        // Input AHRS output into smoothing windows
+        PROFILE_START(PROFILE_SMOOTHING);
+        sliding_window_push(&smooth_roll, roll);
+        sliding_window_push(&smooth_lin_y_accel, lin_ay);
+        PROFILE_END(PROFILE_SMOOTHING);
+
+        // The last sample in the batch is the newest
+        uint32_t sample_ms = batch_ms - (uint32_t)(IMU_batch.count - 1 - i) * IMU_batch.sample_period_us / 1000;
+
+        bool log_sample = rate_divider_step(&ride_log_divider, 1);
+        bool stream_sample = rate_divider_step(&telemetry_divider, 1);
+        if (log_sample || stream_sample) {
+            PROFILE_START(PROFILE_RIDE_LOG);
+            ride_log_record_t record = {
+                .type = RIDE_LOG_SAMPLE,
+                .time_ms = sample_ms,
+                .sample = {
+                    .speed = speed_estimator_speed(&speed_estimator),
+                    .distance = hall_velocity_distance(&hall),
+                    .roll = roll,
+                    .lin_ay = lin_ay,
+                },
+            };
+            if (log_sample) {
+                ride_log_write(&record);
+            }
+            if (stream_sample) {
+                ble_telemetry_write(&record);
+            }
+            PROFILE_END(PROFILE_RIDE_LOG);
+        }
+
+        if (rate_divider_step(&fsm_divider, 1)) {
+            smoothed_roll = sliding_window_mean(&smooth_roll);
+            PROFILE_START(PROFILE_FSM);
+            run_fsm_step(sample_ms);
+            PROFILE_END(PROFILE_FSM);
+        }
+    }
+
+    if (rotating) {
+        last_activity_ms = batch_ms;
+    }
+
+    smoothed_roll = sliding_window_mean(&smooth_roll);
+    smoothed_lin_y_accel = sliding_window_mean(&smooth_lin_y_accel);
+
+    PROFILE_START(PROFILE_MAG_CALIBRATION);
+    update_mag_calibration();
+    PROFILE_END(PROFILE_MAG_CALIBRATION);
+
+    if (rate_divider_step(&periodic_divider, IMU_batch.count)) {
+        run_periodic_step();
+    }
+}
+
+void speech_command_event_handler(uint32_t data) {
+    speech_command_t command;
+
+    // Commands that arrive from here on are posted as a new event
+    speech_event_pending = false;
+    while (speech_next_command(&command)) {
+        // Speech is not acted on while parked
+        if (parked) {
+            continue;
+        }
+
+        uint8_t speech_input = command.id;
+        last_activity_ms = get_uptime_msecs();
+        printf("Voice command '%s', handled after %.1f ms\n", speech_convert_reading(speech_input),
+               get_msecs_from_ticks(app_timer_cnt_diff_compute(app_timer_cnt_get(), command.timestamp)));
+        if(speech_input == VOICE_COMMAND_STOP) {
+            states_voice_command(&system_fsm, BRAKE);
+        }
+        if(speech_input == VOICE_COMMAND_LEFT) {
+            states_voice_command(&system_fsm, LEFT);
+        }
+        if(speech_input == VOICE_COMMAND_RIGHT) {
+            states_voice_command(&system_fsm, RIGHT);
+        }
+        if(speech_input == VOICE_COMMAND_NEXT) {
+            display_mode = (display_mode + 1) % NUM_DISPLAY_MODES;
+            printf("Display Mode (Next): %d\n", display_mode);
+        }
+        if(speech_input == VOICE_COMMAND_PREV) {
+            display_mode = (display_mode + NUM_DISPLAY_MODES - 1) % NUM_DISPLAY_MODES;
+            printf("Display Mode (Prev): %d\n", display_mode);
+        }
+    }
+}
+
+void environment_event_handler(uint32_t data) {
+    // A measurement started before parking can finish afterwards
+    if (parked) {
+        return;
+    }
+
+    //printf("Temperature: %f\n", temperature);
+    //printf("Humidity: %f\n", humidity);
+
+    ride_log_record_t record = {
+        .type = RIDE_LOG_ENVIRONMENT,
+        .time_ms = get_uptime_msecs(),
+        .environment = {
+            .temperature = temperature,
+            .humidity = humidity,
+        },
+    };
+    ride_log_write(&record);
+    ble_telemetry_write(&record);
+
+    PROFILE_START(PROFILE_DISPLAY);
+    if (display_mode == DISPLAY_MODE_TEMP) {
+        displayNum(temperature, 0, false, 0);
+        displayStr("*F", 1);
+    } else if (display_mode == DISPLAY_MODE_HUMIDITY) {
+        displayNum(humidity, 0, false, 0);
+        displayStr("*Io", 1);
+    }
+    PROFILE_END(PROFILE_DISPLAY);
+}
+
+// Put the IMU into wake-on-motion and turn off everything that draws current while parked.
+// The Si7021 is only measured from the IMU path, so it stays in standby.
+void enter_parking_mode(void) {
+    printf("Parking after %d s without activity\n", PARKING_TIMEOUT_S);
+
+    app_timer_stop(hall_velocity_calc);
+    ret_code_t error_code = app_timer_start(hall_velocity_calc, APP_TIMER_TICKS(PARKING_TICK_MS), NULL);
+    APP_ERROR_CHECK(error_code);
+
+    // Blank the strip and displays
+    pattern_stop();
+    led_clear();
+    led_show();
+    for (int port = 0; port < 2; port++) {
+        clearMarquee(port);
+        clearDisplay(port);
+    }
+
+    ride_log_flush();
+    if (mag_calibration_unsaved) {
+        save_mag_calibration();
+    }
+    start_IMU_wake_on_motion(PARKING_WOM_THRESHOLD_MG, PARKING_WOM_ODR);
+#if HALL_USE_TIMER_CAPTURE
+    // Stop the capture timers so nothing holds the high frequency clock, and
+    // wake on the next edge from a PORT event
+    error_code = hall_capture_stop(hall_wake_callback);
+    APP_ERROR_CHECK(error_code);
+    hfclk_stop();
+#endif
+
+    // Data ready interrupts have stopped, so from here on the IMU pin means motion
+    wake_event_pending = false;
+    parked = true;
+}
+
+void wake_on_motion_event_handler(uint32_t data) {
+    ret_code_t error_code;
+    wake_event_pending = false;
+    if (!parked) {
+        return;
+    }
+
+#if HALL_USE_TIMER_CAPTURE
+    hfclk_start();
+    error_code = hall_capture_start();
+    APP_ERROR_CHECK(error_code);
+    hall_velocity_resync(&hall);
+#endif
+    stop_IMU_wake_on_motion();
+    start_IMU_burst_mode();
+    start_IMU_fifo_stream(&IMU_fifo_config);
+    parked = false;
+
+    states_fsm_init(&system_fsm);
+    pattern_update_state(IDLE);
+    pattern_start();
+
+    app_timer_stop(hall_velocity_calc);
+    error_code = app_timer_start(hall_velocity_calc, APP_TIMER_TICKS(rate_plan.hall_window_ms), NULL);
+    APP_ERROR_CHECK(error_code);
+
+    last_activity_ms = get_uptime_msecs();
+    printf("Woke in %.1f ms\n", get_msecs_from_ticks(app_timer_cnt_diff_compute(app_timer_cnt_get(), data)));
+}
+
+// Print how much of the last report period the CPU spent awake
+void report_power_stats(void) {
+    uint32_t now = app_timer_cnt_get();
+    uint32_t period_ticks = app_timer_cnt_diff_compute(now, power_report_start);
+    event_queue_stats_t stats;
+    event_queue_get_stats(&stats);
+
+    if (period_ticks > 0) {
+        printf("CPU awake %lu%%, events %lu (dropped %lu, max depth %lu)\n",
+               (unsigned long)(100 - (100ull * sleep_ticks) / period_ticks),
+               (unsigned long)stats.posted, (unsigned long)stats.dropped, (unsigned long)stats.max_depth);
+        printf("Hall edges lost %lu, rejected %lu\n",
+               (unsigned long)hall.lost_edges, (unsigned long)hall.rejected);
+
+        ride_log_stats_t log_stats;
+        ride_log_get_stats(&log_stats);
+        printf("Ride log %lu records, %lu bytes, dropped %lu, flash errors %lu, max erase count %lu\n",
+               (unsigned long)log_stats.records, (unsigned long)log_stats.bytes, (unsigned long)log_stats.dropped,
+               (unsigned long)log_stats.write_errors, (unsigned long)log_stats.max_erase_count);
+        printf("Calibration store flash errors %lu\n", (unsigned long)calibration_store_write_errors());
+
+        ble_telemetry_stats_t link_stats;
+        ble_telemetry_get_stats(&link_stats);
+        if (link_stats.connected) {
+            printf("BLE MTU %u, LL %u bytes, interval %.2f ms (latency %u), PHY %u: %lu records in %lu notifications (%lu bytes), dropped %lu packets, %lu records\n",
+                   link_stats.att_mtu, link_stats.data_length, link_stats.interval_units * 1.25f,
+                   link_stats.slave_latency, link_stats.tx_phy, (unsigned long)link_stats.records,
+                   (unsigned long)link_stats.notifications, (unsigned long)link_stats.bytes,
+                   (unsigned long)link_stats.packets_dropped, (unsigned long)link_stats.records_dropped);
+        }
+    }
+    sleep_ticks = 0;
+    power_report_start = now;
+}
+
 // Create TWI manager instance to read the IMU
 NRF_TWI_MNGR_DEF(twi_mngr_instance, 5, 0);
 
 int main(void) {
     ret_code_t error_code = NRF_SUCCESS; // Don't need to redeclare error_code again
 
-    // Start low frequency clock
+    rate_plan_init(&rate_plan);
+    rate_divider_init(&fsm_divider, rate_plan.fsm_decimation);
+    rate_divider_init(&periodic_divider, rate_plan.periodic_decimation);
+    rate_divider_init(&ride_log_divider, rate_plan.ride_log_decimation);
+    rate_divider_init(&telemetry_divider, rate_plan.telemetry_decimation);
+
+    // Start low frequency clock. With BLE the SoftDevice starts it and owns
+    // the CLOCK peripheral, whose interrupt must still be off when it is enabled.
+#if !BLE_TELEMETRY_ENABLED
     start_lfclock();
+#endif
+
+    // Set up the event queue before any interrupt can post to it
+    event_queue_init();
+    event_queue_register(EVENT_IMU_FIFO, IMU_fifo_event_handler);
+    event_queue_register(EVENT_HALL_WINDOW, hall_window_event_handler);
+    event_queue_register(EVENT_SPEECH_COMMAND, speech_command_event_handler);
+    event_queue_register(EVENT_ENVIRONMENT, environment_event_handler);
+    event_queue_register(EVENT_WAKE_ON_MOTION, wake_on_motion_event_handler);
+    event_queue_register(EVENT_PROFILE_DUMP, profile_dump_event_handler);
+    event_queue_register(EVENT_BLE_TELEMETRY, telemetry_event_handler);
+    profiler_init();
+    error_code = nrf_pwr_mgmt_init();
+    APP_ERROR_CHECK(error_code);
+
+#if BLE_TELEMETRY_ENABLED
+    // Before the timers, which need the LFCLK it starts, and before flash,
+    // which it takes over
+    ble_telemetry_set_callback(telemetry_ready_callback);
+    error_code = ble_telemetry_init(BLE_DEVICE_NAME);
+    APP_ERROR_CHECK(error_code);
+#endif
 
     // initialize GPIO driver
     if (!nrfx_gpiote_is_init()) {
@@ -278,13 +915,24 @@ int main(void) {
 
     // Setup IMU interrupt
     setup_IMU_interrupt();
+    setup_profile_button();
 
     // Setup hall effect sensor
+    speed_estimator_init(&speed_estimator, arc_length);
+    trip_stats_init(&trip, MOUNT_PITCH_DEG, PITCH_UP_SIGN);
+#if HALL_USE_TIMER_CAPTURE
+    hfclk_start(); // Crystal accuracy for the capture timer
+    hall_velocity_init(&hall, arc_length, HALL_CAPTURE_TICKS_PER_SECOND, 0xFFFFFFFF, HALL_MAX_SPEED_MPH);
+    error_code = hall_capture_init(HALL_PIN);
+    APP_ERROR_CHECK(error_code);
+#else
+    hall_velocity_init(&hall, arc_length, 32768, 0xFFFFFF, HALL_MAX_SPEED_MPH);
     setup_Hall_GPIO_interrupt();
+#endif
 
     // Start hall timer
     init_hall_effect_timer();
-    error_code = app_timer_start(hall_velocity_calc, APP_TIMER_TICKS(HALL_EFFECT_TIME_MS), NULL);
+    error_code = app_timer_start(hall_velocity_calc, APP_TIMER_TICKS(rate_plan.hall_window_ms), NULL);
     APP_ERROR_CHECK(error_code);
 
     // Initialize I2C
@@ -295,21 +943,38 @@ int main(void) {
     i2c_config.frequency = NRF_TWIM_FREQ_400K; // Changed to 400k to match the datasheet for MPU9250
     error_code = nrf_twi_mngr_init(&twi_mngr_instance, &i2c_config);
     APP_ERROR_CHECK(error_code);
+    sensor_bus_init(&twi_mngr_instance);
     nrf_delay_ms(50);
 
 
 
-    // Start the IMU and run calibration
+    // Start the IMU and restore its calibration, calibrating only on first boot
     start_IMU_i2c_connection(&twi_mngr_instance);
-    calibrate_gyro_and_accel();
+    error_code = calibration_store_init();
+    APP_ERROR_CHECK(error_code);
+    if (!RECALIBRATE_ON_BOOT && calibration_store_load(&calibration) == NRF_SUCCESS) {
+        set_IMU_calibration(&calibration.imu);
+    } else {
+        printf("No stored calibration, calibrating\n");
+        calibrate_gyro_and_accel();
+        // calibrate_magnetometer(); // Run to generate magnetometer calibration values
+        restore_calibrated_magnetometer_values();
+        get_IMU_calibration(&calibration.imu);
+        error_code = calibration_store_save(&calibration);
+        APP_ERROR_CHECK(error_code);
+    }
+    mag_calibration_init(&mag_calibration, calibration.imu.mag_bias, calibration.imu.mag_scale);
+
+    error_code = ride_log_init();
+    APP_ERROR_CHECK(error_code);
 
     // Init Si7021 Temperature/Humidity Sensor
     si7021_init(&twi_mngr_instance);
     si7021_is_init = 1;
     si7021_reset();
 
-    // calibrate_magnetometer(); // Run to generate magnetometer calibration values
-    restore_calibrated_magnetometer_values();
+    // Let the MPU fetch the magnetometer so each sample is a single I2C burst
+    start_IMU_burst_mode();
 
     // Initialize the LEDs
     uint16_t numLEDs = 9;
@@ -318,258 +983,30 @@ int main(void) {
     pattern_start();
 
 
-    // Initialize the Grove speech recognizer
+    // Initialize the Grove speech recognizer; commands arrive as events
+    speech_set_callback(speech_command_callback);
     speech_init();
 
-    // Init variables for AHRS integration time
-    uint32_t current_time = 0;
-    uint32_t previous_time = 0;
-
-    // Madewick algo hyperparameters; do not change during execution
-    float GyroMeasError = PI * (4.0f / 180.0f);   // gyroscope measurement error in rads/s (start at 40 deg/s)
-    float beta = sqrt(3.0f / 4.0f) * GyroMeasError;   // compute beta
-
-    // Variables for AHRS calculation
-    float pitch, yaw, roll;
-    float a12, a22, a31, a32, a33; // rotation matrix coefficients for Euler angles and gravity components
-    float ax, ay, az, gx, gy, gz, mx, my, mz; // variables to hold latest sensor data values
-    float lin_ax, lin_ay, lin_az;             // linear acceleration (acceleration with gravity component subtracted)
-    float q[4] = {1.0f, 0.0f, 0.0f, 0.0f};    // vector to hold quaternion
-
-    // Arrays to hold smoothed AHRS data
-    float smooth_roll_array[smooth_num] = {0};
-    float smooth_lin_y_accel_array[smooth_num] = {0};
-    uint16_t smoother_array_index = 0;
-
-    float smoothed_roll = 0;
-    float smoothed_lin_y_accel = 0;
-
-    uint16_t IMU_read_counter = 0;
-
-    bool turn_locked = false;
-    uint32_t speech_sensor_triggered_time = 0;
-    float speech_sensor_triggered_time_diff = 0;    
-
-    while(true) {
-        // Get current RTC tick count from hall effect timer
-        current_time = app_timer_cnt_get();
-        uint32_t tick_diff = app_timer_cnt_diff_compute(current_time, previous_time);
-        float time_diff_msec = get_msecs_from_ticks(tick_diff);
-
-        // Read the IMU if new data is available
-        if (IMU_data_ready) {
-            IMU_data_ready = false;
-            read_accelerometer_pointer(&ax, &ay, &az);
-            read_gyro_pointer(&gx, &gy, &gz);
-            read_magnetometer_pointer(&mx, &my, &mz);
-            IMU_read_counter++;
-        }
-
-        uint8_t speech_input = speech_read();
-
-        if (speech_input != 255) {
-            if(speech_input == VOICE_COMMAND_STOP) {
-                voice_recognition_state = BRAKE;
-            }
-            if(speech_input == VOICE_COMMAND_LEFT) {
-                voice_recognition_state = LEFT;
-            }
-            if(speech_input == VOICE_COMMAND_RIGHT) {
-                voice_recognition_state = RIGHT;
-            }
-            if(speech_input == VOICE_COMMAND_NEXT) {
-                display_mode = (display_mode + 1) % NUM_DISPLAY_MODES;
-                printf("Display Mode (Next): %d\n", display_mode);
-            }
-            if(speech_input == VOICE_COMMAND_PREV) {
-                display_mode = (display_mode + NUM_DISPLAY_MODES - 1) % NUM_DISPLAY_MODES;
-                printf("Display Mode (Prev): %d\n", display_mode);
-            }
+    // Stream IMU samples through the hardware FIFO so none are lost while
+    // the loop is busy with the displays or the Si7021
+    IMU_fifo_config.sample_rate_hz = rate_plan.IMU_rate_hz;
+    IMU_fifo_config.dlpf_config = rate_plan.IMU_dlpf_config;
+    IMU_fifo_config.watermark = rate_plan.IMU_batch;
+    start_IMU_fifo_stream(&IMU_fifo_config);
+    rate_plan_print(&rate_plan);
+
+    beta = sqrt(3.0f / 4.0f) * GyroMeasError;   // compute beta
+    states_fsm_init(&system_fsm);
+
+    // Everything else happens in event handlers; sleep until an interrupt posts one
+    power_report_start = app_timer_cnt_get();
+    last_activity_ms = get_uptime_msecs();
+    while (true) {
+        while (event_queue_dispatch()) {
         }
 
-        // Run Madgwick's algorithm
-        MadgwickQuaternionUpdate(q, beta, time_diff_msec, -ax, ay, az, gx * PI / 180.0f, -gy * PI / 180.0f, -gz * PI / 180.0f,  my,  -mx, mz);
-
-        // Get Euler's angles
-        a12 =   2.0f * (q[1] * q[2] + q[0] * q[3]);
-        a22 =   q[0] * q[0] + q[1] * q[1] - q[2] * q[2] - q[3] * q[3];
-        a31 =   2.0f * (q[0] * q[1] + q[2] * q[3]);
-        a32 =   2.0f * (q[1] * q[3] - q[0] * q[2]);
-        a33 =   q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
-        pitch = -asinf(a32);
-        roll  = atan2f(a31, a33);
-        yaw   = atan2f(a12, a22);
-        pitch *= 180.0f / PI;
-        yaw   *= 180.0f / PI;
-        yaw   += 13.2f; // Declination in Belmont, California is 13 degrees 20 minutes 2019-11-30
-        if(yaw < 0) yaw   += 360.0f; // Ensure yaw stays between 0 and 360
-        roll  *= 180.0f / PI;
-        lin_ax = ax + a31;
-        lin_ay = ay + a32;
-        lin_az = az - a33;
-
-        // Input AHRS output into smoothing array
-        smooth_roll_array[smoother_array_index % smooth_num] = roll;
-        smooth_lin_y_accel_array[smoother_array_index % smooth_num] = lin_ay;
-        smoother_array_index++;
-
-        smoothed_roll = sliding_averager_float_array(smooth_roll_array, smooth_num);
-        smoothed_lin_y_accel = sliding_averager_float_array(smooth_lin_y_accel_array, smooth_num);
-
-        if ((IMU_read_counter % 100) == 0) {
-            //printf("Smoothed Y Accel: %f\n", smoothed_lin_y_accel);
-            // printf("Smoothed roll: %f\n", smoothed_roll); add back
-
-            if (si7021_is_init == 1) {
-                float temp = read_temperature();
-                float hum = read_humidity();
-                //printf("Temperature: %f\n", temp);
-                //printf("Humidity: %f\n", hum);
-
-                if (display_mode == DISPLAY_MODE_TEMP) {
-                    displayNum(temp, 0, false, 0);
-                    displayStr("*F", 1);
-                } else if (display_mode == DISPLAY_MODE_HUMIDITY) {
-                    displayNum(hum, 0, false, 0);
-                    displayStr("*Io", 1);
-                }
-            }
-
-            __disable_irq();
-            // float current_speed = (float)hall_revolution_history[hall_revolution_array_index % 4];
-            // float recent_speed_1 = (float)hall_revolution_history[(hall_revolution_array_index - 1) % 4];
-            // float recent_speed_2 = (float)hall_revolution_history[(hall_revolution_array_index - 2) % 4];
-            // float recent_speed_3 = (float)hall_revolution_history[(hall_revolution_array_index - 3) % 4];
-
-            float current_speed = (float)velocity_reading_history[velocity_reading_array_index % 4];
-            float recent_speed_1 = (float)velocity_reading_history[(velocity_reading_array_index - 1) % 4];
-            float recent_speed_2 = (float)velocity_reading_history[(velocity_reading_array_index - 2) % 4];
-            float recent_speed_3 = (float)velocity_reading_history[(velocity_reading_array_index - 3) % 4];
-
-            __enable_irq();
-
-            float speed_diff = current_speed - ((recent_speed_1 * 0.1) + (recent_speed_2 * 0.4) + (recent_speed_3 * 0.5));
-            printf("Weighted Speed Diff: %f\n", speed_diff);
-
-            //displayNum(speed_diff, 2, true, 0);
-
-            
-            //displayNum(smoothed_roll, 2, true, 1);
-
-
-            switch(current_system_state) {
-            case IDLE:
-                // Show speed and distance to rider
-                //CHECK FOR BRAKING SHOULD COME FIRST!!!!
-                //displayStr("A--A", 1);
-                if ((speed_diff < BRAKING_THRESHOLD) | (voice_recognition_state == BRAKE)) {
-                    voice_recognition_state = IDLE;
-                    speech_sensor_triggered_time = app_timer_cnt_get();
-                    current_system_state = BRAKE;
-                } else if ((smoothed_roll > LEFT_THRESHOLD) | (voice_recognition_state == LEFT)) {
-                    speech_sensor_triggered_time = app_timer_cnt_get();
-                    current_system_state = LEFT;
-                } else if ((smoothed_roll < RIGHT_THRESHOLD) | (voice_recognition_state == RIGHT)) {
-                    speech_sensor_triggered_time = app_timer_cnt_get();
-                    current_system_state = RIGHT;
-                }
-                break;
-
-            case BRAKE:
-                speech_sensor_triggered_time_diff = get_msecs_from_ticks(app_timer_cnt_diff_compute(app_timer_cnt_get(), speech_sensor_triggered_time));
-                if (speech_sensor_triggered_time_diff < 3000.0) {
-                    break;
-                } else if ((speech_sensor_triggered_time_diff > 3000.0) && ((voice_recognition_state == BRAKE) | (speed_diff < -8.0))) {
-                    voice_recognition_state = IDLE;
-                    speech_sensor_triggered_time = app_timer_cnt_get();
-                    break;
-                }
-
-                if (smoothed_roll < RIGHT_THRESHOLD) {
-                    current_system_state = RIGHT;
-                    break;
-                } else if (smoothed_roll > LEFT_THRESHOLD) {
-                    current_system_state = LEFT;
-                    break;
-                } else {
-                    current_system_state = IDLE;
-                }
-                break;
-
-            case RIGHT:
-                // Flash Left_green
-                // Again check for breaking
-                //displayStr("A---", 1);
-                if (speed_diff < BRAKING_THRESHOLD) {
-                    voice_recognition_state = IDLE;
-                    turn_locked = false;
-                    current_system_state = BRAKE;
-                    break;
-                }
-                if (smoothed_roll < RIGHT_THRESHOLD) {
-                    turn_locked = true;
-                }
-
-                speech_sensor_triggered_time_diff = get_msecs_from_ticks(app_timer_cnt_diff_compute(app_timer_cnt_get(), speech_sensor_triggered_time));
-
-                if ((voice_recognition_state == RIGHT) && (turn_locked == false) && speech_sensor_triggered_time_diff < 10000.0) {
-                    break;
-                } else if ((voice_recognition_state == RIGHT) && (turn_locked == false) && speech_sensor_triggered_time_diff > 10000.0) {
-                    turn_locked = false;
-                    voice_recognition_state = IDLE;
-                    current_system_state = IDLE;
-                    break;
-                }
-                /*if (smoothed_roll > 10.0) {
-                    turn_locked = false;
-                    voice_recognition_state = IDLE;
-                    current_system_state = LEFT;
-                } else */if (smoothed_roll > -1.0) { // Changed hysteresis for BENCH TESTING!!!
-                    turn_locked = false;
-                    voice_recognition_state = IDLE;
-                    current_system_state = IDLE;
-                }
-                break;
-
-            case LEFT:
-                // Flash Right_green
-                // Again check for breaking
-                //displayStr("A---", 1);
-                if (speed_diff < BRAKING_THRESHOLD) {
-                    voice_recognition_state = IDLE;
-                    turn_locked = false;
-                    current_system_state = BRAKE;
-                    break;
-                }
-                if (smoothed_roll > LEFT_THRESHOLD) {
-                    turn_locked = true;
-                }
-
-                speech_sensor_triggered_time_diff = get_msecs_from_ticks(app_timer_cnt_diff_compute(app_timer_cnt_get(), speech_sensor_triggered_time));
-
-                if ((voice_recognition_state == LEFT) && (turn_locked == false) && speech_sensor_triggered_time_diff < 10000.0) {
-                    break;
-                } else if ((voice_recognition_state == LEFT) && (turn_locked == false) && speech_sensor_triggered_time_diff > 10000.0) {
-                    turn_locked = false;
-                    voice_recognition_state = IDLE;
-                    current_system_state = IDLE;
-                    break;
-                }
-                /*if (smoothed_roll < -10.0) {
-                    turn_locked = false;
-                    voice_recognition_state = IDLE;
-                    current_system_state = RIGHT;
-                } else */if (smoothed_roll < 1.0) { // Changed hysteresis for BENCH TESTING!!!
-                    turn_locked = false;
-                    voice_recognition_state = IDLE;
-                    current_system_state = IDLE;
-                }
-                break;
-            }
-            pattern_update_state(current_system_state);
-        }
-
-        previous_time = current_time;
+        uint32_t sleep_start = app_timer_cnt_get();
+        nrf_pwr_mgmt_run();
+        sleep_ticks += app_timer_cnt_diff_compute(app_timer_cnt_get(), sleep_start);
     }
 }
-
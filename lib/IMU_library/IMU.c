@@ -9,11 +9,14 @@
 #include <stdint.h>
 
 #include "app_error.h"
+#include "app_util_platform.h"
 #include "nrf.h"
 #include "nrf_delay.h"
 #include "nrf_twi_mngr.h"
+#include "app_timer.h"
 
 #include "IMU.h"
+#include "sensor_bus.h"
 
 static uint8_t MPU_ADDRESS = 0x68;
 static uint8_t MAG_ADDRESS = 0x0C;
@@ -24,6 +27,25 @@ float factory_mag_sensitivity[3] = {0};
 float software_mag_bias[3] = {0};
 float software_mag_scale[3] = {0};
 
+// Offset register values from the last calibration
+static int16_t gyro_offset[3] = {0};
+static int16_t accel_offset[3] = {0};
+
+// Set once the MPU's I2C master owns the AK8963 (see start_IMU_burst_mode)
+static bool mag_on_aux_bus = false;
+
+// Hardware FIFO size in bytes
+#define MPU9250_FIFO_SIZE 512
+// TWIM EasyDMA can move at most 255 bytes per transfer on the nRF52832
+#define TWIM_MAX_TRANSFER 255
+
+// FIFO streaming state
+static uint8_t fifo_packet_bytes = 0;
+static uint8_t fifo_watermark = 1;
+static uint32_t fifo_sample_period_us = 0;
+static volatile uint8_t fifo_pending = 0;
+static uint32_t fifo_overflows = 0;
+
 static uint8_t i2c_reg_read(uint8_t i2c_addr, uint8_t reg_addr) {
     uint8_t rx_buf = 0;
     nrf_twi_mngr_transfer_t const read_transfer[] = {
@@ -55,6 +77,53 @@ static void i2c_reg_read_N_bytes(uint8_t i2c_addr, uint8_t reg_addr, int num_byt
     APP_ERROR_CHECK(error_code);
 }
 
+// FIFO drains go through the sensor bus at IMU priority, ahead of any queued
+// environment job, and wait for the transfer instead of taking the bus over
+static sensor_bus_job_t fifo_job;
+static volatile bool fifo_job_done = false;
+static volatile ret_code_t fifo_job_result = NRF_SUCCESS;
+
+static void fifo_job_callback(ret_code_t result, void *p_context) {
+    fifo_job_result = result;
+    fifo_job_done = true;
+}
+
+static void bus_reg_read_N_bytes(uint8_t i2c_addr, uint8_t reg_addr, int num_bytes, uint8_t *buffer) {
+    nrf_twi_mngr_transfer_t const read_transfer[] = {
+        NRF_TWI_MNGR_WRITE(i2c_addr, &reg_addr, 1, NRF_TWI_MNGR_NO_STOP),
+        NRF_TWI_MNGR_READ(i2c_addr, buffer, num_bytes, 0),
+    };
+    fifo_job.p_transfers = read_transfer;
+    fifo_job.number_of_transfers = 2;
+    fifo_job.priority = SENSOR_BUS_PRIORITY_IMU;
+    fifo_job.callback = fifo_job_callback;
+    fifo_job.p_context = NULL;
+
+    fifo_job_done = false;
+    ret_code_t error_code = sensor_bus_schedule(&fifo_job);
+    APP_ERROR_CHECK(error_code);
+    while (!fifo_job_done) {
+        __WFE();
+    }
+    APP_ERROR_CHECK(fifo_job_result);
+}
+
+static void write_offset_registers(void) {
+    i2c_reg_write(MPU_ADDRESS, MPU9250_XG_OFFSET_H, (gyro_offset[0] >> 8) & 0xFF);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_XG_OFFSET_L, gyro_offset[0] & 0xFF);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_YG_OFFSET_H, (gyro_offset[1] >> 8) & 0xFF);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_YG_OFFSET_L, gyro_offset[1] & 0xFF);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_ZG_OFFSET_H, (gyro_offset[2] >> 8) & 0xFF);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_ZG_OFFSET_L, gyro_offset[2] & 0xFF);
+
+    i2c_reg_write(MPU_ADDRESS, MPU9250_XA_OFFSET_H, (accel_offset[0] >> 8) & 0xFF);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_XA_OFFSET_L, accel_offset[0] & 0xFF);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_YA_OFFSET_H, (accel_offset[1] >> 8) & 0xFF);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_YA_OFFSET_L, accel_offset[1] & 0xFF);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_ZA_OFFSET_H, (accel_offset[2] >> 8) & 0xFF);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_ZA_OFFSET_L, accel_offset[2] & 0xFF);
+}
+
 void debug(void) {
     int16_t x_offset = (((uint16_t) i2c_reg_read(MPU_ADDRESS, MPU9250_GYRO_XOUT_H)) << 8 | i2c_reg_read(MPU_ADDRESS, MPU9250_GYRO_XOUT_L));
     int16_t y_offset = (((uint16_t) i2c_reg_read(MPU_ADDRESS, MPU9250_GYRO_YOUT_H)) << 8 | i2c_reg_read(MPU_ADDRESS, MPU9250_GYRO_YOUT_L));
@@ -91,6 +160,8 @@ void calibrate_gyro_and_accel(void) {
     // reset device
     i2c_reg_write(MPU_ADDRESS, MPU9250_PWR_MGMT_1, 0x80); // Write a one to bit 7 reset bit; toggle reset device
     nrf_delay_ms(100);
+    mag_on_aux_bus = false; // reset also disables the I2C master and FIFO
+    fifo_packet_bytes = 0;
 
     // get stable time source; Auto select clock source to be PLL gyroscope reference if ready
     // else use the internal oscillator, bits 2:0 = 001
@@ -160,21 +231,11 @@ void calibrate_gyro_and_accel(void) {
     }
 
     // Construct the gyro biases for push to the hardware gyro bias registers, which are reset to zero upon device startup
-    data[0] = (-gyro_bias[0] / 4 >> 8) & 0xFF; // Divide by 4 to get 32.9 LSB per deg/s to conform to expected bias input format
-    data[1] = (-gyro_bias[0] / 4) & 0xFF; // Biases are additive, so change sign on calculated average gyro biases
-    data[2] = (-gyro_bias[1] / 4 >> 8) & 0xFF;
-    data[3] = (-gyro_bias[1] / 4) & 0xFF;
-    data[4] = (-gyro_bias[2] / 4 >> 8) & 0xFF;
-    data[5] = (-gyro_bias[2] / 4) & 0xFF;
-
-    // Push gyro biases to hardware registers
-
-    i2c_reg_write(MPU_ADDRESS, MPU9250_XG_OFFSET_H, data[0]);
-    i2c_reg_write(MPU_ADDRESS, MPU9250_XG_OFFSET_L, data[1]);
-    i2c_reg_write(MPU_ADDRESS, MPU9250_YG_OFFSET_H, data[2]);
-    i2c_reg_write(MPU_ADDRESS, MPU9250_YG_OFFSET_L, data[3]);
-    i2c_reg_write(MPU_ADDRESS, MPU9250_ZG_OFFSET_H, data[4]);
-    i2c_reg_write(MPU_ADDRESS, MPU9250_ZG_OFFSET_L, data[5]);
+    // Divide by 4 to get 32.9 LSB per deg/s to conform to expected bias input format
+    // Biases are additive, so change sign on calculated average gyro biases
+    gyro_offset[0] = (int16_t) (-gyro_bias[0] / 4);
+    gyro_offset[1] = (int16_t) (-gyro_bias[1] / 4);
+    gyro_offset[2] = (int16_t) (-gyro_bias[2] / 4);
 
 
     // Construct the accelerometer biases for push to the hardware accelerometer bias registers. These registers contain
@@ -205,21 +266,12 @@ void calibrate_gyro_and_accel(void) {
         }
     }
 
-    data[0] = (accel_bias_reg[0] >> 8) & 0xFF;
-    data[1] = (accel_bias_reg[0]) & 0xFF;
-    data[2] = (accel_bias_reg[1] >> 8) & 0xFF;
-    data[3] = (accel_bias_reg[1]) & 0xFF;
-    data[4] = (accel_bias_reg[2] >> 8) & 0xFF;
-    data[5] = (accel_bias_reg[2]) & 0xFF;
+    accel_offset[0] = accel_bias_reg[0];
+    accel_offset[1] = accel_bias_reg[1];
+    accel_offset[2] = accel_bias_reg[2];
 
-    // Push accelerometer biases to hardware registers
-
-    i2c_reg_write(MPU_ADDRESS, MPU9250_XA_OFFSET_H, data[0]);
-    i2c_reg_write(MPU_ADDRESS, MPU9250_XA_OFFSET_L, data[1]);
-    i2c_reg_write(MPU_ADDRESS, MPU9250_YA_OFFSET_H, data[2]);
-    i2c_reg_write(MPU_ADDRESS, MPU9250_YA_OFFSET_L, data[3]);
-    i2c_reg_write(MPU_ADDRESS, MPU9250_ZA_OFFSET_H, data[4]);
-    i2c_reg_write(MPU_ADDRESS, MPU9250_ZA_OFFSET_L, data[5]);
+    // Push gyro and accelerometer biases to hardware registers
+    write_offset_registers();
 
     // Put the correct settings back on////////
     i2c_reg_write(MPU_ADDRESS, MPU9250_PWR_MGMT_1, 0x01);
@@ -250,7 +302,7 @@ void calibrate_gyro_and_accel(void) {
     i2c_reg_write(MAG_ADDRESS, AK8963_CNTL2, 0x01);
     nrf_delay_ms(100);
 
-    // configure magnetometer, enable continuous measurement mode (8 Hz)
+    // configure magnetometer, enable continuous measurement mode 2 (100 Hz)
     i2c_reg_write(MAG_ADDRESS, AK8963_CNTL1, 0x16);
 
 }
@@ -338,6 +390,8 @@ void start_IMU_i2c_connection(const nrf_twi_mngr_t *i2c) {
     // reset IMU
     i2c_reg_write(MPU_ADDRESS, MPU9250_PWR_MGMT_1, 0x80);
     nrf_delay_ms(100);
+    mag_on_aux_bus = false;
+    fifo_packet_bytes = 0;
 
     // disable sleep mode and set clock source to internal high res PLL clock
     i2c_reg_write(MPU_ADDRESS, MPU9250_PWR_MGMT_1, 0x01);
@@ -368,7 +422,7 @@ void start_IMU_i2c_connection(const nrf_twi_mngr_t *i2c) {
     i2c_reg_write(MAG_ADDRESS, AK8963_CNTL2, 0x01);
     nrf_delay_ms(100);
 
-    // configure magnetometer, enable continuous measurement mode (8 Hz)
+    // configure magnetometer, enable continuous measurement mode 2 (100 Hz)
     i2c_reg_write(MAG_ADDRESS, AK8963_CNTL1, 0x16);
 }
 
@@ -386,6 +440,37 @@ void restore_calibrated_magnetometer_values(void) {
     software_mag_scale[2] = 0.807760;
 }
 
+void get_IMU_calibration(mpu9250_calibration_t *calibration) {
+    for (int i = 0; i < 3; i++) {
+        calibration->gyro_offset[i] = gyro_offset[i];
+        calibration->accel_offset[i] = accel_offset[i];
+        calibration->mag_sensitivity[i] = factory_mag_sensitivity[i];
+        calibration->mag_bias[i] = software_mag_bias[i];
+        calibration->mag_scale[i] = software_mag_scale[i];
+    }
+}
+
+void set_IMU_calibration(const mpu9250_calibration_t *calibration) {
+    for (int i = 0; i < 3; i++) {
+        gyro_offset[i] = calibration->gyro_offset[i];
+        accel_offset[i] = calibration->accel_offset[i];
+        factory_mag_sensitivity[i] = calibration->mag_sensitivity[i];
+        software_mag_bias[i] = calibration->mag_bias[i];
+        software_mag_scale[i] = calibration->mag_scale[i];
+    }
+    write_offset_registers();
+}
+
+void set_IMU_magnetometer_correction(const float bias[3], const float scale[3]) {
+    // A reading never mixes old and new values
+    CRITICAL_REGION_ENTER();
+    for (int i = 0; i < 3; i++) {
+        software_mag_bias[i] = bias[i];
+        software_mag_scale[i] = scale[i];
+    }
+    CRITICAL_REGION_EXIT();
+}
+
 void read_accelerometer_pointer(float *ax, float *ay, float *az) {
     // read values
     int16_t x_val = (((uint16_t)i2c_reg_read(MPU_ADDRESS, MPU9250_ACCEL_XOUT_H)) << 8) | i2c_reg_read(MPU_ADDRESS, MPU9250_ACCEL_XOUT_L);
@@ -411,30 +496,283 @@ void read_gyro_pointer(float *gx, float *gy, float *gz) {
     *gz = ((float)z_val) / 131;
 }
 
+// Convert raw magnetometer counts to calibrated milligaus
+static void convert_magnetometer_counts(int16_t x_val, int16_t y_val, int16_t z_val, float *mx, float *my, float *mz) {
+    // convert to milligaus --> (1mg = 1000uT)
+
+    float x = x_val * ((10.0 * 4912.0) / 32760.0) * factory_mag_sensitivity[0] - software_mag_bias[0];
+    float y = y_val * ((10.0 * 4912.0) / 32760.0) * factory_mag_sensitivity[1] - software_mag_bias[1];
+    float z = z_val * ((10.0 * 4912.0) / 32760.0) * factory_mag_sensitivity[2] - software_mag_bias[2];
+
+    *mx = x * software_mag_scale[0];
+    *my = y * software_mag_scale[1];
+    *mz = z * software_mag_scale[2];
+}
+
 void read_magnetometer_pointer(float *mx, float *my, float *mz) {
     // read data
     // must read 8 bytes starting at the first status register
-    uint8_t reg_addr = AK8963_ST1;
     uint8_t rx_buf[8] = {0};
-    nrf_twi_mngr_transfer_t const read_transfer[] = {
-        NRF_TWI_MNGR_WRITE(MAG_ADDRESS, &reg_addr, 1, NRF_TWI_MNGR_NO_STOP),
-        NRF_TWI_MNGR_READ(MAG_ADDRESS, rx_buf, 8, 0),
-    };
-    ret_code_t error_code = nrf_twi_mngr_perform(i2c_manager, NULL, read_transfer, 2, NULL);
-    APP_ERROR_CHECK(error_code);
+    if (mag_on_aux_bus) {
+        // The AK8963 is hidden behind the MPU's I2C master; read its shadow copy
+        i2c_reg_read_N_bytes(MPU_ADDRESS, MPU9250_EXT_SENS_DATA_00, 8, rx_buf);
+    } else {
+        i2c_reg_read_N_bytes(MAG_ADDRESS, AK8963_ST1, 8, rx_buf);
+    }
 
     // determine values
     int16_t x_val = (((uint16_t)rx_buf[2]) << 8) | rx_buf[1];
     int16_t y_val = (((uint16_t)rx_buf[4]) << 8) | rx_buf[3];
     int16_t z_val = (((uint16_t)rx_buf[6]) << 8) | rx_buf[5];
 
-    // convert to milligaus --> (1mg = 1000uT)
+    convert_magnetometer_counts(x_val, y_val, z_val, mx, my, mz);
+}
 
-    float x = x_val * ((10.0 * 4912.0) / 32760.0) * factory_mag_sensitivity[0] - software_mag_bias[0];
-    float y = y_val * ((10.0 * 4912.0) / 32760.0) * factory_mag_sensitivity[1] - software_mag_bias[1];
-    float z = z_val * ((10.0 * 4912.0) / 32760.0) * factory_mag_sensitivity[2] - software_mag_bias[2];
+void start_IMU_burst_mode(void) {
+    // Stop reading the AK8963 directly and let the MPU fetch it for us:
+    // disable bypass (keep "clear interrupt on any read")
+    i2c_reg_write(MPU_ADDRESS, MPU9250_INT_PIN_CFG, 0x10);
+    nrf_delay_ms(3);
 
-    *mx = x * software_mag_scale[0];
-    *my = y * software_mag_scale[1];
-    *mz = z * software_mag_scale[2];
-}
\ No newline at end of file
+    // I2C master clock at 400 kHz, wait for external sensor data before raising data ready
+    i2c_reg_write(MPU_ADDRESS, MPU9250_I2C_MST_CTRL, 0x4D);
+    // Shadow external sensor data only once all of it has been received
+    i2c_reg_write(MPU_ADDRESS, MPU9250_I2C_MST_DELAY_CTRL, 0x80);
+
+    // Slave 0: read 8 bytes from AK8963 ST1 into EXT_SENS_DATA_00..07 every sample
+    i2c_reg_write(MPU_ADDRESS, MPU9250_I2C_SLV0_ADDR, 0x80 | MAG_ADDRESS);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_I2C_SLV0_REG, AK8963_ST1);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_I2C_SLV0_CTRL, 0x88);
+
+    // Enable the I2C master
+    i2c_reg_write(MPU_ADDRESS, MPU9250_USER_CTRL, 0x20);
+    nrf_delay_ms(10);
+
+    mag_on_aux_bus = true;
+}
+
+// Decode one ACCEL_XOUT_H..GYRO_ZOUT_L (+ EXT_SENS_DATA_00..07) block into a raw sample
+static void decode_IMU_sample(const uint8_t *data, bool has_mag, mpu9250_raw_sample_t *sample) {
+    sample->accel[0] = (int16_t) (((uint16_t) data[0] << 8) | data[1]);
+    sample->accel[1] = (int16_t) (((uint16_t) data[2] << 8) | data[3]);
+    sample->accel[2] = (int16_t) (((uint16_t) data[4] << 8) | data[5]);
+    sample->temperature = (int16_t) (((uint16_t) data[6] << 8) | data[7]);
+    sample->gyro[0] = (int16_t) (((uint16_t) data[8] << 8) | data[9]);
+    sample->gyro[1] = (int16_t) (((uint16_t) data[10] << 8) | data[11]);
+    sample->gyro[2] = (int16_t) (((uint16_t) data[12] << 8) | data[13]);
+
+    if (!has_mag) {
+        sample->mag_status_1 = 0; // never reported as new data
+        sample->mag[0] = sample->mag[1] = sample->mag[2] = 0;
+        sample->mag_status_2 = 0;
+        return;
+    }
+
+    // AK8963 registers are little-endian
+    sample->mag_status_1 = data[14];
+    sample->mag[0] = (int16_t) (((uint16_t) data[16] << 8) | data[15]);
+    sample->mag[1] = (int16_t) (((uint16_t) data[18] << 8) | data[17]);
+    sample->mag[2] = (int16_t) (((uint16_t) data[20] << 8) | data[19]);
+    sample->mag_status_2 = data[21];
+}
+
+void read_IMU_sample_raw(mpu9250_raw_sample_t *sample) {
+    uint8_t data[MPU9250_SAMPLE_BYTES];
+    i2c_reg_read_N_bytes(MPU_ADDRESS, MPU9250_ACCEL_XOUT_H, MPU9250_SAMPLE_BYTES, data);
+    decode_IMU_sample(data, true, sample);
+}
+
+void convert_IMU_magnetometer_uncorrected(const mpu9250_raw_sample_t *raw, float m[3]) {
+    for (int i = 0; i < 3; i++) {
+        m[i] = raw->mag[i] * ((10.0 * 4912.0) / 32760.0) * factory_mag_sensitivity[i];
+    }
+}
+
+void convert_IMU_sample(const mpu9250_raw_sample_t *raw, mpu9250_sample_t *sample) {
+    // convert to g at +/- 2g resolution
+    sample->ax = ((float)raw->accel[0]) / 16384;
+    sample->ay = ((float)raw->accel[1]) / 16384;
+    sample->az = ((float)raw->accel[2]) / 16384;
+
+    // Convert to degrees at +/- 250deg/sec resolution
+    sample->gx = ((float)raw->gyro[0]) / 131;
+    sample->gy = ((float)raw->gyro[1]) / 131;
+    sample->gz = ((float)raw->gyro[2]) / 131;
+
+    // Die temperature in degrees C (RM-MPU-9250A-00 section 4.23)
+    sample->temperature = ((float)raw->temperature) / 333.87 + 21.0;
+
+    convert_magnetometer_counts(raw->mag[0], raw->mag[1], raw->mag[2], &sample->mx, &sample->my, &sample->mz);
+    sample->mag_valid = (raw->mag_status_1 & 0x01) && !(raw->mag_status_2 & 0x08);
+}
+
+// USER_CTRL value that keeps the I2C master running if it owns the AK8963
+static uint8_t user_ctrl_base(void) {
+    return mag_on_aux_bus ? 0x20 : 0x00;
+}
+
+// Takes samples off the pending count without losing increments from
+// IMU_fifo_interrupt_handler that land in between; stops at 0 since the FIFO
+// can hold samples whose interrupts were already counted or capped
+static void fifo_pending_consume(uint8_t samples) {
+    uint8_t pending = __atomic_load_n(&fifo_pending, __ATOMIC_RELAXED);
+    uint8_t remaining;
+    do {
+        remaining = pending > samples ? pending - samples : 0;
+    } while (!__atomic_compare_exchange_n(&fifo_pending, &pending, remaining, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void reset_fifo(void) {
+    uint8_t discarded = __atomic_load_n(&fifo_pending, __ATOMIC_RELAXED);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_USER_CTRL, user_ctrl_base());        // Stop FIFO
+    i2c_reg_write(MPU_ADDRESS, MPU9250_USER_CTRL, user_ctrl_base() | 0x04); // Reset FIFO
+    i2c_reg_write(MPU_ADDRESS, MPU9250_USER_CTRL, user_ctrl_base() | 0x40); // Enable FIFO
+    fifo_pending_consume(discarded);
+}
+
+void start_IMU_fifo_stream(const mpu9250_fifo_config_t *config) {
+    uint16_t rate = config->sample_rate_hz;
+    if (rate < 4) {
+        rate = 4;
+    } else if (rate > 1000) {
+        rate = 1000;
+    }
+    uint8_t divider = (1000 / rate) - 1;
+    fifo_sample_period_us = 1000 * (1 + (uint32_t)divider);
+    fifo_watermark = config->watermark ? config->watermark : 1;
+
+    // DLPF_CFG 0 and 7 run the gyro at 8 kHz, which SMPLRT_DIV above does not
+    // account for; use the widest 1 kHz setting instead
+    uint8_t dlpf_config = config->dlpf_config;
+    if (dlpf_config < 1 || dlpf_config > 6) {
+        dlpf_config = 1;
+    }
+
+    // Low pass filter; FIFO_MODE set so a full FIFO drops new samples instead of
+    // overwriting old ones, which keeps the packets already in it aligned
+    i2c_reg_write(MPU_ADDRESS, MPU9250_CONFIG, 0x40 | dlpf_config);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_SMPLRT_DIV, divider);
+
+    // Temperature, gyro and accel, plus slave 0 (the AK8963 block) when available
+    uint8_t fifo_enable = 0xF8;
+    fifo_packet_bytes = 14;
+    if (mag_on_aux_bus) {
+        fifo_enable |= 0x01;
+        fifo_packet_bytes = MPU9250_SAMPLE_BYTES;
+    }
+
+    i2c_reg_write(MPU_ADDRESS, MPU9250_FIFO_EN, 0x00);
+    reset_fifo();
+    i2c_reg_write(MPU_ADDRESS, MPU9250_FIFO_EN, fifo_enable);
+    fifo_overflows = 0;
+}
+
+void stop_IMU_fifo_stream(void) {
+    i2c_reg_write(MPU_ADDRESS, MPU9250_FIFO_EN, 0x00);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_USER_CTRL, user_ctrl_base());
+    fifo_packet_bytes = 0;
+}
+
+void IMU_fifo_interrupt_handler(void) {
+    if (fifo_pending < 0xFF) {
+        fifo_pending++;
+    }
+}
+
+bool IMU_fifo_ready(void) {
+    return fifo_packet_bytes && fifo_pending >= fifo_watermark;
+}
+
+void read_IMU_fifo_batch(mpu9250_fifo_batch_t *batch) {
+    static uint8_t fifo_data[TWIM_MAX_TRANSFER];
+
+    batch->count = 0;
+    batch->overflow = false;
+    batch->sample_period_us = fifo_sample_period_us;
+    if (!fifo_packet_bytes) {
+        return;
+    }
+
+    bus_reg_read_N_bytes(MPU_ADDRESS, MPU9250_FIFO_COUNTH, 2, fifo_data);
+    batch->timestamp = app_timer_cnt_get();
+    uint16_t fifo_count = ((uint16_t)(fifo_data[0] & 0x1F) << 8) | fifo_data[1];
+
+    // A full FIFO stops accepting data part way through a packet
+    if ((fifo_count % fifo_packet_bytes) != 0 || fifo_count + fifo_packet_bytes > MPU9250_FIFO_SIZE) {
+        batch->overflow = true;
+        fifo_overflows++;
+    }
+
+    uint16_t packets = fifo_count / fifo_packet_bytes;
+    if (packets > IMU_FIFO_MAX_BATCH) {
+        packets = IMU_FIFO_MAX_BATCH;
+    }
+
+    // Drain as many whole packets per FIFO_R_W burst as a single transfer allows
+    uint8_t packets_per_burst = TWIM_MAX_TRANSFER / fifo_packet_bytes;
+    while (batch->count < packets) {
+        uint8_t burst = packets - batch->count;
+        if (burst > packets_per_burst) {
+            burst = packets_per_burst;
+        }
+        bus_reg_read_N_bytes(MPU_ADDRESS, MPU9250_FIFO_R_W, burst * fifo_packet_bytes, fifo_data);
+        for (uint8_t i = 0; i < burst; i++) {
+            decode_IMU_sample(&fifo_data[i * fifo_packet_bytes], mag_on_aux_bus, &batch->samples[batch->count++]);
+        }
+    }
+    fifo_pending_consume(batch->count);
+
+    if (batch->overflow) {
+        reset_fifo();
+    }
+}
+
+uint32_t IMU_fifo_overflow_count(void) {
+    return fifo_overflows;
+}
+
+void start_IMU_wake_on_motion(uint16_t threshold_mg, uint8_t lp_accel_odr) {
+    stop_IMU_fifo_stream();
+
+    // Take the AK8963 back from the I2C master and power it down through bypass
+    i2c_reg_write(MPU_ADDRESS, MPU9250_I2C_SLV0_CTRL, 0x00);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_USER_CTRL, 0x00);
+    mag_on_aux_bus = false;
+    nrf_delay_ms(3);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_INT_PIN_CFG, 0x12);
+    nrf_delay_ms(3);
+    i2c_reg_write(MAG_ADDRESS, AK8963_CNTL1, 0x00);
+
+    // Accelerometer only, 184 Hz accel low pass as the WOM sequence requires
+    i2c_reg_write(MPU_ADDRESS, MPU9250_PWR_MGMT_1, 0x00);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_PWR_MGMT_2, 0x07);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_ACCEL_CONFIG_2, 0x01);
+
+    // Interrupt on motion only, comparing each sample with the previous one
+    i2c_reg_write(MPU_ADDRESS, MPU9250_INT_ENABLE, 0x40);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_MOT_DETECT_CTRL, 0xC0);
+
+    // 4 mg per LSB
+    uint16_t threshold = threshold_mg / 4;
+    if (threshold > 0xFF) {
+        threshold = 0xFF;
+    }
+    i2c_reg_write(MPU_ADDRESS, MPU9250_WOM_THR, threshold);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_LP_ACCEL_ODR, lp_accel_odr & 0x0F);
+
+    // Cycle mode: sleep between accelerometer samples
+    i2c_reg_write(MPU_ADDRESS, MPU9250_PWR_MGMT_1, 0x20);
+}
+
+void stop_IMU_wake_on_motion(void) {
+    // Leave cycle mode, back on the PLL clock with the gyro enabled
+    i2c_reg_write(MPU_ADDRESS, MPU9250_PWR_MGMT_1, 0x01);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_PWR_MGMT_2, 0x00);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_MOT_DETECT_CTRL, 0x00);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_ACCEL_CONFIG_2, 0x00);
+    i2c_reg_write(MPU_ADDRESS, MPU9250_INT_ENABLE, 0x01);
+
+    // Magnetometer back to continuous measurement mode 2 (100 Hz)
+    i2c_reg_write(MAG_ADDRESS, AK8963_CNTL1, 0x16);
+    nrf_delay_ms(1);
+}
@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "app_error.h"
 #include "nrf_twi_mngr.h"
 
@@ -35,6 +38,28 @@ restore_calibrated_magnetometer_values() function
 */
 void restore_calibrated_magnetometer_values(void);
 
+// Everything the calibration routines produce, to be stored and restored per unit
+typedef struct {
+	int16_t gyro_offset[3];      // XG/YG/ZG_OFFSET register values
+	int16_t accel_offset[3];     // XA/YA/ZA_OFFSET register values, factory trim included
+	float mag_sensitivity[3];    // AK8963 factory adjustment
+	float mag_bias[3];           // Hard iron, milligaus
+	float mag_scale[3];          // Soft iron, per axis
+} mpu9250_calibration_t;
+
+// The current calibration
+void get_IMU_calibration(mpu9250_calibration_t *calibration);
+
+/*
+Use a stored calibration instead of running calibrate_gyro_and_accel() and
+calibrate_magnetometer(). Writes the offset registers, so call it after
+start_IMU_i2c_connection().
+*/
+void set_IMU_calibration(const mpu9250_calibration_t *calibration);
+
+// Replace the hard iron bias (milligaus) and soft iron scales in one step
+void set_IMU_magnetometer_correction(const float bias[3], const float scale[3]);
+
 // Read accel and return value in g's
 
 void read_accelerometer_pointer(float *ax, float *ay, float *az);
@@ -46,6 +71,115 @@ void read_gyro_pointer(float *gx, float *gy, float *gz);
 // Read magnetometer and return value in milligaus
 void read_magnetometer_pointer(float *mx, float *my, float *mz);
 
+/*
+Raw sample as laid out in the MPU-9250 register map, starting at ACCEL_XOUT_H.
+Accel/temp/gyro are big-endian on the wire; the AK8963 block (ST1..ST2) is
+little-endian. Both are converted to host order when the sample is decoded.
+*/
+typedef struct __attribute__((packed)) {
+	int16_t accel[3];
+	int16_t temperature;
+	int16_t gyro[3];
+	uint8_t mag_status_1;  // AK8963 ST1, bit 0 = new data ready
+	int16_t mag[3];
+	uint8_t mag_status_2;  // AK8963 ST2, bit 3 = magnetic sensor overflow
+} mpu9250_raw_sample_t;
+
+// Number of bytes read per sample: 14 accel/temp/gyro + 8 AK8963 ST1..ST2
+#define MPU9250_SAMPLE_BYTES 22
+
+// Sample converted to g's, degrees/second, milligaus and degrees C
+typedef struct {
+	float ax, ay, az;
+	float gx, gy, gz;
+	float mx, my, mz;
+	float temperature;
+	bool mag_valid;        // true if the magnetometer values are new and not saturated
+} mpu9250_sample_t;
+
+/*
+Hand the AK8963 over to the MPU's I2C master so every magnetometer reading is
+shadowed into EXT_SENS_DATA_00..07 at the sample rate. After this call the
+whole sample can be fetched with a single burst by read_IMU_sample_raw().
+Run this after calibrate_gyro_and_accel()/calibrate_magnetometer(), which
+talk to the AK8963 directly through bypass mode.
+*/
+void start_IMU_burst_mode(void);
+
+// Read accel, temperature, gyro and magnetometer in one I2C transaction
+void read_IMU_sample_raw(mpu9250_raw_sample_t *sample);
+
+// Convert a raw sample to physical units using the current calibration
+void convert_IMU_sample(const mpu9250_raw_sample_t *raw, mpu9250_sample_t *sample);
+
+// Magnetometer reading in milligaus with only the factory sensitivity applied,
+// for fitting a new hard and soft iron correction
+void convert_IMU_magnetometer_uncorrected(const mpu9250_raw_sample_t *raw, float m[3]);
+
+// FIFO streaming configuration
+typedef struct {
+	uint16_t sample_rate_hz;   // 4..1000 Hz, realised as 1 kHz / (1 + SMPLRT_DIV)
+	uint8_t dlpf_config;       // CONFIG register low-pass setting, 1..6; 0 and 7 (8 kHz) fall back to 1
+	uint8_t watermark;         // packets to collect before IMU_fifo_ready() reports true
+} mpu9250_fifo_config_t;
+
+// The FIFO holds 512 bytes, i.e. 36 packets without the magnetometer (23 with)
+#define IMU_FIFO_MAX_BATCH 36
+
+typedef struct {
+	mpu9250_raw_sample_t samples[IMU_FIFO_MAX_BATCH]; // oldest first
+	uint16_t count;
+	uint32_t timestamp;        // app_timer ticks when the newest sample was drained
+	uint32_t sample_period_us;
+	bool overflow;             // FIFO filled up and was reset; samples were lost after this batch
+} mpu9250_fifo_batch_t;
+
+/*
+Continuously stream accel, temperature, gyro (and the magnetometer if
+start_IMU_burst_mode() was called) into the hardware FIFO at the configured
+rate. Samples keep accumulating in the sensor while the main loop is busy.
+*/
+void start_IMU_fifo_stream(const mpu9250_fifo_config_t *config);
+void stop_IMU_fifo_stream(void);
+
+/*
+The MPU-9250 has no FIFO watermark interrupt, so the watermark is counted in
+software: call this from the data-ready GPIOTE handler.
+*/
+void IMU_fifo_interrupt_handler(void);
+
+// True once at least `watermark` samples arrived since the last drain
+bool IMU_fifo_ready(void);
+
+/*
+Drain every complete packet from the FIFO, a burst of several packets per
+FIFO_R_W transfer. If the FIFO overflowed, the packets already in it are
+returned and the FIFO is reset so the stream resynchronises on a packet
+boundary. The reads are queued on the sensor bus (sensor_bus_init must have
+been called) at IMU priority and waited for.
+*/
+void read_IMU_fifo_batch(mpu9250_fifo_batch_t *batch);
+
+// Number of FIFO overflows detected since streaming started
+uint32_t IMU_fifo_overflow_count(void);
+
+/*
+Low-power wake-on-motion, for parking. Stops the FIFO stream, powers down the
+gyro and the AK8963 and leaves the accelerometer waking up at `lp_accel_odr`
+(LP_ACCEL_ODR setting: 0 = 0.24 Hz, doubling up to 11 = 500 Hz) to compare
+each sample against the previous one. A change of more than `threshold_mg` on
+any axis raises the interrupt pin, in place of data ready.
+*/
+void start_IMU_wake_on_motion(uint16_t threshold_mg, uint8_t lp_accel_odr);
+
+/*
+Back to full operation: gyro, magnetometer and data ready interrupts on, with
+the AK8963 reachable through bypass mode as after start_IMU_i2c_connection().
+Follow with start_IMU_burst_mode() and start_IMU_fifo_stream(). The gyro
+needs about 35 ms to settle after this.
+*/
+void stop_IMU_wake_on_motion(void);
+
 // Enums of accel/gryo and mag registers
 
 typedef enum {
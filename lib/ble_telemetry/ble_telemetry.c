@@ -0,0 +1,374 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "app_util.h"
+#include "ble.h"
+#include "ble_advdata.h"
+#include "ble_hci.h"
+#include "ble_srv_common.h"
+#include "nrf_ble_gatt.h"
+#include "nrf_sdh.h"
+#include "nrf_sdh_ble.h"
+
+#include "ble_telemetry.h"
+
+#define CONN_CFG_TAG 1
+#define BLE_OBSERVER_PRIO 3
+
+// 7b1cxxxx-5a5e-4b5e-9d1a-62696b650000, little endian
+static const ble_uuid128_t uuid_base = {{
+  0x00, 0x00, 0x65, 0x6b, 0x69, 0x62, 0x1a, 0x9d, 0x5e, 0x4b, 0x5e, 0x5a, 0x00, 0x00, 0x1c, 0x7b,
+}};
+#define TELEMETRY_SERVICE_UUID 0x1000
+#define TELEMETRY_CHAR_UUID 0x1001
+
+static const ble_gap_conn_params_t conn_params = {
+  .min_conn_interval = MSEC_TO_UNITS(BLE_TELEMETRY_MIN_INTERVAL_MS, UNIT_1_25_MS),
+  .max_conn_interval = MSEC_TO_UNITS(BLE_TELEMETRY_MAX_INTERVAL_MS, UNIT_1_25_MS),
+  .slave_latency = BLE_TELEMETRY_SLAVE_LATENCY,
+  .conn_sup_timeout = MSEC_TO_UNITS(BLE_TELEMETRY_SUPERVISION_MS, UNIT_10_MS),
+};
+
+NRF_BLE_GATT_DEF(gatt);
+
+static uint8_t uuid_type;
+static uint16_t service_handle;
+static ble_gatts_char_handles_t telemetry_handles;
+
+static uint8_t adv_handle = BLE_GAP_ADV_SET_HANDLE_NOT_SET;
+static uint8_t adv_buffer[BLE_GAP_ADV_SET_DATA_SIZE_MAX];
+static uint8_t scan_response_buffer[BLE_GAP_ADV_SET_DATA_SIZE_MAX];
+static ble_gap_adv_data_t adv_data = {
+  .adv_data = {.p_data = adv_buffer, .len = BLE_GAP_ADV_SET_DATA_SIZE_MAX},
+  .scan_rsp_data = {.p_data = scan_response_buffer, .len = BLE_GAP_ADV_SET_DATA_SIZE_MAX},
+};
+
+// Link state, written from the SoftDevice interrupt
+static volatile uint16_t conn_handle = BLE_CONN_HANDLE_INVALID;
+static volatile bool notifying = false;
+static volatile bool link_reset = false;
+static volatile uint16_t att_mtu = BLE_GATT_ATT_MTU_DEFAULT;
+static ble_telemetry_stats_t link;
+static void (*ready_callback)(void) = NULL;
+
+// Packets, owned by the main loop
+static telemetry_queue_t queue;
+static uint16_t queue_mtu = BLE_GATT_ATT_MTU_DEFAULT;
+
+static void link_ready(void) {
+  if (ready_callback) {
+    ready_callback();
+  }
+}
+
+static ret_code_t advertising_start(void) {
+  return sd_ble_gap_adv_start(adv_handle, CONN_CFG_TAG);
+}
+
+static void gatt_event_handler(nrf_ble_gatt_t* p_gatt, nrf_ble_gatt_evt_t const* p_evt) {
+  if (p_evt->evt_id == NRF_BLE_GATT_EVT_ATT_MTU_UPDATED) {
+    att_mtu = p_evt->params.att_mtu_effective;
+  } else if (p_evt->evt_id == NRF_BLE_GATT_EVT_DATA_LENGTH_UPDATED) {
+    link.data_length = p_evt->params.data_length;
+  }
+}
+
+static void ble_event_handler(ble_evt_t const* p_ble_evt, void* p_context) {
+  ret_code_t error_code = NRF_SUCCESS;
+
+  switch (p_ble_evt->header.evt_id) {
+    case BLE_GAP_EVT_CONNECTED: {
+      conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+      const ble_gap_conn_params_t* params = &p_ble_evt->evt.gap_evt.params.connected.conn_params;
+      link.interval_units = params->max_conn_interval;
+      link.slave_latency = params->slave_latency;
+      link.tx_phy = BLE_GAP_PHY_1MBPS;
+
+      // Half the time on air for the same packet
+      ble_gap_phys_t phys = {.tx_phys = BLE_GAP_PHY_2MBPS, .rx_phys = BLE_GAP_PHY_2MBPS};
+      error_code = sd_ble_gap_phy_update(conn_handle, &phys);
+      APP_ERROR_CHECK(error_code);
+      // Centrals usually connect fast for service discovery; ask for the
+      // slower telemetry interval straight away. The central may refuse.
+      sd_ble_gap_conn_param_update(conn_handle, &conn_params);
+      break;
+    }
+
+    case BLE_GAP_EVT_DISCONNECTED:
+      conn_handle = BLE_CONN_HANDLE_INVALID;
+      notifying = false;
+      link_reset = true;
+      att_mtu = BLE_GATT_ATT_MTU_DEFAULT;
+      error_code = advertising_start();
+      APP_ERROR_CHECK(error_code);
+      break;
+
+    case BLE_GAP_EVT_CONN_PARAM_UPDATE: {
+      const ble_gap_conn_params_t* params = &p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params;
+      link.interval_units = params->max_conn_interval;
+      link.slave_latency = params->slave_latency;
+      break;
+    }
+
+    case BLE_GAP_EVT_PHY_UPDATE_REQUEST: {
+      ble_gap_phys_t phys = {.tx_phys = BLE_GAP_PHY_AUTO, .rx_phys = BLE_GAP_PHY_AUTO};
+      error_code = sd_ble_gap_phy_update(p_ble_evt->evt.gap_evt.conn_handle, &phys);
+      APP_ERROR_CHECK(error_code);
+      break;
+    }
+
+    case BLE_GAP_EVT_PHY_UPDATE:
+      if (p_ble_evt->evt.gap_evt.params.phy_update.status == BLE_HCI_STATUS_CODE_SUCCESS) {
+        link.tx_phy = p_ble_evt->evt.gap_evt.params.phy_update.tx_phy;
+      }
+      break;
+
+    case BLE_GAP_EVT_SEC_PARAMS_REQUEST:
+      error_code = sd_ble_gap_sec_params_reply(conn_handle, BLE_GAP_SEC_STATUS_PAIRING_NOT_SUPP, NULL, NULL);
+      APP_ERROR_CHECK(error_code);
+      break;
+
+    case BLE_GATTS_EVT_SYS_ATTR_MISSING:
+      error_code = sd_ble_gatts_sys_attr_set(conn_handle, NULL, 0, 0);
+      APP_ERROR_CHECK(error_code);
+      break;
+
+    case BLE_GATTS_EVT_WRITE: {
+      const ble_gatts_evt_write_t* write = &p_ble_evt->evt.gatts_evt.params.write;
+      if (write->handle == telemetry_handles.cccd_handle && write->len == 2) {
+        notifying = ble_srv_is_notification_enabled(write->data);
+        link_ready();
+      }
+      break;
+    }
+
+    case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+      link_ready();
+      break;
+
+    case BLE_GATTC_EVT_TIMEOUT:
+      sd_ble_gap_disconnect(p_ble_evt->evt.gattc_evt.conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+      break;
+
+    case BLE_GATTS_EVT_TIMEOUT:
+      sd_ble_gap_disconnect(p_ble_evt->evt.gatts_evt.conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+      break;
+
+    default:
+      break;
+  }
+}
+
+NRF_SDH_BLE_OBSERVER(ble_observer, BLE_OBSERVER_PRIO, ble_event_handler, NULL);
+
+static ret_code_t stack_init(void) {
+  ret_code_t error_code = nrf_sdh_enable_request();
+  if (error_code != NRF_SUCCESS) {
+    return error_code;
+  }
+
+  uint32_t ram_start = 0;
+  error_code = nrf_sdh_ble_default_cfg_set(CONN_CFG_TAG, &ram_start);
+  if (error_code != NRF_SUCCESS) {
+    return error_code;
+  }
+
+  // Let the SoftDevice hold a full queue of notifications
+  ble_cfg_t cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.conn_cfg.conn_cfg_tag = CONN_CFG_TAG;
+  cfg.conn_cfg.params.gatts_conn_cfg.hvn_tx_queue_size = TELEMETRY_QUEUE_PACKETS;
+  error_code = sd_ble_cfg_set(BLE_CONN_CFG_GATTS, &cfg, ram_start);
+  if (error_code != NRF_SUCCESS) {
+    return error_code;
+  }
+
+  error_code = nrf_sdh_ble_enable(&ram_start);
+  if (error_code != NRF_SUCCESS) {
+    return error_code;
+  }
+
+  // Keep a connection event open while there are packets to send
+  ble_opt_t opt;
+  memset(&opt, 0, sizeof(opt));
+  opt.common_opt.conn_evt_ext.enable = 1;
+  return sd_ble_opt_set(BLE_COMMON_OPT_CONN_EVT_EXT, &opt);
+}
+
+static ret_code_t gap_init(const char* device_name) {
+  ble_gap_conn_sec_mode_t sec_mode;
+  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&sec_mode);
+  ret_code_t error_code = sd_ble_gap_device_name_set(&sec_mode, (const uint8_t*) device_name, strlen(device_name));
+  if (error_code != NRF_SUCCESS) {
+    return error_code;
+  }
+  return sd_ble_gap_ppcp_set(&conn_params);
+}
+
+static ret_code_t gatt_init(void) {
+  ret_code_t error_code = nrf_ble_gatt_init(&gatt, gatt_event_handler);
+  if (error_code != NRF_SUCCESS) {
+    return error_code;
+  }
+  error_code = nrf_ble_gatt_att_mtu_periph_set(&gatt, NRF_SDH_BLE_GATT_MAX_MTU_SIZE);
+  if (error_code != NRF_SUCCESS) {
+    return error_code;
+  }
+  return nrf_ble_gatt_data_length_set(&gatt, BLE_CONN_HANDLE_INVALID, NRF_SDH_BLE_GAP_DATA_LENGTH);
+}
+
+static ret_code_t service_init(void) {
+  ret_code_t error_code = sd_ble_uuid_vs_add(&uuid_base, &uuid_type);
+  if (error_code != NRF_SUCCESS) {
+    return error_code;
+  }
+
+  ble_uuid_t service_uuid = {.uuid = TELEMETRY_SERVICE_UUID, .type = uuid_type};
+  error_code = sd_ble_gatts_service_add(BLE_GATTS_SRVC_TYPE_PRIMARY, &service_uuid, &service_handle);
+  if (error_code != NRF_SUCCESS) {
+    return error_code;
+  }
+
+  ble_gatts_attr_md_t cccd_md;
+  memset(&cccd_md, 0, sizeof(cccd_md));
+  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.read_perm);
+  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.write_perm);
+  cccd_md.vloc = BLE_GATTS_VLOC_STACK;
+
+  ble_gatts_char_md_t char_md;
+  memset(&char_md, 0, sizeof(char_md));
+  char_md.char_props.notify = 1;
+  char_md.p_cccd_md = &cccd_md;
+
+  // Notify only: the value is never stored or read
+  ble_gatts_attr_md_t attr_md;
+  memset(&attr_md, 0, sizeof(attr_md));
+  BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.read_perm);
+  BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.write_perm);
+  attr_md.vloc = BLE_GATTS_VLOC_STACK;
+  attr_md.vlen = 1;
+
+  ble_uuid_t char_uuid = {.uuid = TELEMETRY_CHAR_UUID, .type = uuid_type};
+  ble_gatts_attr_t attr = {
+    .p_uuid = &char_uuid,
+    .p_attr_md = &attr_md,
+    .init_len = 0,
+    .max_len = TELEMETRY_PACKET_MAX_SIZE,
+    .p_value = NULL,
+  };
+  return sd_ble_gatts_characteristic_add(service_handle, &char_md, &attr, &telemetry_handles);
+}
+
+// Name in the advertisement, service UUID in the scan response
+static ret_code_t advertising_init(void) {
+  ble_advdata_t advdata;
+  memset(&advdata, 0, sizeof(advdata));
+  advdata.name_type = BLE_ADVDATA_FULL_NAME;
+  advdata.flags = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+  ret_code_t error_code = ble_advdata_encode(&advdata, adv_data.adv_data.p_data, &adv_data.adv_data.len);
+  if (error_code != NRF_SUCCESS) {
+    return error_code;
+  }
+
+  ble_uuid_t service_uuid = {.uuid = TELEMETRY_SERVICE_UUID, .type = uuid_type};
+  ble_advdata_t scan_response;
+  memset(&scan_response, 0, sizeof(scan_response));
+  scan_response.uuids_complete.uuid_cnt = 1;
+  scan_response.uuids_complete.p_uuids = &service_uuid;
+  error_code = ble_advdata_encode(&scan_response, adv_data.scan_rsp_data.p_data, &adv_data.scan_rsp_data.len);
+  if (error_code != NRF_SUCCESS) {
+    return error_code;
+  }
+
+  ble_gap_adv_params_t adv_params;
+  memset(&adv_params, 0, sizeof(adv_params));
+  adv_params.properties.type = BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED;
+  adv_params.filter_policy = BLE_GAP_ADV_FP_ANY;
+  adv_params.interval = MSEC_TO_UNITS(BLE_TELEMETRY_ADV_INTERVAL_MS, UNIT_0_625_MS);
+  adv_params.duration = BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED;
+  adv_params.primary_phy = BLE_GAP_PHY_1MBPS;
+  return sd_ble_gap_adv_set_configure(&adv_handle, &adv_data, &adv_params);
+}
+
+ret_code_t ble_telemetry_init(const char* device_name) {
+  telemetry_queue_init(&queue, BLE_GATT_ATT_MTU_DEFAULT - 3);
+
+  ret_code_t error_code = stack_init();
+  if (error_code == NRF_SUCCESS) {
+    error_code = gap_init(device_name);
+  }
+  if (error_code == NRF_SUCCESS) {
+    error_code = gatt_init();
+  }
+  if (error_code == NRF_SUCCESS) {
+    error_code = service_init();
+  }
+  if (error_code == NRF_SUCCESS) {
+    error_code = advertising_init();
+  }
+  if (error_code == NRF_SUCCESS) {
+    error_code = advertising_start();
+  }
+  return error_code;
+}
+
+void ble_telemetry_set_callback(void (*callback)(void)) {
+  ready_callback = callback;
+}
+
+// Pick up connection changes made in the SoftDevice interrupt
+static void sync_link(void) {
+  if (link_reset) {
+    link_reset = false;
+    telemetry_queue_reset(&queue);
+  }
+  uint16_t mtu = att_mtu;
+  if (mtu != queue_mtu) {
+    queue_mtu = mtu;
+    telemetry_queue_set_packet_size(&queue, mtu - 3);
+  }
+}
+
+void ble_telemetry_write(const ride_log_record_t* record) {
+  if (!notifying) {
+    return;
+  }
+  sync_link();
+  telemetry_queue_add(&queue, record);
+}
+
+// Transport for the queue. On NRF_ERROR_RESOURCES the SoftDevice queue is
+// full; the packet is offered again after the next HVN_TX_COMPLETE.
+static bool notify_packet(const uint8_t* data, uint16_t length, void* context) {
+  uint16_t hvx_length = length;
+  ble_gatts_hvx_params_t hvx = {
+    .handle = telemetry_handles.value_handle,
+    .type = BLE_GATT_HVX_NOTIFICATION,
+    .offset = 0,
+    .p_len = &hvx_length,
+    .p_data = data,
+  };
+  return sd_ble_gatts_hvx(conn_handle, &hvx) == NRF_SUCCESS;
+}
+
+void ble_telemetry_send(uint32_t now_ms) {
+  sync_link();
+  if (!notifying) {
+    return;
+  }
+  telemetry_queue_close_older(&queue, now_ms, BLE_TELEMETRY_MAX_LATENCY_MS);
+  telemetry_queue_send(&queue, notify_packet, NULL);
+}
+
+void ble_telemetry_get_stats(ble_telemetry_stats_t* stats) {
+  *stats = link;
+  stats->connected = conn_handle != BLE_CONN_HANDLE_INVALID;
+  stats->notifying = notifying;
+  stats->att_mtu = att_mtu;
+  stats->records = queue.records;
+  stats->notifications = queue.packets_sent;
+  stats->bytes = queue.bytes_sent;
+  stats->packets_dropped = queue.packets_dropped;
+  stats->records_dropped = queue.records_dropped;
+}
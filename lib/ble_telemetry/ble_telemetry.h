@@ -0,0 +1,84 @@
+// BLE telemetry service
+//
+// Streams speed, distance, roll, lin_ay, temperature, humidity and FSM state
+// to a phone through one notify characteristic of a custom GATT service.
+// Records are packed many to a notification (ble_telemetry_queue.h). The link
+// is set up so each packet is one short radio burst:
+// - a 247-byte ATT MTU with data length extension, so a 244-byte
+//   notification is a single link layer packet
+// - the 2 Mbps PHY when the central supports it
+// - connection event extension, so queued packets go out back to back
+// - a connection interval with slave latency, so an idle link skips most
+//   connection events
+//
+// Enabling the SoftDevice means the clock must be requested through it from
+// then on (sd_clock_hfclk_request). In sdk_config.h, enable NRF_SDH,
+// NRF_SDH_BLE and NRF_BLE_GATT, with NRF_SDH_BLE_GATT_MAX_MTU_SIZE 247,
+// NRF_SDH_BLE_GAP_DATA_LENGTH 251 and NRF_SDH_BLE_VS_UUID_COUNT 1.
+//
+// Service 7b1c1000-5a5e-4b5e-9d1a-62696b650000, telemetry characteristic
+// 7b1c1001-...; decode notifications with ble_telemetry_queue.h and
+// ride_log_format.h.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "app_error.h"
+#include "ble_telemetry_queue.h"
+
+// Connection interval range (ms), slave latency (intervals the board may skip
+// while it has nothing to send) and supervision timeout (ms)
+#ifndef BLE_TELEMETRY_MIN_INTERVAL_MS
+#define BLE_TELEMETRY_MIN_INTERVAL_MS 100
+#endif
+#ifndef BLE_TELEMETRY_MAX_INTERVAL_MS
+#define BLE_TELEMETRY_MAX_INTERVAL_MS 200
+#endif
+#ifndef BLE_TELEMETRY_SLAVE_LATENCY
+#define BLE_TELEMETRY_SLAVE_LATENCY 4
+#endif
+#ifndef BLE_TELEMETRY_SUPERVISION_MS
+#define BLE_TELEMETRY_SUPERVISION_MS 4000
+#endif
+
+#ifndef BLE_TELEMETRY_ADV_INTERVAL_MS
+#define BLE_TELEMETRY_ADV_INTERVAL_MS 1000
+#endif
+
+// A partly filled packet is sent once its oldest record is this old
+#ifndef BLE_TELEMETRY_MAX_LATENCY_MS
+#define BLE_TELEMETRY_MAX_LATENCY_MS 1000
+#endif
+
+typedef struct {
+  bool connected;
+  bool notifying;
+  uint16_t att_mtu;
+  uint16_t data_length;       // Link layer payload, bytes
+  uint16_t interval_units;    // Connection interval in 1.25 ms units, up to 4 s
+  uint16_t slave_latency;
+  uint8_t tx_phy;             // BLE_GAP_PHY_*
+  uint32_t records;
+  uint32_t notifications;
+  uint32_t bytes;
+  uint32_t packets_dropped;
+  uint32_t records_dropped;   // Too large for the link's packets
+} ble_telemetry_stats_t;
+
+// Enable the SoftDevice, add the service and start advertising as `device_name`
+ret_code_t ble_telemetry_init(const char* device_name);
+
+// Called from the SoftDevice interrupt when the link can take more packets.
+// Call ble_telemetry_send from the main loop in response.
+void ble_telemetry_set_callback(void (*callback)(void));
+
+// Queue a record. Dropped unless a central has subscribed. Main loop only.
+void ble_telemetry_write(const ride_log_record_t* record);
+
+// Send queued packets, and any partly filled one older than
+// BLE_TELEMETRY_MAX_LATENCY_MS. Main loop only.
+void ble_telemetry_send(uint32_t now_ms);
+
+void ble_telemetry_get_stats(ble_telemetry_stats_t* stats);
@@ -0,0 +1,124 @@
+#include <stddef.h>
+
+#include "ble_telemetry_queue.h"
+
+static uint8_t next_index(uint8_t index) {
+  return (index + 1) % TELEMETRY_QUEUE_PACKETS;
+}
+
+// Start filling the packet at the head
+static void open_packet(telemetry_queue_t* queue, uint32_t time_ms) {
+  telemetry_packet_t* packet = &queue->packets[queue->head];
+  uint8_t* data = packet->data;
+  data[0] = queue->sequence & 0xFF;
+  data[1] = queue->sequence >> 8;
+  data[2] = time_ms & 0xFF;
+  data[3] = (time_ms >> 8) & 0xFF;
+  data[4] = (time_ms >> 16) & 0xFF;
+  data[5] = time_ms >> 24;
+  packet->length = TELEMETRY_PACKET_HEADER_SIZE;
+  queue->open_size = queue->packet_size;
+  queue->opened_ms = time_ms;
+  ride_log_codec_reset(&queue->codec, time_ms);
+}
+
+// Queue the packet being filled for sending, dropping the oldest if full
+static void close_packet(telemetry_queue_t* queue) {
+  if (queue->packets[queue->head].length == 0) {
+    return;
+  }
+  queue->head = next_index(queue->head);
+  if (queue->head == queue->tail) {
+    queue->packets[queue->tail].length = 0;
+    queue->tail = next_index(queue->tail);
+    queue->packets_dropped++;
+  }
+  queue->packets[queue->head].length = 0;
+  queue->sequence++;
+}
+
+void telemetry_queue_init(telemetry_queue_t* queue, uint16_t packet_size) {
+  queue->sequence = 0;
+  queue->records = 0;
+  queue->packets_sent = 0;
+  queue->bytes_sent = 0;
+  queue->packets_dropped = 0;
+  queue->records_dropped = 0;
+  telemetry_queue_set_packet_size(queue, packet_size);
+  telemetry_queue_reset(queue);
+}
+
+void telemetry_queue_reset(telemetry_queue_t* queue) {
+  for (int i = 0; i < TELEMETRY_QUEUE_PACKETS; i++) {
+    queue->packets[i].length = 0;
+  }
+  queue->head = 0;
+  queue->tail = 0;
+}
+
+void telemetry_queue_set_packet_size(telemetry_queue_t* queue, uint16_t packet_size) {
+  if (packet_size > TELEMETRY_PACKET_MAX_SIZE) {
+    packet_size = TELEMETRY_PACKET_MAX_SIZE;
+  }
+  if (packet_size < TELEMETRY_PACKET_MIN_SIZE) {
+    packet_size = TELEMETRY_PACKET_MIN_SIZE;
+  }
+  queue->packet_size = packet_size;
+}
+
+void telemetry_queue_add(telemetry_queue_t* queue, const ride_log_record_t* record) {
+  // A record that does not fit closes the packet and goes into a new one, so
+  // this takes at most two passes
+  for (int pass = 0; pass < 2; pass++) {
+    telemetry_packet_t* packet = &queue->packets[queue->head];
+    if (packet->length == 0) {
+      open_packet(queue, record->time_ms);
+    }
+
+    size_t n = ride_log_encode(&queue->codec, record, &packet->data[packet->length], queue->open_size - packet->length);
+    if (n > 0) {
+      packet->length += n;
+      queue->records++;
+      return;
+    }
+    if (packet->length == TELEMETRY_PACKET_HEADER_SIZE) {
+      // Too large for even an empty packet (a record with many fields on a
+      // default MTU link). Keep the packet open for the next record.
+      packet->length = 0;
+      queue->records_dropped++;
+      return;
+    }
+    close_packet(queue);
+  }
+}
+
+void telemetry_queue_close_older(telemetry_queue_t* queue, uint32_t now_ms, uint32_t max_age_ms) {
+  if (queue->packets[queue->head].length != 0 && now_ms - queue->opened_ms >= max_age_ms) {
+    close_packet(queue);
+  }
+}
+
+uint16_t telemetry_queue_send(telemetry_queue_t* queue, telemetry_transport_t transport, void* context) {
+  uint16_t sent = 0;
+  while (queue->tail != queue->head) {
+    telemetry_packet_t* packet = &queue->packets[queue->tail];
+    if (!transport(packet->data, packet->length, context)) {
+      break;
+    }
+    queue->packets_sent++;
+    queue->bytes_sent += packet->length;
+    packet->length = 0;
+    queue->tail = next_index(queue->tail);
+    sent++;
+  }
+  return sent;
+}
+
+bool telemetry_packet_header(const uint8_t* data, uint16_t length, uint16_t* sequence, uint32_t* start_ms) {
+  if (length < TELEMETRY_PACKET_HEADER_SIZE) {
+    return false;
+  }
+  *sequence = data[0] | (uint16_t) data[1] << 8;
+  *start_ms = data[2] | (uint32_t) data[3] << 8 | (uint32_t) data[4] << 16 | (uint32_t) data[5] << 24;
+  return true;
+}
@@ -0,0 +1,79 @@
+// BLE telemetry packets
+//
+// Packs dashboard records into notification-sized packets and queues them for
+// the link. A packet is a 6-byte header followed by records in the ride log
+// format (ride_log_format.h). The header holds a 16-bit sequence number and
+// the uptime the first record is relative to. Delta state restarts in every
+// packet, so a central decodes each notification on its own and sees a lost
+// one as a gap in the sequence.
+//
+// The link is reached through a transport callback, which is
+// sd_ble_gatts_hvx on the board and a simulated central on the host.
+// Pure C, so it can be tested without a phone.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ride_log_format.h"
+
+// A 247-byte ATT MTU less the 3-byte notification header; fits one
+// data-length-extended link layer packet
+#define TELEMETRY_PACKET_MAX_SIZE 244
+#define TELEMETRY_PACKET_MIN_SIZE 20     // Default 23-byte ATT MTU, too small for the largest records
+#define TELEMETRY_PACKET_HEADER_SIZE 6
+
+// Packets held while the link is busy, including the one being filled.
+// When full the oldest packet is dropped: the newest telemetry matters most.
+#ifndef TELEMETRY_QUEUE_PACKETS
+#define TELEMETRY_QUEUE_PACKETS 4
+#endif
+
+typedef struct {
+  uint8_t data[TELEMETRY_PACKET_MAX_SIZE];
+  uint16_t length;          // 0 while the packet has no records
+} telemetry_packet_t;
+
+typedef struct {
+  telemetry_packet_t packets[TELEMETRY_QUEUE_PACKETS];
+  uint8_t head;             // Packet being filled
+  uint8_t tail;             // Oldest packet waiting for the link
+  uint16_t packet_size;     // Size limit for packets opened from now on
+  uint16_t open_size;       // Size limit of the packet being filled
+  uint16_t sequence;        // Of the packet being filled
+  uint32_t opened_ms;       // Time of its first record
+  ride_log_codec_t codec;
+
+  uint32_t records;
+  uint32_t packets_sent;
+  uint32_t bytes_sent;
+  uint32_t packets_dropped;
+  uint32_t records_dropped;   // Larger than a whole packet
+} telemetry_queue_t;
+
+// Hands one packet to the link. Returns false if the link cannot take it
+// now; the packet is offered again on the next telemetry_queue_send.
+typedef bool (*telemetry_transport_t)(const uint8_t* data, uint16_t length, void* context);
+
+void telemetry_queue_init(telemetry_queue_t* queue, uint16_t packet_size);
+
+// Drop everything queued, e.g. when the central goes away
+void telemetry_queue_reset(telemetry_queue_t* queue);
+
+// Use packets of up to `packet_size` bytes (ATT MTU - 3) from the next packet on
+void telemetry_queue_set_packet_size(telemetry_queue_t* queue, uint16_t packet_size);
+
+// Add a record to the packet being filled, closing it first if the record does
+// not fit. A record larger than a whole packet is counted in records_dropped.
+void telemetry_queue_add(telemetry_queue_t* queue, const ride_log_record_t* record);
+
+// Close the packet being filled if its first record is at least `max_age_ms` old
+void telemetry_queue_close_older(telemetry_queue_t* queue, uint32_t now_ms, uint32_t max_age_ms);
+
+// Offer closed packets to the transport, oldest first, until it refuses one.
+// Returns the number of packets sent.
+uint16_t telemetry_queue_send(telemetry_queue_t* queue, telemetry_transport_t transport, void* context);
+
+// Read a packet header. Returns false if the packet is too short.
+bool telemetry_packet_header(const uint8_t* data, uint16_t length, uint16_t* sequence, uint32_t* start_ms);
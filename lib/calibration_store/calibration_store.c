@@ -0,0 +1,202 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "app_util_platform.h"
+#include "crc32.h"
+#include "fds.h"
+#include "nrf_pwr_mgmt.h"
+
+#include "calibration_store.h"
+
+// FDS records are whole words
+_Static_assert(sizeof(calibration_record_t) % 4 == 0, "calibration record must be word aligned");
+
+static volatile bool initialized = false;
+static volatile ret_code_t init_result = NRF_SUCCESS;
+
+// FDS reads the data while the write is in progress, so it lives here
+static calibration_record_t writing;
+static calibration_record_t next;
+static volatile bool write_in_flight = false;
+static volatile bool have_next = false;
+static bool gc_pending = false;
+static uint8_t retries = 0;
+static volatile uint32_t write_errors = 0;
+
+static uint32_t record_crc(const calibration_record_t* record) {
+  return crc32_compute((const uint8_t*) record, offsetof(calibration_record_t, crc), NULL);
+}
+
+// Write or replace the record held in `writing`
+static ret_code_t start_write(void) {
+  fds_record_t fds_record = {
+    .file_id = CALIBRATION_FILE_ID,
+    .key = CALIBRATION_RECORD_KEY,
+    .data.p_data = &writing,
+    .data.length_words = sizeof(writing) / 4,
+  };
+  fds_record_desc_t desc = {0};
+  fds_find_token_t token = {0};
+
+  ret_code_t error_code;
+  if (fds_record_find(CALIBRATION_FILE_ID, CALIBRATION_RECORD_KEY, &desc, &token) == FDS_SUCCESS) {
+    error_code = fds_record_update(&desc, &fds_record);
+  } else {
+    error_code = fds_record_write(&desc, &fds_record);
+  }
+
+  // Reclaim the space held by old copies, then try again
+  if (error_code == FDS_ERR_NO_SPACE_IN_FLASH && !gc_pending) {
+    gc_pending = true;
+    error_code = fds_gc();
+  }
+  return error_code;
+}
+
+// Put a record that failed to write back in the queue, unless a newer one is
+// already waiting there
+static void requeue_failed_write(void) {
+  write_errors++;
+  CRITICAL_REGION_ENTER();
+  if (!have_next) {
+    next = writing;
+    have_next = true;
+  }
+  write_in_flight = false;
+  CRITICAL_REGION_EXIT();
+}
+
+// Write the queued record, if any and if no write is in flight
+static ret_code_t start_next_write(void) {
+  bool start = false;
+  CRITICAL_REGION_ENTER();
+  if (have_next && !write_in_flight) {
+    writing = next;
+    have_next = false;
+    write_in_flight = true;
+    start = true;
+  }
+  CRITICAL_REGION_EXIT();
+
+  if (!start) {
+    return NRF_SUCCESS;
+  }
+  ret_code_t error_code = start_write();
+  if (error_code != FDS_SUCCESS) {
+    requeue_failed_write();
+  }
+  return error_code;
+}
+
+// Retry a write that failed in the background, a few times in a row at most;
+// after that the record waits for the next calibration_store_save
+static void retry_failed_write(void) {
+  requeue_failed_write();
+  if (retries < CALIBRATION_STORE_RETRIES) {
+    retries++;
+    start_next_write();
+  }
+}
+
+static void fds_event_handler(fds_evt_t const* p_evt) {
+  switch (p_evt->id) {
+    case FDS_EVT_INIT:
+      init_result = p_evt->result;
+      initialized = true;
+      break;
+
+    case FDS_EVT_WRITE:
+    case FDS_EVT_UPDATE:
+      gc_pending = false;
+      if (p_evt->result != FDS_SUCCESS) {
+        retry_failed_write();
+        break;
+      }
+      retries = 0;
+      write_in_flight = false;
+      start_next_write();
+      break;
+
+    case FDS_EVT_GC:
+      if (p_evt->result != FDS_SUCCESS) {
+        gc_pending = false;
+        if (write_in_flight) {
+          retry_failed_write();
+        } else {
+          write_errors++;
+        }
+        break;
+      }
+      // Retry the write that ran out of space
+      if (write_in_flight && start_write() != FDS_SUCCESS) {
+        retry_failed_write();
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+ret_code_t calibration_store_init(void) {
+  ret_code_t error_code = fds_register(fds_event_handler);
+  if (error_code != FDS_SUCCESS) {
+    return error_code;
+  }
+  error_code = fds_init();
+  if (error_code != FDS_SUCCESS) {
+    return error_code;
+  }
+  while (!initialized) {
+    nrf_pwr_mgmt_run();
+  }
+  return init_result;
+}
+
+ret_code_t calibration_store_load(calibration_record_t* record) {
+  fds_record_desc_t desc = {0};
+  fds_find_token_t token = {0};
+  if (fds_record_find(CALIBRATION_FILE_ID, CALIBRATION_RECORD_KEY, &desc, &token) != FDS_SUCCESS) {
+    return NRF_ERROR_NOT_FOUND;
+  }
+
+  fds_flash_record_t flash_record;
+  ret_code_t error_code = fds_record_open(&desc, &flash_record);
+  if (error_code != FDS_SUCCESS) {
+    return error_code;
+  }
+
+  ret_code_t result = NRF_ERROR_INVALID_DATA;
+  if (flash_record.p_header->length_words == sizeof(*record) / 4) {
+    memcpy(record, flash_record.p_data, sizeof(*record));
+    if (record->version == CALIBRATION_RECORD_VERSION && record->crc == record_crc(record)) {
+      result = NRF_SUCCESS;
+    }
+  }
+  fds_record_close(&desc);
+  return result;
+}
+
+ret_code_t calibration_store_save(const calibration_record_t* record) {
+  if (!initialized) {
+    return NRF_ERROR_INVALID_STATE;
+  }
+
+  calibration_record_t stamped = *record;
+  stamped.version = CALIBRATION_RECORD_VERSION;
+  stamped.reserved = 0;
+  stamped.crc = record_crc(&stamped);
+
+  CRITICAL_REGION_ENTER();
+  next = stamped;
+  have_next = true;
+  CRITICAL_REGION_EXIT();
+
+  retries = 0;
+  return start_next_write();
+}
+
+uint32_t calibration_store_write_errors(void) {
+  return write_errors;
+}
@@ -0,0 +1,49 @@
+// Calibration store
+//
+// Keeps the IMU calibration in flash as one versioned FDS record with a
+// CRC-32, so a unit only has to be calibrated once. Loading is a flash read;
+// saving queues the write with FDS and returns, and the write (plus garbage
+// collection when the FDS pages are full) completes in the background.
+//
+// Enable FDS, fstorage and CRC32 in sdk_config.h.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "app_error.h"
+#include "IMU.h"
+
+// Bump whenever calibration_record_t changes; older records are ignored
+#define CALIBRATION_RECORD_VERSION 1
+
+#define CALIBRATION_FILE_ID 0xCA1B
+#define CALIBRATION_RECORD_KEY 0x0001
+
+// Times a failed background write or garbage collection is retried in a row
+#ifndef CALIBRATION_STORE_RETRIES
+#define CALIBRATION_STORE_RETRIES 3
+#endif
+
+typedef struct {
+  uint16_t version;
+  uint16_t reserved;
+  mpu9250_calibration_t imu;
+  uint32_t crc;           // CRC-32 of everything above
+} calibration_record_t;
+
+// Start FDS and wait for it to be ready (a few milliseconds)
+ret_code_t calibration_store_init(void);
+
+// Returns NRF_ERROR_NOT_FOUND if there is no record, or NRF_ERROR_INVALID_DATA
+// if it fails the CRC or has another version
+ret_code_t calibration_store_load(calibration_record_t* record);
+
+// Stamps the version and CRC and writes the record in the background. If a
+// write is already in flight the newest record is written after it. A write
+// that fails stays queued: it is retried CALIBRATION_STORE_RETRIES times, then
+// again on the next save unless that save brings a newer record.
+ret_code_t calibration_store_save(const calibration_record_t* record);
+
+// Failed writes and garbage collections since boot, including retried ones
+uint32_t calibration_store_write_errors(void);
@@ -0,0 +1,102 @@
+#include <stddef.h>
+
+#include "event_queue.h"
+
+#define QUEUE_MASK (EVENT_QUEUE_SIZE - 1)
+
+// Each slot's sequence number says who may use it next: a producer when it
+// equals the enqueue position, the consumer when it is one past it.
+typedef struct {
+  uint32_t sequence;
+  uint8_t type;
+  uint32_t data;
+} slot_t;
+
+static slot_t slots[EVENT_QUEUE_SIZE];
+static uint32_t enqueue_pos = 0;
+static uint32_t dequeue_pos = 0;
+
+static event_handler_t handlers[EVENT_QUEUE_MAX_TYPES] = {NULL};
+static event_queue_stats_t stats = {0};
+
+void event_queue_init(void) {
+  for (uint32_t i = 0; i < EVENT_QUEUE_SIZE; i++) {
+    slots[i].sequence = i;
+  }
+  enqueue_pos = 0;
+  dequeue_pos = 0;
+  stats.posted = 0;
+  stats.dropped = 0;
+  stats.max_depth = 0;
+}
+
+void event_queue_register(uint8_t type, event_handler_t handler) {
+  if (type < EVENT_QUEUE_MAX_TYPES) {
+    handlers[type] = handler;
+  }
+}
+
+bool event_queue_post(uint8_t type, uint32_t data) {
+  uint32_t pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+  slot_t* slot;
+
+  // Claim a slot. An interrupt that preempts us between the load and the
+  // compare-and-swap makes the swap fail, and we retry with its new position.
+  while (true) {
+    slot = &slots[pos & QUEUE_MASK];
+    uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    int32_t diff = (int32_t)(sequence - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      __atomic_fetch_add(&stats.dropped, 1, __ATOMIC_RELAXED);
+      return false;
+    } else {
+      pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->type = type;
+  slot->data = data;
+  __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&stats.posted, 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+bool event_queue_dispatch(void) {
+  uint32_t pos = dequeue_pos;
+  slot_t* slot = &slots[pos & QUEUE_MASK];
+  if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+    return false;
+  }
+
+  uint32_t depth = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED) - pos;
+  if (depth > stats.max_depth) {
+    stats.max_depth = depth;
+  }
+
+  uint8_t type = slot->type;
+  uint32_t data = slot->data;
+  // Hand the slot back to producers before running the handler, so the
+  // handler itself can post
+  __atomic_store_n(&slot->sequence, pos + EVENT_QUEUE_SIZE, __ATOMIC_RELEASE);
+  dequeue_pos = pos + 1;
+
+  if (type < EVENT_QUEUE_MAX_TYPES && handlers[type] != NULL) {
+    handlers[type](data);
+  }
+  return true;
+}
+
+bool event_queue_is_empty(void) {
+  uint32_t pos = dequeue_pos;
+  return __atomic_load_n(&slots[pos & QUEUE_MASK].sequence, __ATOMIC_ACQUIRE) != pos + 1;
+}
+
+void event_queue_get_stats(event_queue_stats_t* out) {
+  out->posted = __atomic_load_n(&stats.posted, __ATOMIC_RELAXED);
+  out->dropped = __atomic_load_n(&stats.dropped, __ATOMIC_RELAXED);
+  out->max_depth = stats.max_depth;
+}
@@ -0,0 +1,47 @@
+// Event queue
+//
+// Cooperative scheduler for the main loop. Interrupt handlers post small
+// events into a bounded lock-free queue (safe from any interrupt priority and
+// from thread mode), and the main loop dispatches them to their handlers in
+// posting order, sleeping whenever the queue is empty. An event therefore
+// waits for at most the handlers of the EVENT_QUEUE_SIZE - 1 events queued
+// ahead of it.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Must be a power of two
+#ifndef EVENT_QUEUE_SIZE
+#define EVENT_QUEUE_SIZE 32
+#endif
+
+#define EVENT_QUEUE_MAX_TYPES 16
+
+typedef void (*event_handler_t)(uint32_t data);
+
+typedef struct {
+  uint32_t posted;
+  uint32_t dropped;     // Posts rejected because the queue was full
+  uint32_t max_depth;   // Most events ever waiting at once
+} event_queue_stats_t;
+
+// Empty the queue. Call once before enabling the interrupts that post events.
+void event_queue_init(void);
+
+// Set the handler for an event type (0 to EVENT_QUEUE_MAX_TYPES - 1)
+void event_queue_register(uint8_t type, event_handler_t handler);
+
+// Queue an event. Lock-free and safe to call from interrupts. Returns false,
+// and counts the event as dropped, if the queue is full.
+bool event_queue_post(uint8_t type, uint32_t data);
+
+// Run the handler of the oldest event. Returns false if there was none.
+// Call from the main loop only.
+bool event_queue_dispatch(void);
+
+// True if no events are waiting
+bool event_queue_is_empty(void);
+
+void event_queue_get_stats(event_queue_stats_t* stats);
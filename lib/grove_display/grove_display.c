@@ -9,6 +9,8 @@
 #include "nrf_delay.h"
 #include "nrfx_gpiote.h"
 #include "nrf_gpio.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
 
 #include "buckler.h"
 
@@ -18,6 +20,7 @@
 const int DIGITS = 4;
 uint8_t brightness = 7;
 static bool _PointFlag;
+static bool port_initialized[2] = {false, false};
 
 uint32_t clock_pin_0 = BUCKLER_GROVE_A0;  // Note: using "static" breaks Grove
 uint32_t data_pin_0 = BUCKLER_GROVE_A1;
@@ -81,10 +84,6 @@ void point(bool PointFlag) {
   _PointFlag = PointFlag;
 }
 
-static void bitDelay() {
-  nrf_delay_us(50);
-}
-
 static void clockPinLow(int port_number) {
   uint32_t clock_pin = port_number ? clock_pin_1 : clock_pin_0;
   nrf_gpio_pin_clear(clock_pin);
@@ -150,70 +149,218 @@ void init_tm1637_display(int port_number) {
 
   clockPinOutput(port_number);
   dataPinOutput(port_number);
+  port_initialized[port_number] = true;
+}
+
+// Frames are sent as a precomputed list of pin states ("steps") that a timer
+// plays back one step per tick, so the CPU never waits on the display.
+// A frame sets auto-increment mode, writes all digits starting at address 0
+// and then sets the brightness.
+
+#define STEP_CLK       0x01
+#define STEP_DIO       0x02
+#define STEP_DIO_INPUT 0x04  // Release DIO so the TM1637 can ACK
+
+// 3 start + 3 stop conditions (3 steps each) + 7 bytes (19 steps each)
+#define FRAME_MAX_STEPS 160
+
+// Only used when no app_timer is available to run the frame in the background
+#define SYNC_STEP_DELAY_US 5
+
+typedef struct {
+  uint8_t steps[FRAME_MAX_STEPS];
+  uint8_t num_steps;
+  uint8_t next_step;
+  volatile bool busy;
+} waveform_t;
+
+static uint8_t shadow[2][4];        // Segments to show
+static uint8_t sent[2][4];          // Segments in the last frame sent
+static uint8_t sent_brightness[2];
+static bool sent_valid[2] = {false, false};
+static waveform_t waveform[2];
+
+APP_TIMER_DEF(step_timer);
+static bool step_timer_created = false;
+static volatile bool step_timer_running = false;
+
+// Scrolling text, advanced by one single-shot app_timer per port. Messages are
+// kept sorted by priority; queue[0] is the one on screen. While a marquee is
+// showing, plain display() writes still land in the shadow buffer and appear
+// once the marquee queue is empty.
+
+typedef struct {
+  char text[MARQUEE_MAX_LENGTH + 1];
+  uint16_t step_ms;
+  uint8_t repeats;
+  uint8_t priority;
+} marquee_t;
+
+typedef struct {
+  marquee_t queue[MARQUEE_QUEUE_SIZE];
+  volatile uint8_t count;
+  uint16_t position;      // First character on screen
+  uint8_t repeats_done;
+  uint8_t digits[4];      // Segments for the current window
+} marquee_port_t;
+
+static marquee_port_t marquee[2];
+static void marquee_timer_callback(void* p_context);
+
+APP_TIMER_DEF(marquee_timer_0);
+APP_TIMER_DEF(marquee_timer_1);
+static bool marquee_timers_created = false;
+
+static const uint8_t* frame_source(int port_number) {
+  return marquee[port_number].count ? marquee[port_number].digits : shadow[port_number];
+}
+
+static bool frame_changed(int port_number) {
+  return !sent_valid[port_number] ||
+    sent_brightness[port_number] != brightness ||
+    memcmp(frame_source(port_number), sent[port_number], DIGITS) != 0;
+}
+
+static void add_step(waveform_t* w, uint8_t step) {
+  w->steps[w->num_steps++] = step;
+}
+
+static void add_start(waveform_t* w) {
+  add_step(w, STEP_CLK | STEP_DIO);
+  add_step(w, STEP_CLK);
+  add_step(w, 0);
+}
+
+static void add_stop(waveform_t* w) {
+  add_step(w, 0);
+  add_step(w, STEP_CLK);
+  add_step(w, STEP_CLK | STEP_DIO);
 }
 
-static int writeByte(int8_t wr_data, int port_number) {
-  for (uint8_t i = 0; i < 8; i++) {  // Sent 8-bit data
+static void add_byte(waveform_t* w, uint8_t wr_data) {
+  for (uint8_t i = 0; i < 8; i++) {  // Sent 8-bit data, LSB first
+    uint8_t dio = (wr_data & 0x01) ? STEP_DIO : 0;
+    add_step(w, dio);
+    add_step(w, dio | STEP_CLK);
+    wr_data >>= 1;
+  }
+
+  // Clock out the ACK with DIO released
+  add_step(w, STEP_DIO_INPUT);
+  add_step(w, STEP_DIO_INPUT | STEP_CLK);
+  add_step(w, 0);
+}
+
+// Snapshot the shadow buffer (or marquee window) into a frame. Called with the port idle.
+static void compile_frame(int port_number) {
+  waveform_t* w = &waveform[port_number];
+  w->num_steps = 0;
+  w->next_step = 0;
+
+  memcpy(sent[port_number], frame_source(port_number), DIGITS);
+  sent_brightness[port_number] = brightness;
+  sent_valid[port_number] = true;
+
+  add_start(w);
+  add_byte(w, 0x40);                        // Command1: Set data (auto increment)
+  add_stop(w);
+  add_start(w);
+  add_byte(w, 0xc0);                        // Command2: Start at address 0
+  for (int i = 0; i < DIGITS; i++) {
+    add_byte(w, sent[port_number][i]);      // Transfer display data 8 bits
+  }
+  add_stop(w);
+  add_start(w);
+  add_byte(w, 0x88 + sent_brightness[port_number]); // Control display
+  add_stop(w);
+}
+
+static void apply_step(int port_number, uint8_t step) {
+  // DIO may only change while CLK is low: lower CLK first, raise it last
+  if (!(step & STEP_CLK)) {
     clockPinLow(port_number);
-    if (wr_data & 0x01) {
-      dataPinHigh(port_number);  // LSB first
+  }
+  if (step & STEP_DIO_INPUT) {
+    dataPinInput(port_number);
+  } else {
+    if (step & STEP_DIO) {
+      dataPinHigh(port_number);
     } else {
       dataPinLow(port_number);
-	}
-    wr_data >>= 1;
+    }
+    dataPinOutput(port_number);
+  }
+  if (step & STEP_CLK) {
     clockPinHigh(port_number);
   }
+}
 
-  clockPinLow(port_number);  // Wait for the ACK
-  dataPinHigh(port_number);
-  clockPinHigh(port_number);
-  dataPinInput(port_number);
+// Plays one step on every port with a frame in progress
+static void step_timer_callback(void* p_context) {
+  bool active = false;
 
-  bitDelay();
-  uint32_t data_pin = port_number ? data_pin_1 : data_pin_0;
-  uint8_t ack = nrf_gpio_pin_read(data_pin);
+  for (int port = 0; port < 2; port++) {
+    waveform_t* w = &waveform[port];
+    if (!w->busy) {
+      if (!port_initialized[port] || !frame_changed(port)) {
+        continue;
+      }
+      compile_frame(port);
+      w->busy = true;
+    }
 
-  if (ack == 0) {
-    dataPinOutput(port_number);
-    dataPinLow(port_number);
+    apply_step(port, w->steps[w->next_step++]);
+    if (w->next_step == w->num_steps) {
+      w->busy = false;
+    }
+    active = true;
   }
 
-  bitDelay();
-  dataPinOutput(port_number);
-  bitDelay();
-
-  return ack;
+  if (!active) {
+    app_timer_stop(step_timer);
+    step_timer_running = false;
+  }
 }
 
-static void start(int port_number) {
-  clockPinHigh(port_number);
-  dataPinHigh(port_number);
-  dataPinLow(port_number);
-  clockPinLow(port_number);
-}
+// Send the shadow buffer if it changed
+static void request_frame(int port_number) {
+  if (!port_initialized[port_number]) {
+    return;
+  }
+  if (step_timer_running) {
+    return; // Picked up by the timer once the current frame is done
+  }
 
-static void stop(int port_number) {
-  clockPinLow(port_number);
-  dataPinLow(port_number);
-  clockPinHigh(port_number);
-  dataPinHigh(port_number);
+  if (!step_timer_created) {
+    step_timer_created = app_timer_create(&step_timer, APP_TIMER_MODE_REPEATED,
+                                          step_timer_callback) == NRF_SUCCESS;
+  }
+  if (step_timer_created &&
+      app_timer_start(step_timer, APP_TIMER_MIN_TIMEOUT_TICKS, NULL) == NRF_SUCCESS) {
+    // Frames are compiled on the first tick, so back-to-back digit updates
+    // (e.g. from displayNum) go out together
+    step_timer_running = true;
+    return;
+  }
+
+  // No app_timer (not initialized yet): bit-bang the frame right away
+  if (!frame_changed(port_number)) {
+    return;
+  }
+  compile_frame(port_number);
+  waveform_t* w = &waveform[port_number];
+  while (w->next_step < w->num_steps) {
+    apply_step(port_number, w->steps[w->next_step++]);
+    nrf_delay_us(SYNC_STEP_DELAY_US);
+  }
 }
 
 void display(uint8_t bit_addr, int8_t disp_data, int port_number) {
-  int8_t seg_data = coding(disp_data);
-
-  start(port_number);                 // Start signal sent to TM1637 from MCU
-  uint8_t ADDR_FIXED = 0x44;
-  writeByte(ADDR_FIXED, port_number);      // Command1: Set data
-  stop(port_number);
-  start(port_number);
-  writeByte(bit_addr | 0xc0, port_number); // Command2: Set data (fixed address)
-  writeByte(seg_data, port_number);        // Transfer display data 8 bits
-  stop(port_number);
-  start(port_number);
-  uint8_t cmd_disp_ctrl = 0x88 + brightness;
-  writeByte(cmd_disp_ctrl, port_number);   // Control display
-  stop(port_number);
+  if (bit_addr >= DIGITS) {
+    return;
+  }
+  shadow[port_number][bit_addr] = coding(disp_data);
+  request_frame(port_number);
 }
 
 void displayNum(float num, int decimal, bool show_minus, int port_number) {
@@ -247,11 +394,81 @@ void displayNum(float num, int decimal, bool show_minus, int port_number) {
   }
 }
 
-void displayStr(const char str[], int port_number) {
-  point(false);
+// Render the visible window of the active marquee. Interrupts must be masked.
+static void render_marquee(int port_number) {
+  marquee_port_t* m = &marquee[port_number];
+  if (m->count == 0) {
+    return;
+  }
+  const char* text = m->queue[0].text;
+  uint16_t length = strlen(text);
+  for (int d = 0; d < DIGITS; d++) {
+    char c = (m->position + d < length) ? text[m->position + d] : 0x7f;
+    m->digits[d] = (uint8_t) coding(c) & 0x7f; // no decimal point in text
+  }
+}
+
+// Windows in one pass over the text
+static uint16_t marquee_windows(const marquee_t* message) {
+  uint16_t length = strlen(message->text);
+  return length > DIGITS ? length - DIGITS + 1 : 1;
+}
+
+static app_timer_id_t marquee_timer(int port_number) {
+  return port_number ? marquee_timer_1 : marquee_timer_0;
+}
+
+static bool create_marquee_timers(void) {
+  if (!marquee_timers_created) {
+    marquee_timers_created =
+      app_timer_create(&marquee_timer_0, APP_TIMER_MODE_SINGLE_SHOT, marquee_timer_callback) == NRF_SUCCESS &&
+      app_timer_create(&marquee_timer_1, APP_TIMER_MODE_SINGLE_SHOT, marquee_timer_callback) == NRF_SUCCESS;
+  }
+  return marquee_timers_created;
+}
+
+// (Re)start stepping the message at the head of the queue
+static void start_marquee_timer(int port_number) {
+  app_timer_id_t timer = marquee_timer(port_number);
+  app_timer_stop(timer);
+  if (marquee[port_number].count) {
+    app_timer_start(timer, APP_TIMER_TICKS(marquee[port_number].queue[0].step_ms),
+                    (void*) (intptr_t) port_number);
+  }
+}
+
+static void marquee_timer_callback(void* p_context) {
+  int port_number = (int) (intptr_t) p_context;
+  marquee_port_t* m = &marquee[port_number];
+
+  CRITICAL_REGION_ENTER();
+  if (m->count) {
+    m->position++;
+    if (m->position >= marquee_windows(&m->queue[0])) {
+      m->position = 0;
+      m->repeats_done++;
+      if (m->queue[0].repeats && m->repeats_done >= m->queue[0].repeats) {
+        // Done, move on to the next message
+        m->count--;
+        memmove(&m->queue[0], &m->queue[1], m->count * sizeof(marquee_t));
+        m->repeats_done = 0;
+      }
+    }
+    render_marquee(port_number);
+  }
+  CRITICAL_REGION_EXIT();
+
+  if (m->count) {
+    app_timer_start(marquee_timer(port_number), APP_TIMER_TICKS(m->queue[0].step_ms), p_context);
+  }
+  request_frame(port_number);
+}
+
+// Scroll in place when there is no app_timer to do it in the background
+static void scroll_blocking(const char str[], uint16_t step_ms, int port_number) {
   for (int i = 0; i < (int)(strlen(str)); i++) {
     if (i + 1 > DIGITS) {  // Sliding string (loop display)
-      nrf_delay_ms(500);   // TODO: Change to timer callback?
+      nrf_delay_ms(step_ms);
       for (int d = 0; d < DIGITS; d++) {
         display(d, str[d + i + 1 - DIGITS], port_number);
       }
@@ -259,6 +476,73 @@ void displayStr(const char str[], int port_number) {
       display(i, str[i], port_number);
     }
   }
+}
+
+void displayMarquee(const char str[], uint16_t step_ms, uint8_t repeats, uint8_t priority, int port_number) {
+  if (!create_marquee_timers()) {
+    point(false);
+    scroll_blocking(str, step_ms, port_number);
+    return;
+  }
+
+  marquee_port_t* m = &marquee[port_number];
+  bool new_head = false;
+
+  CRITICAL_REGION_ENTER();
+  // Insert behind every message of the same or higher priority
+  uint8_t slot = 0;
+  while (slot < m->count && m->queue[slot].priority >= priority) {
+    slot++;
+  }
+  if (slot < MARQUEE_QUEUE_SIZE) {
+    uint8_t kept = m->count < MARQUEE_QUEUE_SIZE ? m->count : MARQUEE_QUEUE_SIZE - 1; // drop the lowest priority when full
+    memmove(&m->queue[slot + 1], &m->queue[slot], (kept - slot) * sizeof(marquee_t));
+    m->count = kept + 1;
+
+    marquee_t* message = &m->queue[slot];
+    strncpy(message->text, str, MARQUEE_MAX_LENGTH);
+    message->text[MARQUEE_MAX_LENGTH] = '\0';
+    message->step_ms = step_ms;
+    message->repeats = repeats;
+    message->priority = priority;
+
+    if (slot == 0) {
+      // Pre-empt: the interrupted message starts over when it comes back
+      m->position = 0;
+      m->repeats_done = 0;
+      render_marquee(port_number);
+      new_head = true;
+    }
+  }
+  CRITICAL_REGION_EXIT();
+
+  if (new_head) {
+    start_marquee_timer(port_number);
+    request_frame(port_number);
+  }
+}
+
+void clearMarquee(int port_number) {
+  if (!marquee_timers_created) {
+    return;
+  }
+  app_timer_stop(marquee_timer(port_number));
+  CRITICAL_REGION_ENTER();
+  marquee[port_number].count = 0;
+  CRITICAL_REGION_EXIT();
+  request_frame(port_number);
+}
+
+void displayStr(const char str[], int port_number) {
+  if ((int)(strlen(str)) > DIGITS) {  // Sliding string
+    displayMarquee(str, MARQUEE_DEFAULT_STEP_MS, 1, MARQUEE_PRIORITY_NORMAL, port_number);
+    return;
+  }
+
+  point(false);
+  for (int i = 0; i < (int)(strlen(str)); i++) {
+    display(i, str[i], port_number);
+  }
 
   // display nothing for remaining characters
   for (int i = strlen(str); i < DIGITS; i++) {
@@ -274,4 +558,6 @@ void clearDisplay(int port_number) {
 
 void setBrightness(uint8_t new_brightness) {
   brightness = new_brightness;
+  request_frame(0);
+  request_frame(1);
 }
@@ -5,7 +5,9 @@
 // Port number refers to the display port to communicate on (either 0 or 1)
 void init_tm1637_display(int port_number);
 
-// Displays a char to the correct bit address and port number
+// Displays a char to the correct bit address and port number.
+// Digits are kept in a shadow buffer and the whole display is rewritten in the
+// background (one auto-increment frame) only if the buffer changed.
 void display(uint8_t BitAddr, int8_t DispData, int port_number);
 
 /* Displays a number to Grove
@@ -21,7 +23,33 @@ void display(uint8_t BitAddr, int8_t DispData, int port_number);
 void displayNum(float num, int decimal, bool show_minus, int port_number);
 
 // Displays a string to Grove.  Un-representable characters show as empty.
+// Strings longer than the display scroll in the background (see displayMarquee).
 void displayStr(const char str[], int port_number);
 
+#define MARQUEE_QUEUE_SIZE 4
+#define MARQUEE_MAX_LENGTH 32
+#define MARQUEE_DEFAULT_STEP_MS 500
+
+#define MARQUEE_PRIORITY_NORMAL 0
+#define MARQUEE_PRIORITY_ALERT 10
+
+/* Queues scrolling text on a display without blocking
+ *
+ * INPUTS:
+ *   str - text to scroll, truncated to MARQUEE_MAX_LENGTH characters
+ *   step_ms - time between scroll steps
+ *   repeats - number of passes over the text, 0 to repeat until cleared
+ *   priority - a message with a higher priority than the one showing
+ *       pre-empts it; the interrupted message restarts afterwards
+ *   port_number - the port to display to
+ *
+ * Regular display updates made while text is scrolling are shown once the
+ * queue is empty.
+ */
+void displayMarquee(const char str[], uint16_t step_ms, uint8_t repeats, uint8_t priority, int port_number);
+
+// Drops all queued scrolling text for a display
+void clearMarquee(int port_number);
+
 void clearDisplay(int port_number);
 void setBrightness(uint8_t new_brightness);
@@ -0,0 +1,123 @@
+#include "nrfx_ppi.h"
+#include "nrfx_timer.h"
+
+#include "hall_capture.h"
+
+static const nrfx_timer_t capture_timer = NRFX_TIMER_INSTANCE(1);
+static const nrfx_timer_t counter_timer = NRFX_TIMER_INSTANCE(2);
+
+static nrfx_gpiote_pin_t hall_pin;
+static nrf_ppi_channel_t channel;
+
+// Neither timer has compare events enabled, but the driver requires a handler
+static void timer_event_handler(nrf_timer_event_t event_type, void* p_context) {
+}
+
+// Routes the pin's edge event to the timers
+static ret_code_t connect_edge_event(void) {
+  // Edge event only, no interrupt
+  nrfx_gpiote_in_config_t hall_config = NRFX_GPIOTE_CONFIG_IN_SENSE_HITOLO(true);
+  ret_code_t error_code = nrfx_gpiote_in_init(hall_pin, &hall_config, NULL);
+  if (error_code != NRFX_SUCCESS) {
+    return error_code;
+  }
+
+  // One PPI channel: edge -> capture the time, forked to -> count the edge
+  error_code = nrfx_ppi_channel_assign(channel, nrfx_gpiote_in_event_addr_get(hall_pin),
+                                       nrfx_timer_task_address_get(&capture_timer, NRF_TIMER_TASK_CAPTURE0));
+  if (error_code != NRFX_SUCCESS) {
+    return error_code;
+  }
+  error_code = nrfx_ppi_channel_fork_assign(channel, nrfx_timer_task_address_get(&counter_timer, NRF_TIMER_TASK_COUNT));
+  if (error_code != NRFX_SUCCESS) {
+    return error_code;
+  }
+  error_code = nrfx_ppi_channel_enable(channel);
+  if (error_code != NRFX_SUCCESS) {
+    return error_code;
+  }
+
+  nrfx_gpiote_in_event_enable(hall_pin, false);
+  return NRFX_SUCCESS;
+}
+
+ret_code_t hall_capture_init(nrfx_gpiote_pin_t pin) {
+  ret_code_t error_code;
+
+  nrfx_timer_config_t timer_config = NRFX_TIMER_DEFAULT_CONFIG;
+  timer_config.frequency = NRF_TIMER_FREQ_1MHz;
+  timer_config.bit_width = NRF_TIMER_BIT_WIDTH_32;
+  timer_config.mode = NRF_TIMER_MODE_TIMER;
+  error_code = nrfx_timer_init(&capture_timer, &timer_config, timer_event_handler);
+  if (error_code != NRFX_SUCCESS) {
+    return error_code;
+  }
+
+  timer_config.mode = NRF_TIMER_MODE_LOW_POWER_COUNTER;
+  error_code = nrfx_timer_init(&counter_timer, &timer_config, timer_event_handler);
+  if (error_code != NRFX_SUCCESS) {
+    return error_code;
+  }
+
+  error_code = nrfx_ppi_channel_alloc(&channel);
+  if (error_code != NRFX_SUCCESS) {
+    return error_code;
+  }
+
+  hall_pin = pin;
+  error_code = connect_edge_event();
+  if (error_code != NRFX_SUCCESS) {
+    return error_code;
+  }
+
+  nrfx_timer_enable(&counter_timer);
+  nrfx_timer_enable(&capture_timer);
+  return NRFX_SUCCESS;
+}
+
+ret_code_t hall_capture_stop(nrfx_gpiote_evt_handler_t wake_handler) {
+  nrfx_gpiote_in_event_disable(hall_pin);
+  nrfx_ppi_channel_disable(channel);
+  nrfx_gpiote_in_uninit(hall_pin);
+  nrfx_timer_disable(&capture_timer);
+  nrfx_timer_disable(&counter_timer);
+
+  // Watch the pin with the shared PORT event, which needs no clock
+  nrfx_gpiote_in_config_t wake_config = NRFX_GPIOTE_CONFIG_IN_SENSE_HITOLO(false);
+  ret_code_t error_code = nrfx_gpiote_in_init(hall_pin, &wake_config, wake_handler);
+  if (error_code != NRFX_SUCCESS) {
+    return error_code;
+  }
+  nrfx_gpiote_in_event_enable(hall_pin, true);
+  return NRFX_SUCCESS;
+}
+
+ret_code_t hall_capture_start(void) {
+  nrfx_gpiote_in_event_disable(hall_pin);
+  nrfx_gpiote_in_uninit(hall_pin);
+
+  // Both timers restart from zero
+  nrfx_timer_clear(&capture_timer);
+  nrfx_timer_clear(&counter_timer);
+  ret_code_t error_code = connect_edge_event();
+  if (error_code != NRFX_SUCCESS) {
+    return error_code;
+  }
+  nrfx_timer_enable(&counter_timer);
+  nrfx_timer_enable(&capture_timer);
+  return NRFX_SUCCESS;
+}
+
+void hall_capture_read(uint32_t* edge_count, uint32_t* last_edge_time) {
+  uint32_t count;
+  uint32_t time;
+
+  // An edge between the reads changes the count, so retry until it is stable
+  do {
+    count = nrfx_timer_capture(&counter_timer, NRF_TIMER_CC_CHANNEL0);
+    time = nrfx_timer_capture_get(&capture_timer, NRF_TIMER_CC_CHANNEL0);
+  } while (nrfx_timer_capture(&counter_timer, NRF_TIMER_CC_CHANNEL0) != count);
+
+  *edge_count = count;
+  *last_edge_time = time;
+}
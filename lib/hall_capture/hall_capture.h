@@ -0,0 +1,38 @@
+// Hall sensor edge capture in hardware
+//
+// The hall pin's GPIOTE event is routed over PPI to two timers: a free-running
+// 1 MHz timer that captures the time of each edge, and a counter that counts
+// edges. No interrupt runs per edge; the application reads the edge count and
+// the time of the newest edge whenever it needs them (e.g. once per display
+// window) and feeds them to hall_velocity_edge_batch.
+//
+// Uses TIMER1 and TIMER2 (enable them and PPI in sdk_config.h). The 1 MHz timer
+// keeps the high frequency clock running; start the HFXO for crystal accuracy.
+// hall_capture_stop turns both timers off for sleep and leaves the pin on a
+// low power PORT event (one GPIOTE low power event in sdk_config.h).
+
+#pragma once
+
+#include <stdint.h>
+
+#include "app_error.h"
+#include "nrfx_gpiote.h"
+
+// Capture timer resolution
+#define HALL_CAPTURE_TICKS_PER_SECOND 1000000
+
+// Start counting and timestamping falling edges on `pin`. The GPIOTE driver
+// must already be initialized.
+ret_code_t hall_capture_init(nrfx_gpiote_pin_t pin);
+
+// Stop both timers and call `wake_handler` from the GPIOTE interrupt on the
+// next edge instead. Edges while stopped are not counted.
+ret_code_t hall_capture_stop(nrfx_gpiote_evt_handler_t wake_handler);
+
+// Resume capturing. The edge count and the capture timer restart from zero,
+// so call hall_velocity_resync before feeding the next batch.
+ret_code_t hall_capture_start(void);
+
+// Total edges so far and the capture timer value at the newest one, read as
+// a consistent pair
+void hall_capture_read(uint32_t* edge_count, uint32_t* last_edge_time);
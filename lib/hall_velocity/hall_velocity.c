@@ -0,0 +1,173 @@
+#include "hall_velocity.h"
+
+// m/s to MPH
+#define MS_TO_MPH_CONVERSION_FACTOR 2.237
+
+void hall_velocity_init(hall_velocity_t* hall, float distance_per_edge_m, uint32_t ticks_per_second,
+                        uint32_t counter_mask, float max_speed_mph) {
+  hall->distance_per_edge_m = distance_per_edge_m;
+  hall->ticks_per_second = ticks_per_second;
+  hall->counter_mask = counter_mask;
+  hall->max_speed_mph = max_speed_mph;
+
+  hall->rejected = 0;
+  hall->lost_edges = 0;
+  hall->reading_count = 0;
+  hall->latest_speed = 0;
+  hall->ring_overflows_seen = 0;
+  hall->have_edge_count = false;
+  hall->last_edge_count = 0;
+  hall->have_edge = false;
+  hall->last_edge = 0;
+  hall->window_edges = 0;
+  hall->window_readings = 0;
+  hall->window_speed_sum = 0;
+  hall->window_timed_edges = 0;
+  hall->window_timed_ticks = 0;
+  hall->edge_rate = 0;
+  hall->distance_m = 0;
+  for (int i = 0; i < HALL_VELOCITY_HISTORY; i++) {
+    hall->history[i] = 0;
+  }
+  hall->history_index = 0;
+}
+
+// Adds a reading unless it is implausibly fast
+static void add_reading(hall_velocity_t* hall, float velocity_mph) {
+  if (velocity_mph < hall->max_speed_mph) {
+    hall->window_speed_sum += velocity_mph;
+    hall->window_readings++;
+    hall->reading_count++;
+    hall->latest_speed = velocity_mph / MS_TO_MPH_CONVERSION_FACTOR;
+  } else {
+    hall->rejected++;
+  }
+}
+
+#define RING_MASK (HALL_EDGE_RING_SIZE - 1)
+
+bool hall_edge_ring_push(hall_edge_ring_t* ring, uint32_t timestamp) {
+  uint32_t head = ring->head;
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= HALL_EDGE_RING_SIZE) {
+    __atomic_store_n(&ring->overflows, ring->overflows + 1, __ATOMIC_RELEASE);
+    return false;
+  }
+  ring->timestamps[head & RING_MASK] = timestamp;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+uint32_t hall_velocity_process_edges(hall_velocity_t* hall, hall_edge_ring_t* ring) {
+  uint32_t tail = ring->tail;
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint32_t processed = head - tail;
+
+  for (; tail != head; tail++) {
+    hall_velocity_edge(hall, ring->timestamps[tail & RING_MASK]);
+  }
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+  // Dropped edges have no timestamp but still moved the wheel
+  uint32_t overflows = __atomic_load_n(&ring->overflows, __ATOMIC_ACQUIRE);
+  uint32_t lost = overflows - hall->ring_overflows_seen;
+  hall->ring_overflows_seen = overflows;
+  if (lost > 0) {
+    hall->window_edges += lost;
+    hall->lost_edges += lost;
+    hall->have_edge = false;  // The next interval would span the missing edges
+  }
+
+  return processed;
+}
+
+float hall_velocity_edge(hall_velocity_t* hall, uint32_t timestamp) {
+  float velocity_mph = -1;
+
+  hall->window_edges++;
+
+  if (hall->have_edge) {
+    uint32_t tick_diff = (timestamp - hall->last_edge) & hall->counter_mask;
+    hall->window_timed_edges++;
+    hall->window_timed_ticks += tick_diff;
+    if (tick_diff > 0) {
+      float time_diff_sec = (float)tick_diff / (float)hall->ticks_per_second;
+      velocity_mph = hall->distance_per_edge_m / time_diff_sec * MS_TO_MPH_CONVERSION_FACTOR;
+      add_reading(hall, velocity_mph);
+    }
+  }
+
+  hall->have_edge = true;
+  hall->last_edge = timestamp;
+  return velocity_mph;
+}
+
+void hall_velocity_edge_batch(hall_velocity_t* hall, uint32_t edge_count, uint32_t last_edge) {
+  uint32_t edges = edge_count - hall->last_edge_count;
+  hall->last_edge_count = edge_count;
+  if (!hall->have_edge_count) {
+    // Edges before the first batch count for distance but have no start time
+    hall->have_edge_count = true;
+    hall->window_edges += edge_count;
+    hall->have_edge = edge_count > 0;
+    hall->last_edge = last_edge;
+    return;
+  }
+  if (edges == 0) {
+    return;
+  }
+
+  hall->window_edges += edges;
+  if (hall->have_edge) {
+    uint32_t tick_diff = (last_edge - hall->last_edge) & hall->counter_mask;
+    hall->window_timed_edges += edges;
+    hall->window_timed_ticks += tick_diff;
+    if (tick_diff > 0) {
+      float time_diff_sec = (float)tick_diff / (float)hall->ticks_per_second;
+      add_reading(hall, (float)edges * hall->distance_per_edge_m / time_diff_sec * MS_TO_MPH_CONVERSION_FACTOR);
+    }
+  }
+  hall->have_edge = true;
+  hall->last_edge = last_edge;
+}
+
+void hall_velocity_resync(hall_velocity_t* hall) {
+  hall->have_edge_count = false;
+  hall->last_edge_count = 0;
+  hall->have_edge = false;
+}
+
+float hall_velocity_close_window(hall_velocity_t* hall) {
+  float avg_velocity = 0;
+  if (hall->window_readings > 0) {
+    avg_velocity = hall->window_speed_sum / (float)hall->window_readings;
+  }
+
+  // Edges over the time they took, including bounces that were not used for speed
+  hall->edge_rate = 0;
+  if (hall->window_timed_ticks > 0) {
+    hall->edge_rate = (float)hall->window_timed_edges * (float)hall->ticks_per_second / (float)hall->window_timed_ticks;
+  }
+
+  hall->distance_m += (float)hall->window_edges * hall->distance_per_edge_m;
+  hall->window_edges = 0;
+  hall->window_readings = 0;
+  hall->window_speed_sum = 0;
+  hall->window_timed_edges = 0;
+  hall->window_timed_ticks = 0;
+
+  hall->history_index++;
+  hall->history[hall->history_index % HALL_VELOCITY_HISTORY] = avg_velocity;
+  return avg_velocity;
+}
+
+float hall_velocity_distance(const hall_velocity_t* hall) {
+  return hall->distance_m;
+}
+
+float hall_velocity_current(const hall_velocity_t* hall) {
+  return hall->history[hall->history_index % HALL_VELOCITY_HISTORY];
+}
+
+float hall_velocity_edge_rate(const hall_velocity_t* hall) {
+  return hall->edge_rate;
+}
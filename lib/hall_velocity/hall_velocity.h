@@ -0,0 +1,96 @@
+// Hall effect wheel speed
+//
+// Turns magnet edge timestamps into speed and distance. Edges are averaged over
+// fixed windows (closed by the caller's timer) and the last few window speeds
+// are kept for display. Pure C, independent of the timer hardware.
+//
+// The GPIO interrupt only pushes raw timestamps into a hall_edge_ring_t; all of
+// the math runs in the main loop when the ring is drained. Alternatively, edges
+// counted and timestamped in hardware (see hall_capture) are fed in batches.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HALL_VELOCITY_HISTORY 4
+
+// Must be a power of two
+#ifndef HALL_EDGE_RING_SIZE
+#define HALL_EDGE_RING_SIZE 64
+#endif
+
+// Single-producer, single-consumer ring of edge timestamps
+typedef struct {
+  uint32_t timestamps[HALL_EDGE_RING_SIZE];
+  uint32_t head;        // Written by the producer only
+  uint32_t tail;        // Written by the consumer only
+  uint32_t overflows;   // Edges dropped because the ring was full
+} hall_edge_ring_t;
+
+typedef struct {
+  // Configuration
+  float distance_per_edge_m;
+  uint32_t ticks_per_second;
+  uint32_t counter_mask;    // Timestamps wrap at this mask (0xFFFFFF for the RTC)
+  float max_speed_mph;      // Faster readings are treated as switch bounce
+
+  uint32_t rejected;        // Readings discarded as bounce
+  uint32_t lost_edges;      // Edges counted for distance but missing from the ring
+
+  uint32_t reading_count;   // Accepted readings so far; changes when latest_speed is new
+  float latest_speed;       // Most recent accepted reading, m/s
+
+  // Internal
+  uint32_t ring_overflows_seen;
+  bool have_edge_count;
+  uint32_t last_edge_count;
+  bool have_edge;
+  uint32_t last_edge;
+  uint32_t window_edges;
+  uint32_t window_readings;
+  float window_speed_sum;
+  uint32_t window_timed_edges;  // Edges in the window with a previous edge timestamp
+  uint32_t window_timed_ticks;  // Ticks from each of those edges' previous edge
+  float edge_rate;
+  float distance_m;
+  float history[HALL_VELOCITY_HISTORY];
+  uint32_t history_index;
+} hall_velocity_t;
+
+void hall_velocity_init(hall_velocity_t* hall, float distance_per_edge_m, uint32_t ticks_per_second,
+                        uint32_t counter_mask, float max_speed_mph);
+
+// Queue an edge timestamp. Lock-free; call from the GPIO interrupt only.
+// Returns false (and counts an overflow) if the ring is full.
+bool hall_edge_ring_push(hall_edge_ring_t* ring, uint32_t timestamp);
+
+// Feed every queued edge to hall_velocity_edge. Call from the consumer only.
+// Returns the number of edges processed.
+uint32_t hall_velocity_process_edges(hall_velocity_t* hall, hall_edge_ring_t* ring);
+
+// Record a magnet edge. Returns the speed since the previous edge in mph, or a
+// negative value if there was no previous edge.
+float hall_velocity_edge(hall_velocity_t* hall, uint32_t timestamp);
+
+// Record a batch of edges from a hardware edge counter: `edge_count` is the
+// running total and `last_edge` the timestamp of the newest edge. Gives one
+// reading, the average speed over all edges since the previous batch.
+void hall_velocity_edge_batch(hall_velocity_t* hall, uint32_t edge_count, uint32_t last_edge);
+
+// Forget the previous edge count and timestamp, e.g. after the edge counter
+// was restarted. The next batch starts over as if it were the first.
+void hall_velocity_resync(hall_velocity_t* hall);
+
+// End the current averaging window: adds its distance and returns its average speed in mph
+float hall_velocity_close_window(hall_velocity_t* hall);
+
+// Total distance in meters
+float hall_velocity_distance(const hall_velocity_t* hall);
+
+// Average speed of the most recent closed window, mph
+float hall_velocity_current(const hall_velocity_t* hall);
+
+// Magnet edges per second in the most recent closed window: the timestamped
+// edges in it over the time since each one's previous edge, 0 if there were none
+float hall_velocity_edge_rate(const hall_velocity_t* hall);
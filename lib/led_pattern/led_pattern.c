@@ -2,79 +2,130 @@
 
 #include "app_error.h"
 #include "nrf.h"
-#include "nrf_delay.h"
 
 #include "app_timer.h"
 #include "nrfx_clock.h"
 
 #include "states.h"
+#include "rate_plan.h"
 #include "led_strip.h"
 #include "led_pattern.h"
+#include "profiler.h"
+
+// Colors are {0, R, G, B} as taken by led_set_pixel_color.
+// The strip is driven inverted: 0xFF means a channel is off.
+#define COLOR_OFF 0x00FFFFFF
+
+// Which part of the strip a keyframe lights up
+typedef enum {
+  SEGMENT_ALL,
+  SEGMENT_FROM_START,
+  SEGMENT_FROM_END,
+} segment_anchor_t;
+
+// One keyframe: `color` on the segment, every other LED off.
+// A sweeping keyframe expands into numLEDs frames whose segment grows by one LED per frame.
+typedef struct {
+  uint32_t color;
+  segment_anchor_t anchor;
+  bool sweep;
+} keyframe_t;
+
+typedef struct {
+  uint16_t frame_period_ms;
+  uint8_t num_keyframes;
+  const keyframe_t* keyframes;
+} animation_t;
+
+static const keyframe_t idle_keyframes[] = {
+  {0x000064C8, SEGMENT_ALL, false},         // Red-orange
+};
+
+static const keyframe_t right_keyframes[] = {
+  {0x00FFFF7F, SEGMENT_FROM_START, true},
+};
+
+static const keyframe_t left_keyframes[] = {
+  {0x00FF7FFF, SEGMENT_FROM_END, true},
+};
+
+static const keyframe_t brake_keyframes[] = { // Flash red lights
+  {0x003FFFFF, SEGMENT_ALL, false},         // Red
+  {COLOR_OFF, SEGMENT_ALL, false},          // Empty
+};
+
+#define ANIMATION(period_ms, keyframes) {period_ms, sizeof(keyframes)/sizeof(keyframes[0]), keyframes}
+
+// One animation per FSM state
+static const animation_t animations[] = {
+  [IDLE] = ANIMATION(RATE_PLAN_LED_FRAME_MS, idle_keyframes),
+  [RIGHT] = ANIMATION(RATE_PLAN_LED_FRAME_MS, right_keyframes),
+  [LEFT] = ANIMATION(RATE_PLAN_LED_FRAME_MS, left_keyframes),
+  [BRAKE] = ANIMATION(RATE_PLAN_LED_FLASH_MS, brake_keyframes),  // 10 Hz flashing by default
+};
 
 static uint16_t numLEDs = 0;
+static bool running = false;
 
+// Written by pattern_update_state, picked up by the timer callback
+static volatile states requested_state = IDLE;
+
+// Owned by the timer callback
 static states state = IDLE;
-static uint16_t iteration = 0;
+static uint8_t keyframe = 0;
+static uint16_t sweep_step = 0;
+static bool frame_shown = false;
 
 APP_TIMER_DEF(pattern_timer_id);
 
-// Clear lights
-static void clear_pattern() {
-  led_clear();
-  led_show();
-  nrf_delay_ms(2);
-}
-
-// Callbacks for specific states
-static void idle_callback() {
-  clear_pattern();
-  for (int i=0; i < numLEDs; i++) {
-    led_set_pixel_RGB(i, 0, 100, 200); // Red-orange
+static const animation_t* animation_for(states s) {
+  if ((unsigned) s >= sizeof(animations)/sizeof(animations[0])) {
+    s = IDLE;
   }
-  led_show();
-}
-
-static void right_callback() {
-  iteration = iteration % numLEDs;  
-  clear_pattern();
-  led_fill(0, iteration + 1, 0x00FFFF7F);
-  led_show();
-  iteration = (iteration + 1) % numLEDs;
-}
-
-static void left_callback() {
-  iteration = iteration % numLEDs;
-  clear_pattern();
-  led_fill(numLEDs - 1 - iteration, iteration + 1, 0x00FF7FFF);
-  led_show();
-  iteration = (iteration + 1) % numLEDs;
+  return &animations[s];
 }
 
-static void brake_callback() { // Flash red lights
-  clear_pattern();
+// Sets every pixel for the current frame. The strip library drops writes that
+// do not change a pixel and led_show() skips frames without changes.
+static void render_frame(const keyframe_t* frame) {
+  uint16_t lit = frame->sweep ? sweep_step + 1 : numLEDs;
+  uint16_t first = (frame->anchor == SEGMENT_FROM_END) ? numLEDs - lit : 0;
 
-  if (iteration % 2 == 0) {
-    led_fill(0, numLEDs, 0x003FFFFF); // Red
-  } else {
-    // led_fill(0, numLEDs, 0x00FFFFFF); // Empty
+  for (uint16_t i = 0; i < numLEDs; i++) {
+    bool on = (i >= first) && (i < first + lit);
+    led_set_pixel_color(i, on ? frame->color : COLOR_OFF);
   }
+  PROFILE_START(PROFILE_LED_SHOW);
   led_show();
-  iteration = (iteration + 1) % 2;
+  PROFILE_END(PROFILE_LED_SHOW);
 }
 
 // General Timer callback
 static void pattern_timer_callback(void* p_context) {
-  switch (state) {
-  case IDLE: idle_callback();
-    break;
-  case RIGHT: right_callback();
-    break;
-  case LEFT: left_callback();
-    break;
-  case BRAKE: brake_callback();
-    break;
-  default: idle_callback();
-    break;
+  if (requested_state != state) {
+    state = requested_state;
+    keyframe = 0;
+    sweep_step = 0;
+    frame_shown = false;
+  }
+
+  const animation_t* animation = animation_for(state);
+  const keyframe_t* frame = &animation->keyframes[keyframe];
+
+  // Static animations only need to be drawn once
+  bool is_static = animation->num_keyframes == 1 && !frame->sweep;
+  if (is_static && frame_shown) {
+    return;
+  }
+  render_frame(frame);
+  frame_shown = true;
+
+  // Advance to the next frame
+  if (frame->sweep && sweep_step + 1 < numLEDs) {
+    sweep_step++;
+  } else {
+    sweep_step = 0;
+    keyframe = (keyframe + 1) % animation->num_keyframes;
   }
 }
 
@@ -86,10 +137,12 @@ static void clock_handler(nrfx_clock_evt_type_t event) {
 int pattern_init(uint16_t numLED) {
   if (numLEDs != 0) return 1;
 
-  // Initialize clock (ASSUME ALREADY CALLED)
-  ret_code_t err_code = nrfx_clock_init(&clock_handler);
-  // APP_ERROR_CHECK(err_code);  // Ignorable - errors if already init-ed
+  // Initialize clock (ASSUME ALREADY CALLED). Left alone once running, as the
+  // SoftDevice owns the CLOCK peripheral when it is enabled.
+  ret_code_t err_code;
   if (!nrfx_clock_lfclk_is_running()) {
+    err_code = nrfx_clock_init(&clock_handler);
+    // APP_ERROR_CHECK(err_code);  // Ignorable - errors if already init-ed
     nrfx_clock_lfclk_start();
   }
   // app_timer_init(); // ASSUME ALREADY CALLED
@@ -104,24 +157,35 @@ int pattern_init(uint16_t numLED) {
   return 0;
 }
 
-// Starts the timer (and the LED pattern)
+// Starts the timer (and the LED pattern) at the frame rate of the current state
 ret_code_t pattern_start() {
+  // The strip may have been changed while stopped, so redraw even a static frame
+  frame_shown = false;
   ret_code_t err_code = app_timer_start(pattern_timer_id,
-                                        APP_TIMER_TICKS(250), NULL);
+                                        APP_TIMER_TICKS(animation_for(requested_state)->frame_period_ms), NULL);
   APP_ERROR_CHECK(err_code);
+  running = true;
   return err_code;
 }
 
 // Stops the timer (and the LED pattern)
 void pattern_stop() {
   app_timer_stop(pattern_timer_id);
+  running = false;
 }
 
 // Update FSM state to change LED pattern output
 void pattern_update_state(states new_state) {
-  if (new_state != state) {
-	state = new_state;
-	iteration = 0;
+  if (new_state == requested_state) {
+    return;
   }
-}
 
+  uint16_t old_period_ms = animation_for(requested_state)->frame_period_ms;
+  requested_state = new_state;
+
+  // Retime the timer if the new animation runs at a different frame rate
+  if (running && animation_for(new_state)->frame_period_ms != old_period_ms) {
+    pattern_stop();
+    pattern_start();
+  }
+}
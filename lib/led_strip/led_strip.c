@@ -2,19 +2,91 @@
 #include <string.h>
 
 #include "app_error.h"
+#include "app_util_platform.h"
 #include "nrf.h"
 #include "nrfx_gpiote.h"
 #include "nrf_gpio.h"
 #include "nrfx_pwm.h"
 #include "led_strip.h"
 
+// 3 RGB Values * 8 bits/byte PWM sequence values per LED
+#define VALUES_PER_LED 24
+// Zero padding at the end of each sequence
+#define PADDING_VALUES 2
+// Keep the line low for 40 PWM periods (50 us) so the strip latches the frame
+#define RESET_PERIODS 40
+
+// For high bits, pwm duty is cycle is 13 out of 20.
+// For low bits, it is 7 (note: 6 fails badly).
+#define BIT_DUTY(byte, bit) ((((byte) << (bit)) & 0x80) ? 13 : 7)
+#define BYTE_DUTIES(b) {BIT_DUTY(b, 0), BIT_DUTY(b, 1), BIT_DUTY(b, 2), BIT_DUTY(b, 3), \
+                        BIT_DUTY(b, 4), BIT_DUTY(b, 5), BIT_DUTY(b, 6), BIT_DUTY(b, 7)}
+#define DUTIES_4(b)   BYTE_DUTIES(b), BYTE_DUTIES((b) + 1), BYTE_DUTIES((b) + 2), BYTE_DUTIES((b) + 3)
+#define DUTIES_16(b)  DUTIES_4(b), DUTIES_4((b) + 4), DUTIES_4((b) + 8), DUTIES_4((b) + 12)
+#define DUTIES_64(b)  DUTIES_16(b), DUTIES_16((b) + 16), DUTIES_16((b) + 32), DUTIES_16((b) + 48)
+
+// Byte -> 8 PWM duty values (MSB first), built at compile time
+static const uint16_t byte_to_duty[256][8] = {
+  DUTIES_64(0), DUTIES_64(64), DUTIES_64(128), DUTIES_64(192)
+};
+
 static uint16_t numLEDs = 0;  // Number of LEDs to control
-static uint8_t *pixels = 0;   // Pixel array
+static uint8_t pixels[LED_STRIP_MAX_LEDS * 3];   // Pixel array
 static nrfx_pwm_t m_pwm0 = NRFX_PWM_INSTANCE(0);     // PWM Driver
 
+// Two PWM sequences: one is played back by EasyDMA while the other is encoded
+static uint16_t sequence[2][LED_STRIP_MAX_LEDS * VALUES_PER_LED + PADDING_VALUES];
+// Per sequence, the pixels that changed since that sequence was last encoded
+static uint8_t dirty[2][(LED_STRIP_MAX_LEDS + 7) / 8];
+static bool frame_changed = false;
+
+static uint8_t back = 0;                   // Sequence to encode next
+static volatile bool pwm_busy = false;     // A sequence is playing
+static volatile bool frame_pending = false; // `back` is encoded and waiting for the strip
+
+static void start_playback(void) {
+  nrf_pwm_sequence_t seq = {
+   .values.p_common = sequence[back],
+   .length = numLEDs * VALUES_PER_LED + PADDING_VALUES,
+   .repeats = 0,
+   .end_delay = RESET_PERIODS
+  };
+
+  pwm_busy = true;
+  APP_ERROR_CHECK(nrfx_pwm_simple_playback(&m_pwm0, &seq, 1, NRFX_PWM_FLAG_STOP));
+  back ^= 1;
+}
+
+// Strip finished: send the frame that was queued while it was busy
+static void pwm_handler(nrfx_pwm_evt_type_t event_type) {
+  if (event_type != NRFX_PWM_EVT_STOPPED) {
+	return;
+  }
+
+  pwm_busy = false;
+  if (frame_pending) {
+	frame_pending = false;
+	start_playback();
+  }
+}
+
+static void set_pixel_bytes(uint16_t n, uint8_t g, uint8_t r, uint8_t b) {
+  uint8_t* p = &pixels[n*3];
+  if (p[0] == g && p[1] == r && p[2] == b) {
+	return;
+  }
+  p[0] = g;
+  p[1] = r;
+  p[2] = b;
+
+  dirty[0][n >> 3] |= 1 << (n & 7);
+  dirty[1][n >> 3] |= 1 << (n & 7);
+  frame_changed = true;
+}
+
 int led_init(uint16_t numLED, nrfx_gpiote_pin_t pin) {
   // Setting number of LEDs, returning error if already set
-  if (numLEDs != 0) {
+  if (numLEDs != 0 || numLED > LED_STRIP_MAX_LEDS) {
 	return 1;
   }
 
@@ -43,16 +115,17 @@ int led_init(uint16_t numLED, nrfx_gpiote_pin_t pin) {
    .load_mode = NRF_PWM_LOAD_COMMON,
    .step_mode = NRF_PWM_STEP_AUTO
   };
-  error_code = nrfx_pwm_init(&m_pwm0, &config, NULL);
+  error_code = nrfx_pwm_init(&m_pwm0, &config, pwm_handler);
   APP_ERROR_CHECK(error_code);
 
-  // Malloc enough bytes for pixels
-  uint16_t numBytes = numLED * 3;
-  pixels = (uint8_t*) malloc(numBytes);
-  if (pixels == NULL) {
-	return 1;
+  // Pixels start black; both sequences need a full encode with zero padding at the end
+  memset(pixels, 0, sizeof(pixels));
+  memset(dirty, 0xFF, sizeof(dirty));
+  for (int i = 0; i < 2; i++) {
+	sequence[i][numLED * VALUES_PER_LED] = (uint16_t) 0 | (0x8000);
+	sequence[i][numLED * VALUES_PER_LED + 1] = (uint16_t) 0 | (0x8000);
   }
-  memset(pixels, 0, numBytes);
+  frame_changed = true;
 
   numLEDs = numLED;
   return 0;
@@ -60,20 +133,14 @@ int led_init(uint16_t numLED, nrfx_gpiote_pin_t pin) {
 
 void led_set_pixel_RGB(uint16_t n, uint8_t r, uint8_t g, uint8_t b) {
   if (n < numLEDs) {
-	uint8_t* p = &pixels[n*3];
-	p[0] = g;
-	p[1] = r;
-	p[2] = b;
+	set_pixel_bytes(n, g, r, b);
   }
 }
 
 // Color is composed of bytes {0, R, G, B}
 void led_set_pixel_color(uint16_t n, uint32_t c) {
   if (n < numLEDs) {
-	uint8_t* p = &pixels[n*3];
-	p[0] = (uint8_t) (c >> 8);
-	p[1] = (uint8_t) (c >> 16);
-	p[2] = (uint8_t) c;
+	set_pixel_bytes(n, (uint8_t) (c >> 8), (uint8_t) (c >> 16), (uint8_t) c);
   }
 }
 
@@ -86,43 +153,39 @@ void led_fill(uint16_t first, uint16_t num, uint32_t c) {
 }
 
 void led_clear() {
-  memset(pixels, -1, numLEDs*3);
+  for (uint16_t i = 0; i < numLEDs; i++) {
+	set_pixel_bytes(i, 0xFF, 0xFF, 0xFF);
+  }
 }
 
 void led_show() {
-  if (!numLEDs) return;
-
-  // Creating PWM Sequence Values
-  // 3 RGB Values * 8 bits/byte * PWM sequence size + zero padding
-  uint32_t pattern_len = numLEDs*3*8 + 2;
-  uint16_t* pattern = (uint16_t*) malloc(pattern_len * sizeof(uint16_t));
-  if (pattern == NULL) {
-	return; // Error logging?
-  }
-
-  // Filling PWM Sequence Values, zero-padding at the end
-  uint16_t pos = 0;
-  for (uint16_t i=0; i<numLEDs*3; i++) {
-	uint8_t pixel = pixels[i];
-	for (uint8_t mask=0x80; mask>0; mask >>= 1) {
-	  // For high bits, pwm duty is cycle is 13 out of 20.
-	  // For low bits, it is 7 (note: 6 fails badly).
-	  pattern[pos] = (pixel & mask) ? (uint16_t) 13 : (uint16_t) 7;
-	  pos++;
+  if (!numLEDs || !frame_changed) return;
+  frame_changed = false;
+
+  // Keep the PWM handler away from `back` while it is being encoded
+  CRITICAL_REGION_ENTER();
+  frame_pending = false;
+  CRITICAL_REGION_EXIT();
+
+  // Only re-encode the pixels that changed since this sequence was last sent
+  uint16_t* values = sequence[back];
+  uint8_t* dirty_map = dirty[back];
+  for (uint16_t n = 0; n < numLEDs; n++) {
+	if (!(dirty_map[n >> 3] & (1 << (n & 7)))) {
+	  continue;
+	}
+	dirty_map[n >> 3] &= ~(1 << (n & 7));
+	for (uint8_t i = 0; i < 3; i++) {
+	  memcpy(&values[(n * 3 + i) * 8], byte_to_duty[pixels[n * 3 + i]], sizeof(byte_to_duty[0]));
 	}
   }
-  pattern[pos++] = (uint16_t) 0 | (0x8000);
-  pattern[pos++] = (uint16_t) 0 | (0x8000);
 
-  // Creating PWM Sequence
-  nrf_pwm_sequence_t seq = {
-   .values.p_common = pattern,
-   .length = pattern_len,
-   .repeats = 0,
-   .end_delay = 0
-  };
-
-  // (Finally) Calling the PWM library
-  APP_ERROR_CHECK(nrfx_pwm_simple_playback(&m_pwm0, &seq, 1, 0));
-  free(pattern);
+  // (Finally) Calling the PWM library, or leave the frame for the PWM handler
+  CRITICAL_REGION_ENTER();
+  if (pwm_busy) {
+	frame_pending = true;
+  } else {
+	start_playback();
+  }
+  CRITICAL_REGION_EXIT();
 }
@@ -3,6 +3,12 @@
 #include "nrf.h"
 #include "nrfx_gpiote.h"
 
+// Longest supported strip. All buffers are static, so this sets the RAM cost
+// (about 100 bytes per LED); override with -DLED_STRIP_MAX_LEDS=<n>.
+#ifndef LED_STRIP_MAX_LEDS
+#define LED_STRIP_MAX_LEDS 64
+#endif
+
 // Initializes the number of LEDs.  Only call this once
 int  led_init(uint16_t numLED, nrfx_gpiote_pin_t pin);
 
@@ -14,4 +20,6 @@ void led_set_pixel_color(uint16_t n, uint32_t c);
 void led_fill(uint16_t first, uint16_t num, uint32_t c);
 
 void led_clear(); // Clears all LEDs
-void led_show();  // Send the signal to display the colors
+// Send the signal to display the colors. Does nothing if no pixel changed.
+// Never blocks: if the strip is still busy the frame is sent when it is done.
+void led_show();
@@ -0,0 +1,186 @@
+#include <math.h>
+#include <string.h>
+
+#include "mag_calibration.h"
+
+#define NUM_PARAMS 6
+#define FORGET (1.0 - 1.0 / MAG_CAL_MEMORY_SAMPLES)
+
+// Readings are scaled by the expected field strength (about 500 mG) before fitting
+#define EXPECTED_FIELD 500.0f
+
+// Pivots smaller than this (relative to the diagonal) mean the readings do not
+// pin down every parameter
+#define MIN_PIVOT 1e-9
+
+void mag_calibration_init(mag_calibration_t* cal, const float bias[3], const float scale[3]) {
+  memset(cal, 0, sizeof(*cal));
+  for (int i = 0; i < 3; i++) {
+    cal->center[i] = bias[i];
+    cal->bias[i] = bias[i];
+    cal->scale[i] = scale[i];
+  }
+  cal->unit = EXPECTED_FIELD;
+  cal->pivot = -1;
+}
+
+void mag_calibration_add_sample(mag_calibration_t* cal, const float m[3]) {
+  double x = (m[0] - cal->center[0]) / cal->unit;
+  double y = (m[1] - cal->center[1]) / cal->unit;
+  double z = (m[2] - cal->center[2]) / cal->unit;
+  double phi[NUM_PARAMS] = {x * x, y * y, z * z, x, y, z};
+
+  // The sums are symmetric, so only the upper triangle is kept up to date
+  for (int i = 0; i < NUM_PARAMS; i++) {
+    for (int j = i; j < NUM_PARAMS; j++) {
+      cal->normal[i][j] = FORGET * cal->normal[i][j] + phi[i] * phi[j];
+    }
+    cal->rhs[i] = FORGET * cal->rhs[i] + phi[i];
+  }
+  cal->weight = FORGET * cal->weight + 1.0;
+
+  if (cal->new_samples < MAG_CAL_SOLVE_INTERVAL) {
+    cal->new_samples++;
+  }
+}
+
+// Snapshot the sums so sampling can go on while the fit runs
+static void start_fit(mag_calibration_t* cal) {
+  for (int i = 0; i < NUM_PARAMS; i++) {
+    for (int j = 0; j < NUM_PARAMS; j++) {
+      cal->work[i][j] = (j >= i) ? cal->normal[i][j] : cal->normal[j][i];
+    }
+    cal->work[i][NUM_PARAMS] = cal->rhs[i];
+    cal->work_rhs[i] = cal->rhs[i];
+  }
+  cal->work_weight = cal->weight;
+  cal->new_samples = 0;
+  cal->pivot = 0;
+}
+
+// Eliminate one column. The normal equations are positive definite, so no
+// row exchanges are needed; a tiny pivot means the readings are degenerate.
+static bool eliminate(mag_calibration_t* cal, int k) {
+  double pivot = cal->work[k][k];
+  if (!(pivot > MIN_PIVOT * cal->work_weight)) {
+    return false;
+  }
+  for (int i = k + 1; i < NUM_PARAMS; i++) {
+    double factor = cal->work[i][k] / pivot;
+    for (int j = k; j <= NUM_PARAMS; j++) {
+      cal->work[i][j] -= factor * cal->work[k][j];
+    }
+  }
+  return true;
+}
+
+// Back substitute, turn the ellipsoid into a bias and scales and check them
+static bool finish_fit(mag_calibration_t* cal, mag_calibration_fit_t* fit) {
+  double p[NUM_PARAMS];
+  for (int i = NUM_PARAMS - 1; i >= 0; i--) {
+    double sum = cal->work[i][NUM_PARAMS];
+    for (int j = i + 1; j < NUM_PARAMS; j++) {
+      sum -= cal->work[i][j] * p[j];
+    }
+    p[i] = sum / cal->work[i][i];
+  }
+
+  // Every axis must be covered: rhs holds the sums of x^2 and x
+  double w = cal->work_weight;
+  for (int i = 0; i < 3; i++) {
+    double mean = cal->work_rhs[3 + i] / w;
+    double variance = cal->work_rhs[i] / w - mean * mean;
+    if (variance < MAG_CAL_MIN_SPREAD * MAG_CAL_MIN_SPREAD) {
+      return false;
+    }
+  }
+
+  // A (x - cx)^2 + B (y - cy)^2 + C (z - cz)^2 = g. A, B, C and g all come
+  // out negative when the ellipsoid does not contain the starting center.
+  double g = 1.0;
+  double center[3], axis[3];
+  for (int i = 0; i < 3; i++) {
+    center[i] = -p[3 + i] / (2.0 * p[i]);
+    g += p[i] * center[i] * center[i];
+  }
+  for (int i = 0; i < 3; i++) {
+    if (!(g / p[i] > 0.0)) {
+      return false;
+    }
+    axis[i] = sqrt(g / p[i]);
+  }
+  double radius = (axis[0] + axis[1] + axis[2]) / 3.0;
+
+  // At the least squares solution the residual sum of squares is w - p.rhs.
+  // The algebraic error is about twice the relative distance from the surface.
+  double rss = w;
+  for (int i = 0; i < NUM_PARAMS; i++) {
+    rss -= p[i] * cal->work_rhs[i];
+  }
+  float residual = (float) (sqrt(rss > 0.0 ? rss / w : 0.0) / (2.0 * fabs(g)));
+
+  fit->field = (float) (radius * cal->unit);
+  fit->residual = residual;
+  for (int i = 0; i < 3; i++) {
+    fit->bias[i] = (float) (cal->center[i] + center[i] * cal->unit);
+    fit->scale[i] = (float) (radius / axis[i]);
+  }
+
+  if (residual > MAG_CAL_MAX_RESIDUAL || fit->field < MAG_CAL_MIN_FIELD || fit->field > MAG_CAL_MAX_FIELD) {
+    return false;
+  }
+  for (int i = 0; i < 3; i++) {
+    if (fit->scale[i] > MAG_CAL_MAX_SCALE || fit->scale[i] < 1.0f / MAG_CAL_MAX_SCALE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// True if `fit` is far enough from the calibration in use to be worth applying
+static bool fit_changed(const mag_calibration_t* cal, const mag_calibration_fit_t* fit) {
+  for (int i = 0; i < 3; i++) {
+    if (fabsf(fit->bias[i] - cal->bias[i]) > MAG_CAL_MIN_BIAS_CHANGE ||
+        fabsf(fit->scale[i] - cal->scale[i]) > MAG_CAL_MIN_SCALE_CHANGE * cal->scale[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool mag_calibration_step(mag_calibration_t* cal, mag_calibration_fit_t* fit) {
+  if (cal->pivot < 0) {
+    if (cal->new_samples >= MAG_CAL_SOLVE_INTERVAL) {
+      start_fit(cal);
+    }
+    return false;
+  }
+
+  if (cal->pivot < NUM_PARAMS) {
+    if (eliminate(cal, cal->pivot)) {
+      cal->pivot++;
+    } else {
+      cal->fits_rejected++;
+      cal->pivot = -1;
+    }
+    return false;
+  }
+
+  cal->pivot = -1;
+  mag_calibration_fit_t candidate;
+  if (!finish_fit(cal, &candidate)) {
+    cal->fits_rejected++;
+    return false;
+  }
+  if (!fit_changed(cal, &candidate)) {
+    return false;
+  }
+
+  cal->fits_accepted++;
+  for (int i = 0; i < 3; i++) {
+    cal->bias[i] = candidate.bias[i];
+    cal->scale[i] = candidate.scale[i];
+  }
+  *fit = candidate;
+  return true;
+}
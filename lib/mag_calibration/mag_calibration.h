@@ -0,0 +1,81 @@
+// Online magnetometer calibration
+//
+// Fits an axis-aligned ellipsoid (hard iron offset plus a soft iron scale per
+// axis) to magnetometer readings taken during normal use. Samples go into a
+// fixed-size set of least squares sums that slowly forget old data, so memory
+// does not grow with ride length. The fit itself runs a slice at a time from
+// mag_calibration_step, one pivot of the 6x6 solve per call.
+//
+// A fit is only reported once the readings cover enough of the sphere on
+// every axis and fit the ellipsoid well. Riding mostly turns the bike about
+// the vertical axis, so expect the first fit after the unit has been tilted
+// or carried around.
+//
+// Pure C, no SDK dependencies.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Readings weigh in with a time constant of this many samples (8.5 min with the
+// AK8963 in continuous mode 2, 100 Hz)
+#define MAG_CAL_MEMORY_SAMPLES 51200
+// Try a fit after this many new samples (32 s at 100 Hz)
+#define MAG_CAL_SOLVE_INTERVAL 3200
+// Standard deviation of the readings on every axis, as a fraction of the field
+#define MAG_CAL_MIN_SPREAD 0.25f
+// RMS distance of the readings from the fitted ellipsoid, as a fraction of the field
+#define MAG_CAL_MAX_RESIDUAL 0.03f
+// Plausible field strength, milligauss
+#define MAG_CAL_MIN_FIELD 150.0f
+#define MAG_CAL_MAX_FIELD 1000.0f
+// Largest soft iron correction accepted on any axis
+#define MAG_CAL_MAX_SCALE 1.5f
+// Only report fits that move the bias by this much (milligauss) or a scale by this fraction
+#define MAG_CAL_MIN_BIAS_CHANGE 5.0f
+#define MAG_CAL_MIN_SCALE_CHANGE 0.01f
+
+typedef struct {
+  float bias[3];     // Hard iron, milligauss, subtracted before scaling
+  float scale[3];    // Soft iron, per axis
+  float field;       // Mean field strength, milligauss
+  float residual;    // RMS fit error, fraction of the field
+} mag_calibration_fit_t;
+
+typedef struct {
+  // Readings are centered and scaled to about unit length for conditioning
+  float center[3];
+  float unit;
+
+  // Calibration in use, to judge whether a new fit is worth reporting
+  float bias[3];
+  float scale[3];
+
+  // Decaying least squares sums for A x^2 + B y^2 + C z^2 + D x + E y + F z = 1
+  double normal[6][6];
+  double rhs[6];
+  double weight;
+  uint16_t new_samples;
+
+  // Fit in progress: augmented normal equations, a copy of the sums they
+  // came from, and the next pivot (-1 when idle)
+  double work[6][7];
+  double work_rhs[6];
+  double work_weight;
+  int8_t pivot;
+
+  uint32_t fits_accepted;
+  uint32_t fits_rejected;
+} mag_calibration_t;
+
+// Start from the calibration currently applied to the readings
+void mag_calibration_init(mag_calibration_t* cal, const float bias[3], const float scale[3]);
+
+// Add one new magnetometer reading in milligauss, without the bias and scale applied
+void mag_calibration_add_sample(mag_calibration_t* cal, const float m[3]);
+
+// Run one slice of a pending fit. Returns true and fills `fit` when a fit
+// passed every check and differs enough from the calibration in use; it then
+// becomes the calibration in use.
+bool mag_calibration_step(mag_calibration_t* cal, mag_calibration_fit_t* fit);
@@ -0,0 +1,85 @@
+#include <math.h>
+
+#include "orientation.h"
+
+#define PI_F 3.14159265f
+#define HALF_PI_F 1.57079633f
+#define RAD_TO_DEG (180.0f / PI_F)
+
+// atan(x) for |x| <= 1, error below 1.2e-5 radians
+static float atan_unit(float x) {
+  float x2 = x * x;
+  return x * (0.9998660f + x2 * (-0.3302995f + x2 * (0.1801410f + x2 * (-0.0851330f + x2 * 0.0208351f))));
+}
+
+float orientation_atan2(float y, float x) {
+  float abs_x = fabsf(x);
+  float abs_y = fabsf(y);
+  if (abs_x == 0.0f && abs_y == 0.0f) {
+    return 0.0f;
+  }
+
+  // Keep the polynomial's argument within [-1, 1]
+  float angle;
+  if (abs_y <= abs_x) {
+    angle = atan_unit(abs_y / abs_x);
+  } else {
+    angle = HALF_PI_F - atan_unit(abs_x / abs_y);
+  }
+
+  if (x < 0.0f) {
+    angle = PI_F - angle;
+  }
+  return y < 0.0f ? -angle : angle;
+}
+
+// Error below 7e-5 radians
+float orientation_asin(float x) {
+  float abs_x = fabsf(x);
+  if (abs_x > 1.0f) {
+    abs_x = 1.0f;
+  }
+  float angle = HALF_PI_F - sqrtf(1.0f - abs_x) * (1.5707288f + abs_x * (-0.2121144f + abs_x * (0.0742610f + abs_x * -0.0187293f)));
+  return x < 0.0f ? -angle : angle;
+}
+
+void orientation_compute(const float q[4], const float accel[3], float declination_deg,
+                         uint32_t fields, orientation_t* out) {
+  float q0q0 = q[0] * q[0];
+  float q1q1 = q[1] * q[1];
+  float q2q2 = q[2] * q[2];
+  float q3q3 = q[3] * q[3];
+
+  // Rotation matrix coefficients, computed only when something uses them
+  float a31 = 0, a32 = 0, a33 = 0;
+  if (fields & (ORIENTATION_ROLL | ORIENTATION_PITCH | ORIENTATION_GRAVITY | ORIENTATION_LINEAR_ACCEL)) {
+    a31 = 2.0f * (q[0] * q[1] + q[2] * q[3]);
+    a32 = 2.0f * (q[1] * q[3] - q[0] * q[2]);
+    a33 = q0q0 - q1q1 - q2q2 + q3q3;
+  }
+
+  if (fields & ORIENTATION_ROLL) {
+    out->roll = orientation_atan2(a31, a33) * RAD_TO_DEG;
+  }
+  if (fields & ORIENTATION_PITCH) {
+    out->pitch = -orientation_asin(a32) * RAD_TO_DEG;
+  }
+  if (fields & ORIENTATION_YAW) {
+    float a12 = 2.0f * (q[1] * q[2] + q[0] * q[3]);
+    float a22 = q0q0 + q1q1 - q2q2 - q3q3;
+    float yaw = orientation_atan2(a12, a22) * RAD_TO_DEG + declination_deg;
+    if (yaw < 0) yaw += 360.0f; // Ensure yaw stays between 0 and 360
+    if (yaw >= 360.0f) yaw -= 360.0f;
+    out->yaw = yaw;
+  }
+  if (fields & ORIENTATION_GRAVITY) {
+    out->gravity[0] = -a31;
+    out->gravity[1] = -a32;
+    out->gravity[2] = a33;
+  }
+  if (fields & ORIENTATION_LINEAR_ACCEL) {
+    out->linear_accel[0] = accel[0] + a31;
+    out->linear_accel[1] = accel[1] + a32;
+    out->linear_accel[2] = accel[2] - a33;
+  }
+}
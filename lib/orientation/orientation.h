@@ -0,0 +1,35 @@
+// Orientation outputs from the AHRS quaternion
+//
+// Derives only the requested quantities from a Madgwick quaternion, using
+// polynomial arctangent/arcsine approximations instead of libm trig:
+//   roll, yaw:  max error 0.0007 degrees (atan, Abramowitz & Stegun 4.4.49)
+//   pitch:      max error 0.004 degrees (asin, Abramowitz & Stegun 4.4.45)
+// Gravity and linear acceleration need no trig at all. Pure C.
+
+#pragma once
+
+#include <stdint.h>
+
+#define ORIENTATION_ROLL          (1 << 0)
+#define ORIENTATION_PITCH         (1 << 1)
+#define ORIENTATION_YAW           (1 << 2)
+#define ORIENTATION_GRAVITY       (1 << 3)
+#define ORIENTATION_LINEAR_ACCEL  (1 << 4)
+#define ORIENTATION_ALL           0x1F
+
+typedef struct {
+  float roll;               // Degrees, positive leaning left
+  float pitch;              // Degrees
+  float yaw;                // Degrees from north including declination, 0 to 360
+  float gravity[3];         // Gravity in the sensor frame, g
+  float linear_accel[3];    // Acceleration with gravity removed, g
+} orientation_t;
+
+// Fill in the `fields` of `out` (other members are left unchanged). `accel` is
+// the sensor acceleration in g and is only needed for ORIENTATION_LINEAR_ACCEL.
+void orientation_compute(const float q[4], const float accel[3], float declination_deg,
+                         uint32_t fields, orientation_t* out);
+
+// The approximations, in radians
+float orientation_atan2(float y, float x);
+float orientation_asin(float x);
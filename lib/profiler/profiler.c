@@ -0,0 +1,118 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "app_util_platform.h"
+#include "nrf.h"
+
+#include "profiler.h"
+
+#if PROFILER_ENABLED
+
+static const char* probe_names[PROFILE_NUM_PROBES] = {
+  [PROFILE_IMU_READ] = "IMU read",
+  [PROFILE_MADGWICK] = "Madgwick",
+  [PROFILE_ORIENTATION] = "Euler",
+  [PROFILE_SMOOTHING] = "smoothing",
+  [PROFILE_MAG_CALIBRATION] = "mag cal",
+  [PROFILE_FSM] = "FSM",
+  [PROFILE_DISPLAY] = "display",
+  [PROFILE_LED_SHOW] = "LED show",
+  [PROFILE_SI7021] = "Si7021",
+  [PROFILE_RIDE_LOG] = "ride log",
+};
+
+static profile_stats_t table[PROFILE_NUM_PROBES];
+
+void profiler_init(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  profiler_reset();
+}
+
+void profiler_record(profile_probe_t probe, uint32_t cycles) {
+  if ((unsigned) probe >= PROFILE_NUM_PROBES) {
+    return;
+  }
+
+  uint32_t scaled = cycles >> PROFILER_HISTOGRAM_SHIFT;
+  uint32_t bucket = scaled ? 31 - __CLZ(scaled) : 0;
+  if (bucket >= PROFILER_HISTOGRAM_BUCKETS) {
+    bucket = PROFILER_HISTOGRAM_BUCKETS - 1;
+  }
+
+  CRITICAL_REGION_ENTER();
+  profile_stats_t* stats = &table[probe];
+  stats->count++;
+  stats->total_cycles += cycles;
+  if (cycles < stats->min_cycles) {
+    stats->min_cycles = cycles;
+  }
+  if (cycles > stats->max_cycles) {
+    stats->max_cycles = cycles;
+  }
+  stats->histogram[bucket]++;
+  CRITICAL_REGION_EXIT();
+}
+
+bool profiler_get(profile_probe_t probe, profile_stats_t* stats) {
+  if ((unsigned) probe >= PROFILE_NUM_PROBES) {
+    return false;
+  }
+  CRITICAL_REGION_ENTER();
+  *stats = table[probe];
+  CRITICAL_REGION_EXIT();
+  return true;
+}
+
+void profiler_reset(void) {
+  CRITICAL_REGION_ENTER();
+  memset(table, 0, sizeof(table));
+  for (int i = 0; i < PROFILE_NUM_PROBES; i++) {
+    table[i].min_cycles = UINT32_MAX;
+  }
+  CRITICAL_REGION_EXIT();
+}
+
+void profiler_dump(void) {
+  float cycles_per_us = SystemCoreClock / 1000000.0f;
+
+  printf("%-10s %8s %9s %9s %9s  histogram: under %.0f us, then doubling\n", "probe", "count", "min us", "mean us", "max us",
+         (1 << (PROFILER_HISTOGRAM_SHIFT + 1)) / cycles_per_us);
+  for (int i = 0; i < PROFILE_NUM_PROBES; i++) {
+    profile_stats_t stats;
+    profiler_get(i, &stats);
+    if (stats.count == 0) {
+      continue;
+    }
+    printf("%-10s %8lu %9.1f %9.1f %9.1f ", probe_names[i], (unsigned long) stats.count,
+           stats.min_cycles / cycles_per_us, (float) stats.total_cycles / stats.count / cycles_per_us,
+           stats.max_cycles / cycles_per_us);
+    for (int b = 0; b < PROFILER_HISTOGRAM_BUCKETS; b++) {
+      printf(" %lu", (unsigned long) stats.histogram[b]);
+    }
+    printf("\n");
+  }
+}
+
+#else
+
+void profiler_init(void) {
+}
+
+void profiler_record(profile_probe_t probe, uint32_t cycles) {
+}
+
+bool profiler_get(profile_probe_t probe, profile_stats_t* stats) {
+  return false;
+}
+
+void profiler_dump(void) {
+  printf("Profiling compiled out (PROFILER_ENABLED=0), %d probes\n", PROFILE_NUM_PROBES);
+}
+
+void profiler_reset(void) {
+}
+
+#endif
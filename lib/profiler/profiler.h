@@ -0,0 +1,72 @@
+// Cycle-count profiler
+//
+// Times pipeline stages with the Cortex-M4 cycle counter (DWT->CYCCNT) and
+// keeps count, min, max, mean and a power-of-two histogram per probe in a
+// static table. Wrap a stage in PROFILE_START/PROFILE_END; probes may be used
+// from interrupts. profiler_dump prints the table with printf (RTT or UART,
+// wherever stdout goes).
+//
+// Build with -DPROFILER_ENABLED=0 to compile every probe and the table out.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+typedef enum {
+  PROFILE_IMU_READ,
+  PROFILE_MADGWICK,
+  PROFILE_ORIENTATION,
+  PROFILE_SMOOTHING,
+  PROFILE_MAG_CALIBRATION,
+  PROFILE_FSM,
+  PROFILE_DISPLAY,
+  PROFILE_LED_SHOW,
+  PROFILE_SI7021,
+  PROFILE_RIDE_LOG,
+  PROFILE_NUM_PROBES,
+} profile_probe_t;
+
+// Histogram bucket 0 holds durations under 2^(PROFILER_HISTOGRAM_SHIFT + 1)
+// cycles, each bucket after it twice as long, and the last bucket everything longer
+#define PROFILER_HISTOGRAM_BUCKETS 12
+#define PROFILER_HISTOGRAM_SHIFT 6
+
+typedef struct {
+  uint32_t count;
+  uint32_t min_cycles;
+  uint32_t max_cycles;
+  uint64_t total_cycles;
+  uint32_t histogram[PROFILER_HISTOGRAM_BUCKETS];
+} profile_stats_t;
+
+#if PROFILER_ENABLED
+
+#include "nrf.h"
+
+#define PROFILE_START(probe) uint32_t profile_start_##probe = DWT->CYCCNT
+#define PROFILE_END(probe) profiler_record(probe, DWT->CYCCNT - profile_start_##probe)
+
+#else
+
+#define PROFILE_START(probe) do {} while (0)
+#define PROFILE_END(probe) do {} while (0)
+
+#endif
+
+// Start the cycle counter and clear the table
+void profiler_init(void);
+
+void profiler_record(profile_probe_t probe, uint32_t cycles);
+
+// Copy of one probe's statistics, false if profiling is compiled out
+bool profiler_get(profile_probe_t probe, profile_stats_t* stats);
+
+// Print every probe that has run, in microseconds
+void profiler_dump(void);
+
+void profiler_reset(void);
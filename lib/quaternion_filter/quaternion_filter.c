@@ -1,5 +1,6 @@
 #include "quaternion_filter.h"
 #include <math.h>
+#include <stdint.h>
 
 // Implementation of Sebastian Madgwick's "...efficient orientation filter for... inertial/magnetic sensor arrays"
 // (see http://www.x-io.co.uk/category/open-source/ for examples and more details)
@@ -96,4 +97,143 @@ void MadgwickQuaternionUpdate(float *q, float beta, float deltat, float ax, floa
     q[2] = q3 * norm;
     q[3] = q4 * norm;
 
-}
\ No newline at end of file
+}
+// Fast inverse square root: refined constant and first Newton step from Moroz et al., then a
+// plain Newton step (maximum relative error about 1e-6), replacing an sqrtf and a divide.
+static float inv_sqrt(float x) {
+    union {
+        float f;
+        uint32_t i;
+    } conv = { .f = x };
+    conv.i = 0x5F1FFFF9 - (conv.i >> 1);
+    conv.f *= 0.703952253f * (2.38924456f - x * conv.f * conv.f);
+    conv.f *= 1.5f - 0.5f * x * conv.f * conv.f;
+    return conv.f;
+}
+
+// Integrate the gyro rate plus the normalised corrective step, then renormalise
+static void integrate_quaternion(float *q, float beta, float deltat, float gx, float gy, float gz, float s1, float s2, float s3, float s4) {
+    float q1 = q[0], q2 = q[1], q3 = q[2], q4 = q[3];
+    float norm;
+
+    // Compute rate of change of quaternion
+    float qDot1 = 0.5f * (-q2 * gx - q3 * gy - q4 * gz);
+    float qDot2 = 0.5f * (q1 * gx + q3 * gz - q4 * gy);
+    float qDot3 = 0.5f * (q1 * gy - q2 * gz + q4 * gx);
+    float qDot4 = 0.5f * (q1 * gz + q2 * gy - q3 * gx);
+
+    norm = s1 * s1 + s2 * s2 + s3 * s3 + s4 * s4;
+    if (norm > 0.0f) { // Zero at the exact solution
+        norm = beta * inv_sqrt(norm);
+        qDot1 -= norm * s1;
+        qDot2 -= norm * s2;
+        qDot3 -= norm * s3;
+        qDot4 -= norm * s4;
+    }
+
+    // Integrate to yield quaternion
+    q1 += qDot1 * deltat;
+    q2 += qDot2 * deltat;
+    q3 += qDot3 * deltat;
+    q4 += qDot4 * deltat;
+    norm = inv_sqrt(q1 * q1 + q2 * q2 + q3 * q3 + q4 * q4);    // normalise quaternion
+    q[0] = q1 * norm;
+    q[1] = q2 * norm;
+    q[2] = q3 * norm;
+    q[3] = q4 * norm;
+}
+
+// Same filter as MadgwickQuaternionUpdate, restructured for speed: the six objective function
+// residuals are evaluated once and the gradient is formed as J^T * f, and every normalisation uses
+// inv_sqrt. Falls back to the IMU-only update if the magnetometer reading is all zero.
+void MadgwickQuaternionUpdateFast(float *q, float beta, float deltat, float ax, float ay, float az, float gx, float gy, float gz, float mx, float my, float mz) {
+    float q1 = q[0], q2 = q[1], q3 = q[2], q4 = q[3];
+    float norm;
+
+    norm = mx * mx + my * my + mz * mz;
+    if (norm == 0.0f) {
+        MadgwickQuaternionUpdateIMU(q, beta, deltat, ax, ay, az, gx, gy, gz);
+        return;
+    }
+    norm = inv_sqrt(norm);
+    mx *= norm;
+    my *= norm;
+    mz *= norm;
+
+    norm = ax * ax + ay * ay + az * az;
+    if (norm == 0.0f) return; // handle NaN
+    norm = inv_sqrt(norm);
+    ax *= norm;
+    ay *= norm;
+    az *= norm;
+
+    float q1q1 = q1 * q1;
+    float q1q2 = q1 * q2;
+    float q1q3 = q1 * q3;
+    float q1q4 = q1 * q4;
+    float q2q2 = q2 * q2;
+    float q2q3 = q2 * q3;
+    float q2q4 = q2 * q4;
+    float q3q3 = q3 * q3;
+    float q3q4 = q3 * q4;
+    float q4q4 = q4 * q4;
+
+    // Reference direction of Earth's magnetic field (m rotated into the earth frame)
+    float hx = mx * (q1q1 + q2q2 - q3q3 - q4q4) + 2.0f * my * (q2q3 - q1q4) + 2.0f * mz * (q2q4 + q1q3);
+    float hy = 2.0f * mx * (q2q3 + q1q4) + my * (q1q1 - q2q2 + q3q3 - q4q4) + 2.0f * mz * (q3q4 - q1q2);
+    float _2bz = 2.0f * mx * (q2q4 - q1q3) + 2.0f * my * (q3q4 + q1q2) + mz * (q1q1 - q2q2 - q3q3 + q4q4);
+    float _2bx = sqrtf(hx * hx + hy * hy);
+
+    // Objective function residuals for gravity and the magnetic field
+    float f1 = 2.0f * (q2q4 - q1q3) - ax;
+    float f2 = 2.0f * (q1q2 + q3q4) - ay;
+    float f3 = 1.0f - 2.0f * (q2q2 + q3q3) - az;
+    float f4 = _2bx * (0.5f - q3q3 - q4q4) + _2bz * (q2q4 - q1q3) - mx;
+    float f5 = _2bx * (q2q3 - q1q4) + _2bz * (q1q2 + q3q4) - my;
+    float f6 = _2bx * (q1q3 + q2q4) + _2bz * (0.5f - q2q2 - q3q3) - mz;
+
+    // Gradient decent algorithm corrective step
+    float _2q1 = 2.0f * q1;
+    float _2q2 = 2.0f * q2;
+    float _2q3 = 2.0f * q3;
+    float _2q4 = 2.0f * q4;
+    float _2bxq1 = _2bx * q1, _2bxq2 = _2bx * q2, _2bxq3 = _2bx * q3, _2bxq4 = _2bx * q4;
+    float _2bzq1 = _2bz * q1, _2bzq2 = _2bz * q2, _2bzq3 = _2bz * q3, _2bzq4 = _2bz * q4;
+    float s1 = -_2q3 * f1 + _2q2 * f2 - _2bzq3 * f4 + (_2bzq2 - _2bxq4) * f5 + _2bxq3 * f6;
+    float s2 = _2q4 * f1 + _2q1 * f2 - 2.0f * _2q2 * f3 + _2bzq4 * f4 + (_2bxq3 + _2bzq1) * f5 + (_2bxq4 - 2.0f * _2bzq2) * f6;
+    float s3 = -_2q1 * f1 + _2q4 * f2 - 2.0f * _2q3 * f3 + (-2.0f * _2bxq3 - _2bzq1) * f4 + (_2bxq2 + _2bzq4) * f5 + (_2bxq1 - 2.0f * _2bzq3) * f6;
+    float s4 = _2q2 * f1 + _2q3 * f2 + (-2.0f * _2bxq4 + _2bzq2) * f4 + (_2bzq3 - _2bxq1) * f5 + _2bxq2 * f6;
+
+    integrate_quaternion(q, beta, deltat, gx, gy, gz, s1, s2, s3, s4);
+}
+
+// 6-DoF variant for samples without a fresh magnetometer reading: corrects pitch and roll
+// against gravity only, and lets yaw run on the gyro until the next magnetometer sample.
+void MadgwickQuaternionUpdateIMU(float *q, float beta, float deltat, float ax, float ay, float az, float gx, float gy, float gz) {
+    float q1 = q[0], q2 = q[1], q3 = q[2], q4 = q[3];
+    float norm;
+
+    norm = ax * ax + ay * ay + az * az;
+    if (norm == 0.0f) return; // handle NaN
+    norm = inv_sqrt(norm);
+    ax *= norm;
+    ay *= norm;
+    az *= norm;
+
+    // Objective function residuals for gravity
+    float f1 = 2.0f * (q2 * q4 - q1 * q3) - ax;
+    float f2 = 2.0f * (q1 * q2 + q3 * q4) - ay;
+    float f3 = 1.0f - 2.0f * (q2 * q2 + q3 * q3) - az;
+
+    // Gradient decent algorithm corrective step
+    float _2q1 = 2.0f * q1;
+    float _2q2 = 2.0f * q2;
+    float _2q3 = 2.0f * q3;
+    float _2q4 = 2.0f * q4;
+    float s1 = -_2q3 * f1 + _2q2 * f2;
+    float s2 = _2q4 * f1 + _2q1 * f2 - 2.0f * _2q2 * f3;
+    float s3 = -_2q1 * f1 + _2q4 * f2 - 2.0f * _2q3 * f3;
+    float s4 = _2q2 * f1 + _2q3 * f2;
+
+    integrate_quaternion(q, beta, deltat, gx, gy, gz, s1, s2, s3, s4);
+}
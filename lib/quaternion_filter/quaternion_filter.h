@@ -1,2 +1,8 @@
-// Madgwick AHRS algorithm
-void MadgwickQuaternionUpdate(float *q, float beta, float deltat, float ax, float ay, float az, float gx, float gy, float gz, float mx, float my, float mz);
\ No newline at end of file
+// Madgwick AHRS algorithm. Gyro rates and beta in rad/s, deltat in seconds.
+void MadgwickQuaternionUpdate(float *q, float beta, float deltat, float ax, float ay, float az, float gx, float gy, float gz, float mx, float my, float mz);
+
+// Faster equivalent of MadgwickQuaternionUpdate (shared subexpressions, fast inverse square root)
+void MadgwickQuaternionUpdateFast(float *q, float beta, float deltat, float ax, float ay, float az, float gx, float gy, float gz, float mx, float my, float mz);
+
+// Accelerometer and gyro only, for samples without fresh magnetometer data
+void MadgwickQuaternionUpdateIMU(float *q, float beta, float deltat, float ax, float ay, float az, float gx, float gy, float gz);
@@ -0,0 +1,78 @@
+#include <stdio.h>
+
+#include "rate_plan.h"
+
+// MPU-9250 DLPF settings 1..6 and their gyro bandwidths in Hz
+static const uint16_t dlpf_bandwidth_hz[] = {184, 92, 41, 20, 10, 5};
+
+// Widest low pass at or below a quarter of the sample rate
+static uint8_t dlpf_for_rate(uint16_t rate_hz) {
+  uint8_t n = sizeof(dlpf_bandwidth_hz)/sizeof(dlpf_bandwidth_hz[0]);
+  for (uint8_t i = 0; i < n; i++) {
+    if (dlpf_bandwidth_hz[i] * 4 <= rate_hz) {
+      return i + 1;
+    }
+  }
+  return n;
+}
+
+void rate_plan_init(rate_plan_t* plan) {
+  uint32_t rate = RATE_PLAN_IMU_RATE_HZ;
+  if (rate < 4) {
+    rate = 4;
+  } else if (rate > 1000) {
+    rate = 1000;
+  }
+  plan->IMU_smplrt_div = (1000 / rate) - 1;
+  plan->IMU_rate_hz = 1000 / (1 + plan->IMU_smplrt_div);
+
+  if (RATE_PLAN_IMU_DLPF >= 1 && RATE_PLAN_IMU_DLPF <= 6) {
+    plan->IMU_dlpf_config = RATE_PLAN_IMU_DLPF;
+  } else {
+    plan->IMU_dlpf_config = dlpf_for_rate(plan->IMU_rate_hz);
+  }
+
+  plan->IMU_batch = RATE_PLAN_IMU_BATCH > 0 ? RATE_PLAN_IMU_BATCH : 1;
+  plan->fsm_decimation = RATE_PLAN_FSM_DECIMATION > 0 ? RATE_PLAN_FSM_DECIMATION : 1;
+
+  uint32_t periodic = ((uint32_t)plan->IMU_rate_hz * RATE_PLAN_PERIODIC_MS + 999) / 1000;
+  plan->periodic_decimation = periodic > 0 ? periodic : 1;
+
+  uint32_t ride_log = RATE_PLAN_RIDE_LOG_HZ > 0 ? plan->IMU_rate_hz / RATE_PLAN_RIDE_LOG_HZ : 0;
+  plan->ride_log_decimation = ride_log > 0 ? ride_log : 1;
+
+  uint32_t telemetry = RATE_PLAN_TELEMETRY_HZ > 0 ? plan->IMU_rate_hz / RATE_PLAN_TELEMETRY_HZ : 0;
+  plan->telemetry_decimation = telemetry > 0 ? telemetry : 1;
+
+  plan->hall_window_ms = RATE_PLAN_HALL_WINDOW_MS > 0 ? RATE_PLAN_HALL_WINDOW_MS : 1;
+
+  // Periods counted in hall windows; a window longer than the period fires every window
+  uint32_t report = RATE_PLAN_POWER_REPORT_MS / plan->hall_window_ms;
+  plan->power_report_windows = report > 0 ? report : 1;
+  uint32_t page = RATE_PLAN_DISPLAY_PAGE_MS / plan->hall_window_ms;
+  plan->display_page_windows = page > 0 ? page : 1;
+}
+
+void rate_plan_print(const rate_plan_t* plan) {
+  printf("IMU %u Hz (SMPLRT_DIV %u, DLPF %u), %u per batch\n",
+         plan->IMU_rate_hz, plan->IMU_smplrt_div, plan->IMU_dlpf_config, plan->IMU_batch);
+  printf("FSM every %u samples, periodic every %u samples, ride log every %u samples, telemetry every %u samples\n",
+         plan->fsm_decimation, plan->periodic_decimation, plan->ride_log_decimation, plan->telemetry_decimation);
+  printf("Hall window %u ms, power report every %u windows, histogram page %u windows, LED frame %u/%u ms\n",
+         plan->hall_window_ms, plan->power_report_windows, plan->display_page_windows, RATE_PLAN_LED_FRAME_MS, RATE_PLAN_LED_FLASH_MS);
+}
+
+void rate_divider_init(rate_divider_t* divider, uint16_t period) {
+  divider->period = period > 0 ? period : 1;
+  divider->count = 0;
+}
+
+bool rate_divider_step(rate_divider_t* divider, uint16_t steps) {
+  uint32_t count = (uint32_t)divider->count + steps;
+  if (count < divider->period) {
+    divider->count = count;
+    return false;
+  }
+  divider->count = count % divider->period;
+  return true;
+}
@@ -0,0 +1,108 @@
+// Sensor rate plan
+//
+// One place that says how often each stage of the dashboard pipeline runs.
+// The IMU output data rate drives the AHRS; the FSM and the slow periodic work
+// are decimated from it, so the work done per second is fixed by the plan
+// rather than by whatever interrupts happen to arrive. The hall window and LED
+// frames run from their own app timers.
+//
+// Every RATE_PLAN_* value can be overridden per deployment from the app
+// Makefile, e.g. CFLAGS += -DRATE_PLAN_IMU_RATE_HZ=100
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// MPU output data rate, realised as 1 kHz / (1 + SMPLRT_DIV)
+#ifndef RATE_PLAN_IMU_RATE_HZ
+#define RATE_PLAN_IMU_RATE_HZ 200
+#endif
+
+// MPU DLPF setting (1..6), 0 to pick the widest bandwidth at or below a quarter of the rate
+#ifndef RATE_PLAN_IMU_DLPF
+#define RATE_PLAN_IMU_DLPF 0
+#endif
+
+// IMU samples per FIFO drain
+#ifndef RATE_PLAN_IMU_BATCH
+#define RATE_PLAN_IMU_BATCH 4
+#endif
+
+// Run the FSM every N IMU samples
+#ifndef RATE_PLAN_FSM_DECIMATION
+#define RATE_PLAN_FSM_DECIMATION 1
+#endif
+
+// Si7021 read and status print
+#ifndef RATE_PLAN_PERIODIC_MS
+#define RATE_PLAN_PERIODIC_MS 500
+#endif
+
+// Ride log samples (speed, distance, roll, lin_ay); at most the IMU rate
+#ifndef RATE_PLAN_RIDE_LOG_HZ
+#define RATE_PLAN_RIDE_LOG_HZ 100
+#endif
+
+// BLE telemetry samples; at most the IMU rate
+#ifndef RATE_PLAN_TELEMETRY_HZ
+#define RATE_PLAN_TELEMETRY_HZ 20
+#endif
+
+// Hall speed window and display refresh
+#ifndef RATE_PLAN_HALL_WINDOW_MS
+#define RATE_PLAN_HALL_WINDOW_MS 250
+#endif
+
+// Sleep and power report, counted in hall windows
+#ifndef RATE_PLAN_POWER_REPORT_MS
+#define RATE_PLAN_POWER_REPORT_MS 10000
+#endif
+
+// Time each trip histogram bin is shown on the display
+#ifndef RATE_PLAN_DISPLAY_PAGE_MS
+#define RATE_PLAN_DISPLAY_PAGE_MS 1500
+#endif
+
+// LED animation frames: sweeps and static patterns, and the brake flash
+#ifndef RATE_PLAN_LED_FRAME_MS
+#define RATE_PLAN_LED_FRAME_MS 250
+#endif
+#ifndef RATE_PLAN_LED_FLASH_MS
+#define RATE_PLAN_LED_FLASH_MS 50
+#endif
+
+// IMU samples in `ms` at the planned rate, for sizing windows at compile time
+#define RATE_PLAN_IMU_SAMPLES(ms) ((RATE_PLAN_IMU_RATE_HZ * (uint32_t)(ms) + 999) / 1000)
+
+typedef struct {
+  uint16_t IMU_rate_hz;            // Rate the MPU actually runs at
+  uint8_t IMU_smplrt_div;
+  uint8_t IMU_dlpf_config;
+  uint8_t IMU_batch;               // Samples per FIFO drain
+  uint16_t fsm_decimation;         // IMU samples per FSM step
+  uint16_t periodic_decimation;    // IMU samples per periodic step
+  uint16_t ride_log_decimation;    // IMU samples per ride log sample
+  uint16_t telemetry_decimation;   // IMU samples per BLE telemetry sample
+  uint16_t hall_window_ms;
+  uint16_t power_report_windows;   // Hall windows per power report, at least 1
+  uint16_t display_page_windows;   // Hall windows per histogram page, at least 1
+} rate_plan_t;
+
+// Counts pipeline steps and fires every `period` of them
+typedef struct {
+  uint16_t period;
+  uint16_t count;
+} rate_divider_t;
+
+// Fill in the plan from the RATE_PLAN_* values, rounding the IMU rate to one
+// the MPU can produce
+void rate_plan_init(rate_plan_t* plan);
+
+// Print each stage's rate
+void rate_plan_print(const rate_plan_t* plan);
+
+void rate_divider_init(rate_divider_t* divider, uint16_t period);
+
+// Advance by `steps`; true if a period boundary was crossed
+bool rate_divider_step(rate_divider_t* divider, uint16_t steps);
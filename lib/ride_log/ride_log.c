@@ -0,0 +1,187 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fds.h"
+#include "nrf_fstorage.h"
+#ifdef SOFTDEVICE_PRESENT
+#include "nrf_fstorage_sd.h"
+#define RIDE_LOG_FSTORAGE_API (&nrf_fstorage_sd)
+#else
+#include "nrf_fstorage_nvmc.h"
+#define RIDE_LOG_FSTORAGE_API (&nrf_fstorage_nvmc)
+#endif
+
+#include "ride_log.h"
+
+#define REGION_START (RIDE_LOG_END_ADDR - RIDE_LOG_NUM_PAGES * RIDE_LOG_PAGE_SIZE)
+
+_Static_assert(sizeof(ride_log_page_t) % 4 == 0, "page header must be whole words");
+_Static_assert(RIDE_LOG_CHUNK_SIZE % 4 == 0, "chunks must be whole words");
+
+static void fstorage_event_handler(nrf_fstorage_evt_t* p_evt);
+
+NRF_FSTORAGE_DEF(nrf_fstorage_t ride_log_fstorage) = {
+  .evt_handler = fstorage_event_handler,
+  .start_addr = REGION_START,
+  .end_addr = RIDE_LOG_END_ADDR,
+};
+
+static bool initialized = false;
+
+// Chunks are written straight from these buffers, so a buffer is only refilled
+// once its write has completed
+static uint32_t buffers[2][RIDE_LOG_CHUNK_SIZE / 4];
+static volatile bool writing[2] = {false, false};
+static uint8_t active = 0;
+static uint16_t used = 0;
+
+// Where the next chunk goes. chunk == RIDE_LOG_CHUNKS_PER_PAGE starts a new page.
+static uint16_t page = RIDE_LOG_NUM_PAGES - 1;
+static uint16_t chunk = RIDE_LOG_CHUNKS_PER_PAGE;
+static uint32_t sequence = 0;
+static ride_log_page_t header;
+
+static ride_log_codec_t codec;
+static ride_log_stats_t stats;
+
+static uint32_t page_address(uint16_t index) {
+  return REGION_START + (uint32_t) index * RIDE_LOG_PAGE_SIZE;
+}
+
+static void fstorage_event_handler(nrf_fstorage_evt_t* p_evt) {
+  if (p_evt->result != NRF_SUCCESS) {
+    stats.write_errors++;
+  }
+  // Chunk writes carry their buffer's busy flag
+  if (p_evt->id == NRF_FSTORAGE_EVT_WRITE_RESULT && p_evt->p_param != NULL) {
+    *(volatile bool*) p_evt->p_param = false;
+  }
+}
+
+// Erase the page after the current one and write its header
+static bool start_page(uint32_t time_ms) {
+  uint16_t next = (page + 1) % RIDE_LOG_NUM_PAGES;
+  uint32_t address = page_address(next);
+
+  ride_log_page_t old;
+  if (nrf_fstorage_read(&ride_log_fstorage, address, &old, sizeof(old)) != NRF_SUCCESS) {
+    old.magic = 0;
+  }
+
+  header.magic = RIDE_LOG_PAGE_MAGIC;
+  header.sequence = sequence + 1;
+  header.erase_count = ride_log_page_valid(&old) ? old.erase_count + 1 : 1;
+  header.start_ms = time_ms;
+
+  if (nrf_fstorage_erase(&ride_log_fstorage, address, 1, NULL) != NRF_SUCCESS ||
+      nrf_fstorage_write(&ride_log_fstorage, address, &header, sizeof(header), NULL) != NRF_SUCCESS) {
+    stats.write_errors++;
+    return false;
+  }
+
+  page = next;
+  chunk = 0;
+  sequence = header.sequence;
+  ride_log_codec_reset(&codec, time_ms);
+  stats.pages_written++;
+  if (header.erase_count > stats.max_erase_count) {
+    stats.max_erase_count = header.erase_count;
+  }
+  return true;
+}
+
+// Pad the active buffer and write it to the next chunk
+static void write_active(void) {
+  if (used == 0) {
+    return;
+  }
+  uint8_t* data = (uint8_t*) buffers[active];
+  memset(&data[used], 0xFF, RIDE_LOG_CHUNK_SIZE - used);
+
+  uint32_t address = page_address(page) + sizeof(ride_log_page_t) + (uint32_t) chunk * RIDE_LOG_CHUNK_SIZE;
+  writing[active] = true;
+  if (nrf_fstorage_write(&ride_log_fstorage, address, data, RIDE_LOG_CHUNK_SIZE, (void*) &writing[active]) != NRF_SUCCESS) {
+    writing[active] = false;
+    stats.write_errors++;
+  }
+
+  chunk++;
+  active ^= 1;
+  used = 0;
+}
+
+ret_code_t ride_log_init(void) {
+  ret_code_t error_code = nrf_fstorage_init(&ride_log_fstorage, RIDE_LOG_FSTORAGE_API, NULL);
+  if (error_code != NRF_SUCCESS) {
+    return error_code;
+  }
+
+  // Carry on after the newest page (sequence numbers compared modulo 2^32)
+  bool found = false;
+  for (uint16_t i = 0; i < RIDE_LOG_NUM_PAGES; i++) {
+    ride_log_page_t existing;
+    error_code = nrf_fstorage_read(&ride_log_fstorage, page_address(i), &existing, sizeof(existing));
+    if (error_code != NRF_SUCCESS) {
+      return error_code;
+    }
+    if (!ride_log_page_valid(&existing)) {
+      continue;
+    }
+    if (!found || (int32_t)(existing.sequence - sequence) > 0) {
+      found = true;
+      page = i;
+      sequence = existing.sequence;
+    }
+    if (existing.erase_count > stats.max_erase_count) {
+      stats.max_erase_count = existing.erase_count;
+    }
+  }
+
+  chunk = RIDE_LOG_CHUNKS_PER_PAGE;
+  used = 0;
+  initialized = true;
+  printf("Ride log at 0x%05lx-0x%05lx, %u pages written\n", (unsigned long) REGION_START,
+         (unsigned long) RIDE_LOG_END_ADDR, found ? (unsigned) sequence : 0);
+  return NRF_SUCCESS;
+}
+
+void ride_log_write(const ride_log_record_t* record) {
+  if (!initialized) {
+    return;
+  }
+
+  // A record always fits an empty chunk, so this takes at most two passes
+  for (int pass = 0; pass < 2; pass++) {
+    if (used == 0) {
+      if (writing[active]) {
+        stats.dropped++;
+        return;
+      }
+      if (chunk >= RIDE_LOG_CHUNKS_PER_PAGE && !start_page(record->time_ms)) {
+        stats.dropped++;
+        return;
+      }
+    }
+
+    size_t n = ride_log_encode(&codec, record, (uint8_t*) buffers[active] + used, RIDE_LOG_CHUNK_SIZE - used);
+    if (n > 0) {
+      used += n;
+      stats.records++;
+      stats.bytes += n;
+      return;
+    }
+    write_active();
+  }
+  stats.dropped++;
+}
+
+void ride_log_flush(void) {
+  if (initialized) {
+    write_active();
+  }
+}
+
+void ride_log_get_stats(ride_log_stats_t* p_stats) {
+  *p_stats = stats;
+}
@@ -0,0 +1,53 @@
+// Ride log
+//
+// Records timestamped speed, distance, roll, lin_ay, temperature, humidity
+// and FSM transitions in internal flash, in the delta-encoded format of
+// ride_log_format.h. Records are encoded into one of two RAM chunk buffers.
+// A full chunk is written with a single fstorage write while the other buffer
+// fills, so logging a record costs only the encoding.
+//
+// The log region is a ring of pages. A new page goes after the newest one,
+// which on boot is found from the header sequence numbers, so every page is
+// erased once per lap however often the board restarts. Each header also
+// keeps the page's erase count. When the ring wraps, the oldest page is lost.
+//
+// Pull the region off with a debugger (e.g. J-Link `savemem`) and turn it into
+// CSV with tools/ride_log_decode. Enable fstorage in sdk_config.h and keep the
+// application below the log region.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "app_error.h"
+#include "ride_log_format.h"
+
+// Flash pages in the ring (4 kB each, about 7 s per page at 100 Hz)
+#ifndef RIDE_LOG_NUM_PAGES
+#define RIDE_LOG_NUM_PAGES 32
+#endif
+
+// Top of the log region, by default just below the FDS pages
+#ifndef RIDE_LOG_END_ADDR
+#define RIDE_LOG_END_ADDR (0x80000 - FDS_VIRTUAL_PAGES * FDS_VIRTUAL_PAGE_SIZE * 4)
+#endif
+
+typedef struct {
+  uint32_t records;         // Records encoded
+  uint32_t bytes;           // Encoded bytes, before chunk padding
+  uint32_t dropped;         // Records dropped while both buffers were busy
+  uint32_t write_errors;    // Failed flash operations
+  uint32_t pages_written;
+  uint32_t max_erase_count; // Most erased page in the ring
+} ride_log_stats_t;
+
+// Find the newest page and get ready to log after it
+ret_code_t ride_log_init(void);
+
+// Encode a record. Call from the main loop only, in time order.
+void ride_log_write(const ride_log_record_t* record);
+
+// Write the partly filled chunk, e.g. before sleeping
+void ride_log_flush(void);
+
+void ride_log_get_stats(ride_log_stats_t* stats);
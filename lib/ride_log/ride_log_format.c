@@ -0,0 +1,203 @@
+#include <math.h>
+
+#include "ride_log_format.h"
+
+#define TAG_TYPE_SHIFT 5
+#define TAG_FIELDS_MASK 0x1F
+#define TAG_PADDING 0xFF
+
+static const float sample_scales[RIDE_LOG_SAMPLE_FIELDS] = {
+  RIDE_LOG_SPEED_SCALE, RIDE_LOG_DISTANCE_SCALE, RIDE_LOG_ROLL_SCALE, RIDE_LOG_LIN_AY_SCALE,
+};
+
+static const float environment_scales[RIDE_LOG_ENVIRONMENT_FIELDS] = {
+  RIDE_LOG_TEMPERATURE_SCALE, RIDE_LOG_HUMIDITY_SCALE,
+};
+
+static size_t put_varint(uint8_t* out, uint32_t value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = (uint8_t) value;
+  return n;
+}
+
+// Returns the bytes used, or 0 if the varint runs past `size` or is too long
+static size_t get_varint(const uint8_t* in, size_t size, uint32_t* value) {
+  uint32_t result = 0;
+  for (size_t n = 0; n < size && n < 5; n++) {
+    result |= (uint32_t)(in[n] & 0x7F) << (7 * n);
+    if ((in[n] & 0x80) == 0) {
+      *value = result;
+      return n + 1;
+    }
+  }
+  return 0;
+}
+
+static uint32_t zigzag(int32_t value) {
+  return ((uint32_t) value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static int32_t quantize(float value, float scale) {
+  return (int32_t) lroundf(value * scale);
+}
+
+void ride_log_codec_reset(ride_log_codec_t* codec, uint32_t start_ms) {
+  codec->time_ms = start_ms;
+  for (int i = 0; i < RIDE_LOG_SAMPLE_FIELDS; i++) {
+    codec->sample[i] = 0;
+  }
+  for (int i = 0; i < RIDE_LOG_ENVIRONMENT_FIELDS; i++) {
+    codec->environment[i] = 0;
+  }
+}
+
+size_t ride_log_encode(ride_log_codec_t* codec, const ride_log_record_t* record, uint8_t* out, size_t size) {
+  uint8_t buffer[RIDE_LOG_MAX_RECORD_SIZE];
+  int32_t values[RIDE_LOG_SAMPLE_FIELDS];
+  int32_t* previous = NULL;
+  const float* scales = NULL;
+  int num_fields = 0;
+  uint8_t fields = 0;
+
+  switch (record->type) {
+    case RIDE_LOG_SAMPLE:
+      previous = codec->sample;
+      scales = sample_scales;
+      num_fields = RIDE_LOG_SAMPLE_FIELDS;
+      values[0] = quantize(record->sample.speed, scales[0]);
+      values[1] = quantize(record->sample.distance, scales[1]);
+      values[2] = quantize(record->sample.roll, scales[2]);
+      values[3] = quantize(record->sample.lin_ay, scales[3]);
+      break;
+    case RIDE_LOG_ENVIRONMENT:
+      previous = codec->environment;
+      scales = environment_scales;
+      num_fields = RIDE_LOG_ENVIRONMENT_FIELDS;
+      values[0] = quantize(record->environment.temperature, scales[0]);
+      values[1] = quantize(record->environment.humidity, scales[1]);
+      break;
+    case RIDE_LOG_STATE:
+      fields = record->state & TAG_FIELDS_MASK;
+      break;
+    default:
+      return 0;
+  }
+
+  for (int i = 0; i < num_fields; i++) {
+    if (values[i] != previous[i]) {
+      fields |= 1 << i;
+    }
+  }
+
+  // Records are in time order; an out-of-order one is logged at the previous time
+  uint32_t elapsed_ms = record->time_ms - codec->time_ms;
+  if ((int32_t) elapsed_ms < 0) {
+    elapsed_ms = 0;
+  }
+
+  size_t n = 0;
+  buffer[n++] = (uint8_t)((record->type << TAG_TYPE_SHIFT) | fields);
+  n += put_varint(&buffer[n], elapsed_ms);
+  for (int i = 0; i < num_fields; i++) {
+    if (fields & (1 << i)) {
+      n += put_varint(&buffer[n], zigzag(values[i] - previous[i]));
+    }
+  }
+  if (n > size) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    out[i] = buffer[i];
+  }
+  codec->time_ms += elapsed_ms;
+  for (int i = 0; i < num_fields; i++) {
+    previous[i] = values[i];
+  }
+  return n;
+}
+
+size_t ride_log_decode(ride_log_codec_t* codec, const uint8_t* in, size_t size, ride_log_record_t* record) {
+  if (size == 0 || in[0] == TAG_PADDING) {
+    return 0;
+  }
+
+  uint8_t tag = in[0];
+  uint8_t fields = tag & TAG_FIELDS_MASK;
+  record->type = (ride_log_record_type_t)(tag >> TAG_TYPE_SHIFT);
+
+  int32_t* current = NULL;
+  const float* scales = NULL;
+  int num_fields = 0;
+  switch (record->type) {
+    case RIDE_LOG_SAMPLE:
+      current = codec->sample;
+      scales = sample_scales;
+      num_fields = RIDE_LOG_SAMPLE_FIELDS;
+      break;
+    case RIDE_LOG_ENVIRONMENT:
+      current = codec->environment;
+      scales = environment_scales;
+      num_fields = RIDE_LOG_ENVIRONMENT_FIELDS;
+      break;
+    case RIDE_LOG_STATE:
+      record->state = fields;
+      fields = 0;
+      break;
+    default:
+      return 0;
+  }
+  if (fields >> num_fields) {
+    return 0;
+  }
+
+  size_t n = 1;
+  uint32_t elapsed_ms;
+  size_t used = get_varint(&in[n], size - n, &elapsed_ms);
+  if (used == 0) {
+    return 0;
+  }
+  n += used;
+
+  int32_t values[RIDE_LOG_SAMPLE_FIELDS];
+  for (int i = 0; i < num_fields; i++) {
+    values[i] = current[i];
+    if (fields & (1 << i)) {
+      uint32_t delta;
+      used = get_varint(&in[n], size - n, &delta);
+      if (used == 0) {
+        return 0;
+      }
+      n += used;
+      values[i] += unzigzag(delta);
+    }
+  }
+
+  codec->time_ms += elapsed_ms;
+  record->time_ms = codec->time_ms;
+  for (int i = 0; i < num_fields; i++) {
+    current[i] = values[i];
+  }
+  if (record->type == RIDE_LOG_SAMPLE) {
+    record->sample.speed = values[0] / scales[0];
+    record->sample.distance = values[1] / scales[1];
+    record->sample.roll = values[2] / scales[2];
+    record->sample.lin_ay = values[3] / scales[3];
+  } else if (record->type == RIDE_LOG_ENVIRONMENT) {
+    record->environment.temperature = values[0] / scales[0];
+    record->environment.humidity = values[1] / scales[1];
+  }
+  return n;
+}
+
+bool ride_log_page_valid(const ride_log_page_t* page) {
+  return page->magic == RIDE_LOG_PAGE_MAGIC;
+}
@@ -0,0 +1,97 @@
+// Ride log record format
+//
+// Shared by the firmware encoder (ride_log.c) and the host decoder
+// (tools/ride_log_decode), so it is pure C.
+//
+// The log is a ring of flash pages. Each page starts with a ride_log_page_t
+// header and is followed by fixed-size chunks of records. A record never
+// spans two chunks, and unused chunk bytes are left at 0xFF.
+//
+// Every record is one tag byte, then a varint of milliseconds since the
+// previous record, then its fields. The top 3 bits of the tag give the record
+// type. The low 5 bits say which fields follow (a state record keeps the
+// state there instead). Each field is a zigzag varint of the change in its
+// quantized value, and unchanged fields are left out. A 100 Hz sample with a
+// slowly changing roll and acceleration usually fits in 4 to 6 bytes.
+//
+// The delta state resets at every page, so pages decode on their own after
+// the ring wraps.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RIDE_LOG_PAGE_SIZE 4096
+#define RIDE_LOG_CHUNK_SIZE 240
+#define RIDE_LOG_PAGE_MAGIC 0x52494445   // "RIDE"
+
+typedef struct {
+  uint32_t magic;
+  uint32_t sequence;      // Increases by one per page written
+  uint32_t erase_count;   // Times this page has been erased
+  uint32_t start_ms;      // Uptime the first record is relative to
+} ride_log_page_t;
+
+#define RIDE_LOG_CHUNKS_PER_PAGE ((RIDE_LOG_PAGE_SIZE - sizeof(ride_log_page_t)) / RIDE_LOG_CHUNK_SIZE)
+
+// Quantization of each logged field
+#define RIDE_LOG_SPEED_SCALE 100.0f        // 0.01 m/s
+#define RIDE_LOG_DISTANCE_SCALE 10.0f      // 0.1 m
+#define RIDE_LOG_ROLL_SCALE 10.0f          // 0.1 degree
+#define RIDE_LOG_LIN_AY_SCALE 1000.0f      // 0.001 g
+#define RIDE_LOG_TEMPERATURE_SCALE 10.0f   // 0.1 degree
+#define RIDE_LOG_HUMIDITY_SCALE 10.0f      // 0.1 %
+
+typedef enum {
+  RIDE_LOG_SAMPLE,        // Speed, distance, roll, lin_ay
+  RIDE_LOG_ENVIRONMENT,   // Temperature, humidity
+  RIDE_LOG_STATE,         // FSM transition
+} ride_log_record_type_t;
+
+#define RIDE_LOG_SAMPLE_FIELDS 4
+#define RIDE_LOG_ENVIRONMENT_FIELDS 2
+
+// Tag plus a 5-byte time varint and up to four 5-byte fields
+#define RIDE_LOG_MAX_RECORD_SIZE (1 + 5 + 5 * RIDE_LOG_SAMPLE_FIELDS)
+
+typedef struct {
+  ride_log_record_type_t type;
+  uint32_t time_ms;
+  union {
+    struct {
+      float speed;        // m/s
+      float distance;     // m
+      float roll;         // Degrees
+      float lin_ay;       // g
+    } sample;
+    struct {
+      float temperature;
+      float humidity;
+    } environment;
+    uint8_t state;
+  };
+} ride_log_record_t;
+
+// Delta state for one direction (encoding or decoding) of one page
+typedef struct {
+  uint32_t time_ms;
+  int32_t sample[RIDE_LOG_SAMPLE_FIELDS];
+  int32_t environment[RIDE_LOG_ENVIRONMENT_FIELDS];
+} ride_log_codec_t;
+
+// Start a page whose header says `start_ms`
+void ride_log_codec_reset(ride_log_codec_t* codec, uint32_t start_ms);
+
+// Append `record` to `out`. Returns the number of bytes written, or 0 (and
+// leaves the codec unchanged) if it does not fit in `size`.
+size_t ride_log_encode(ride_log_codec_t* codec, const ride_log_record_t* record, uint8_t* out, size_t size);
+
+// Read one record from `in`. Returns the number of bytes used, or 0 at
+// padding, at the end of `size` or on a malformed record. Decoded values
+// carry over from earlier records, so unchanged fields are filled in.
+size_t ride_log_decode(ride_log_codec_t* codec, const uint8_t* in, size_t size, ride_log_record_t* record);
+
+// True if `page` has a valid header
+bool ride_log_page_valid(const ride_log_page_t* page);
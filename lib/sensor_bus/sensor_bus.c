@@ -0,0 +1,127 @@
+#include "app_util_platform.h"
+
+#include "sensor_bus.h"
+
+static const nrf_twi_mngr_t* twi_mngr_instance = NULL;
+
+// One FIFO per priority level
+static sensor_bus_job_t* queue_head[SENSOR_BUS_NUM_PRIORITIES] = {NULL};
+static sensor_bus_job_t* queue_tail[SENSOR_BUS_NUM_PRIORITIES] = {NULL};
+
+// Job currently owned by the TWI manager. The transaction descriptor must
+// outlive the transfer, so it is kept here rather than on the stack.
+static sensor_bus_job_t* volatile in_flight = NULL;
+static nrf_twi_mngr_transaction_t transaction;
+
+static void transaction_done(ret_code_t result, void* p_user_data);
+
+// Pops the highest priority job. Must be called with interrupts masked.
+static sensor_bus_job_t* pop_next_job(void) {
+  for (int p = 0; p < SENSOR_BUS_NUM_PRIORITIES; p++) {
+    sensor_bus_job_t* job = queue_head[p];
+    if (job != NULL) {
+      queue_head[p] = job->p_next;
+      if (queue_head[p] == NULL) {
+        queue_tail[p] = NULL;
+      }
+      job->p_next = NULL;
+      return job;
+    }
+  }
+  return NULL;
+}
+
+// Hands the next job to the TWI manager if the bus is free
+static void start_next_job(void) {
+  while (true) {
+    sensor_bus_job_t* failed_job = NULL;
+    ret_code_t error_code = NRF_SUCCESS;
+
+    CRITICAL_REGION_ENTER();
+    if (in_flight == NULL) {
+      sensor_bus_job_t* job = pop_next_job();
+      if (job != NULL) {
+        in_flight = job;
+        transaction.callback = transaction_done;
+        transaction.p_user_data = job;
+        transaction.p_transfers = job->p_transfers;
+        transaction.number_of_transfers = job->number_of_transfers;
+        transaction.p_required_twi_cfg = NULL;
+        error_code = nrf_twi_mngr_schedule(twi_mngr_instance, &transaction);
+        if (error_code != NRF_SUCCESS) {
+          in_flight = NULL;
+          job->queued = false;
+          failed_job = job;
+        }
+      }
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (failed_job == NULL) {
+      return;
+    }
+    // Report the failure outside the critical region and try the next job
+    if (failed_job->callback) {
+      failed_job->callback(error_code, failed_job->p_context);
+    }
+  }
+}
+
+static void transaction_done(ret_code_t result, void* p_user_data) {
+  sensor_bus_job_t* job = (sensor_bus_job_t*) p_user_data;
+
+  CRITICAL_REGION_ENTER();
+  in_flight = NULL;
+  job->queued = false;
+  CRITICAL_REGION_EXIT();
+
+  // Keep the bus busy before running the (possibly slower) callback
+  start_next_job();
+
+  if (job->callback) {
+    job->callback(result, job->p_context);
+  }
+}
+
+void sensor_bus_init(const nrf_twi_mngr_t* instance) {
+  twi_mngr_instance = instance;
+}
+
+ret_code_t sensor_bus_schedule(sensor_bus_job_t* job) {
+  if (twi_mngr_instance == NULL || job->priority >= SENSOR_BUS_NUM_PRIORITIES) {
+    return NRF_ERROR_INVALID_STATE;
+  }
+
+  ret_code_t error_code = NRF_SUCCESS;
+  CRITICAL_REGION_ENTER();
+  if (job->queued) {
+    error_code = NRF_ERROR_BUSY;
+  } else {
+    job->queued = true;
+    job->p_next = NULL;
+    if (queue_tail[job->priority] != NULL) {
+      queue_tail[job->priority]->p_next = job;
+    } else {
+      queue_head[job->priority] = job;
+    }
+    queue_tail[job->priority] = job;
+  }
+  CRITICAL_REGION_EXIT();
+
+  if (error_code == NRF_SUCCESS) {
+    start_next_job();
+  }
+  return error_code;
+}
+
+bool sensor_bus_is_idle(void) {
+  if (in_flight != NULL) {
+    return false;
+  }
+  for (int p = 0; p < SENSOR_BUS_NUM_PRIORITIES; p++) {
+    if (queue_head[p] != NULL) {
+      return false;
+    }
+  }
+  return true;
+}
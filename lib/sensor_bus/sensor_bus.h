@@ -0,0 +1,50 @@
+// Asynchronous sensor bus
+//
+// Priority queue of non-blocking I2C transactions on top of the TWI manager,
+// shared by the IMU FIFO drain and the Si7021. Only one job is handed to
+// nrf_twi_mngr_schedule at a time, so queued jobs go out strictly in priority
+// order (IMU first) and a blocking nrf_twi_mngr_perform elsewhere waits for at
+// most one short transfer.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "app_error.h"
+#include "nrf_twi_mngr.h"
+
+// Lower value = served first
+typedef enum {
+  SENSOR_BUS_PRIORITY_IMU,
+  SENSOR_BUS_PRIORITY_DEFAULT,
+  SENSOR_BUS_PRIORITY_ENVIRONMENT,
+  SENSOR_BUS_NUM_PRIORITIES,
+} sensor_bus_priority_t;
+
+// Called from the TWI interrupt once the job has finished (or failed)
+typedef void (*sensor_bus_callback_t)(ret_code_t result, void* p_context);
+
+// A bus job. The caller owns the memory, which (together with the transfers
+// and their buffers) must stay valid until the callback runs. A job may be
+// rescheduled from its own callback.
+typedef struct sensor_bus_job_s {
+  nrf_twi_mngr_transfer_t const* p_transfers;
+  uint8_t number_of_transfers;
+  sensor_bus_priority_t priority;
+  sensor_bus_callback_t callback;
+  void* p_context;
+
+  // Internal
+  struct sensor_bus_job_s* p_next;
+  volatile bool queued;
+} sensor_bus_job_t;
+
+// Share an already initialized TWI manager instance with the bus
+void sensor_bus_init(const nrf_twi_mngr_t* instance);
+
+// Queue a job. Returns NRF_ERROR_BUSY if the job is still pending.
+ret_code_t sensor_bus_schedule(sensor_bus_job_t* job);
+
+// True when no job is queued or in flight
+bool sensor_bus_is_idle(void);
@@ -50,6 +50,31 @@ void si7021_reset() {
   }
 }
 
+static float convert_temperature(const uint8_t *buf) {
+  uint16_t temp = (buf[0] << 8) | buf[1];
+
+  float temperature = temp;
+  temperature *= 175.72;
+  temperature /= 65536;
+  temperature -= 46.85;
+
+  // Minus 6 because of bias
+  temperature = (9.0 / 5.0) * temperature + 32.0 - 6.0;
+
+  return temperature;
+}
+
+static float convert_humidity(const uint8_t *buf) {
+  uint16_t hum = (buf[0] << 8) | buf[1];
+
+  float humidity = hum;
+  humidity *= 125;
+  humidity /= 65536;
+  humidity -= 6;
+
+  return humidity;
+}
+
 // At 55 degrees F (Apple), temperature reading stabilized at 61 degrees F, ±1 degree F
 float read_temperature() {
   int error = nrf_twi_mngr_perform(twi_mngr_instance, NULL, send_temp_command_i2c, sizeof(send_temp_command_i2c)/sizeof(send_temp_command_i2c[0]), NULL);
@@ -62,17 +87,7 @@ float read_temperature() {
   if (error != 0) {
     printf("Error: %d \n", error);
   }
-  uint16_t temp = (temp_read_buf[0] << 8) | temp_read_buf[1];
-
-  float temperature = temp;
-  temperature *= 175.72;
-  temperature /= 65536;
-  temperature -= 46.85;
-
-  // Minus 6 because of bias
-  temperature = (9.0 / 5.0) * temperature + 32.0 - 6.0;
-
-  return temperature;
+  return convert_temperature(temp_read_buf);
 }
 
 // At 80% humidity (Apple), humidity reading stabilized at 73.5% ± 1%
@@ -87,12 +102,107 @@ float read_humidity() {
     printf("Error: %d \n", error);
   }
 
-  uint16_t hum = (humidity_read_buf[0] << 8) | humidity_read_buf[1];
+  return convert_humidity(humidity_read_buf);
+}
 
-  float humidity = hum;
-  humidity *= 125;
-  humidity /= 65536;
-  humidity -= 6;
+// Asynchronous measurement: command -> wait for conversion -> read, once for
+// temperature and once for humidity
+
+#define SI7021_CONVERSION_TIME_MS 20
+
+typedef enum {
+  ASYNC_IDLE,
+  ASYNC_TEMP_COMMAND,
+  ASYNC_TEMP_CONVERSION,
+  ASYNC_TEMP_READ,
+  ASYNC_HUMIDITY_COMMAND,
+  ASYNC_HUMIDITY_CONVERSION,
+  ASYNC_HUMIDITY_READ,
+} si7021_async_state_t;
+
+static volatile si7021_async_state_t async_state = ASYNC_IDLE;
+static si7021_callback_t async_callback = NULL;
+static float async_temperature = 0;
+static sensor_bus_job_t async_job;
+static bool async_timer_created = false;
+
+APP_TIMER_DEF(conversion_timer);
+
+static void async_job_done(ret_code_t result, void* p_context);
+
+static void async_schedule(nrf_twi_mngr_transfer_t const* transfers, uint8_t number_of_transfers) {
+  async_job.p_transfers = transfers;
+  async_job.number_of_transfers = number_of_transfers;
+  async_job.priority = SENSOR_BUS_PRIORITY_ENVIRONMENT;
+  async_job.callback = async_job_done;
+  async_job.p_context = NULL;
+  ret_code_t error = sensor_bus_schedule(&async_job);
+  if (error != NRF_SUCCESS) {
+    printf("Error: %lu \n", (unsigned long)error);
+    async_state = ASYNC_IDLE;
+  }
+}
 
-  return humidity;
+// Conversion finished, fetch the result
+static void conversion_timer_callback(void* p_context) {
+  if (async_state == ASYNC_TEMP_CONVERSION) {
+    async_state = ASYNC_TEMP_READ;
+    async_schedule(read_temp_i2c, sizeof(read_temp_i2c)/sizeof(read_temp_i2c[0]));
+  } else if (async_state == ASYNC_HUMIDITY_CONVERSION) {
+    async_state = ASYNC_HUMIDITY_READ;
+    async_schedule(read_humidity_i2c, sizeof(read_humidity_i2c)/sizeof(read_humidity_i2c[0]));
+  }
+}
+
+static void async_job_done(ret_code_t result, void* p_context) {
+  if (result != NRF_SUCCESS) {
+    printf("Error: %lu \n", (unsigned long)result);
+    async_state = ASYNC_IDLE;
+    return;
+  }
+
+  switch (async_state) {
+  case ASYNC_TEMP_COMMAND:
+    async_state = ASYNC_TEMP_CONVERSION;
+    app_timer_start(conversion_timer, APP_TIMER_TICKS(SI7021_CONVERSION_TIME_MS), NULL);
+    break;
+  case ASYNC_TEMP_READ:
+    async_temperature = convert_temperature(temp_read_buf);
+    async_state = ASYNC_HUMIDITY_COMMAND;
+    async_schedule(send_humidity_command_i2c, sizeof(send_humidity_command_i2c)/sizeof(send_humidity_command_i2c[0]));
+    break;
+  case ASYNC_HUMIDITY_COMMAND:
+    async_state = ASYNC_HUMIDITY_CONVERSION;
+    app_timer_start(conversion_timer, APP_TIMER_TICKS(SI7021_CONVERSION_TIME_MS), NULL);
+    break;
+  case ASYNC_HUMIDITY_READ:
+    async_state = ASYNC_IDLE;
+    if (async_callback) {
+      async_callback(async_temperature, convert_humidity(humidity_read_buf));
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+ret_code_t si7021_read_async(si7021_callback_t callback) {
+  if (async_state != ASYNC_IDLE) {
+    return NRF_ERROR_BUSY;
+  }
+
+  if (!async_timer_created) {
+    ret_code_t error_code = app_timer_create(&conversion_timer,
+                                             APP_TIMER_MODE_SINGLE_SHOT,
+                                             conversion_timer_callback);
+    if (error_code != NRF_SUCCESS) {
+      return error_code;
+    }
+    async_timer_created = true;
+  }
+
+  async_callback = callback;
+  async_state = ASYNC_TEMP_COMMAND;
+  async_schedule(send_temp_command_i2c, sizeof(send_temp_command_i2c)/sizeof(send_temp_command_i2c[0]));
+  return NRF_SUCCESS;
 }
\ No newline at end of file
@@ -10,11 +10,23 @@
 #include "nrf_log_default_backends.h"
 
 #include "nrf_twi_mngr.h"
+#include "app_timer.h"
 #include "buckler.h"
+#include "sensor_bus.h"
 
 #define SI7021_ADDR 0x40
 
 void si7021_init();
 void si7021_reset();
 float read_temperature();
-float read_humidity();
\ No newline at end of file
+float read_humidity();
+
+// Called once both values of an asynchronous read are available.
+// Runs in interrupt context.
+typedef void (*si7021_callback_t)(float temperature, float humidity);
+
+// Start a temperature + humidity measurement on the sensor bus. The 20 ms
+// conversions complete in the background on an app_timer, so the caller
+// never waits. Requires sensor_bus_init() and app_timer_init().
+// Returns NRF_ERROR_BUSY if a measurement is already running.
+ret_code_t si7021_read_async(si7021_callback_t callback);
\ No newline at end of file
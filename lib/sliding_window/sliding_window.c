@@ -0,0 +1,123 @@
+#include "sliding_window.h"
+
+void sliding_window_init(sliding_window_t* window, float* buffer, uint16_t size,
+                         uint16_t* min_deque, uint16_t* max_deque) {
+  window->buffer = buffer;
+  window->size = size;
+  window->min_deque = min_deque;
+  window->max_deque = max_deque;
+  sliding_window_reset(window);
+}
+
+void sliding_window_reset(sliding_window_t* window) {
+  window->count = 0;
+  window->head = 0;
+  window->since_renormalize = 0;
+  window->sum = 0;
+  window->sum_sq = 0;
+  window->min_front = window->min_length = 0;
+  window->max_front = window->max_length = 0;
+}
+
+// Monotonic deque of buffer positions: values are increasing (min) or
+// decreasing (max) from front to back, so the front is the extreme.
+static void deque_push(const sliding_window_t* window, uint16_t* deque, uint16_t front,
+                       uint16_t* length, uint16_t position, bool is_max) {
+  float value = window->buffer[position];
+  while (*length > 0) {
+    uint16_t back = (front + *length - 1) % window->size;
+    float back_value = window->buffer[deque[back]];
+    if (is_max ? (back_value > value) : (back_value < value)) {
+      break;
+    }
+    (*length)--;
+  }
+  deque[(front + *length) % window->size] = position;
+  (*length)++;
+}
+
+// Drop the front of the deque if it refers to the sample being overwritten
+static void deque_expire(const sliding_window_t* window, const uint16_t* deque,
+                         uint16_t* front, uint16_t* length, uint16_t position) {
+  if (*length > 0 && deque[*front] == position) {
+    *front = (*front + 1) % window->size;
+    (*length)--;
+  }
+}
+
+static void renormalize(sliding_window_t* window) {
+  float sum = 0;
+  float sum_sq = 0;
+  for (uint16_t i = 0; i < window->count; i++) {
+    sum += window->buffer[i];
+    sum_sq += window->buffer[i] * window->buffer[i];
+  }
+  window->sum = sum;
+  window->sum_sq = sum_sq;
+  window->since_renormalize = 0;
+}
+
+void sliding_window_push(sliding_window_t* window, float value) {
+  uint16_t position = window->head;
+
+  if (window->count == window->size) {
+    float oldest = window->buffer[position];
+    window->sum -= oldest;
+    window->sum_sq -= oldest * oldest;
+    if (window->min_deque) {
+      deque_expire(window, window->min_deque, &window->min_front, &window->min_length, position);
+    }
+    if (window->max_deque) {
+      deque_expire(window, window->max_deque, &window->max_front, &window->max_length, position);
+    }
+  } else {
+    window->count++;
+  }
+
+  window->buffer[position] = value;
+  window->sum += value;
+  window->sum_sq += value * value;
+  if (window->min_deque) {
+    deque_push(window, window->min_deque, window->min_front, &window->min_length, position, false);
+  }
+  if (window->max_deque) {
+    deque_push(window, window->max_deque, window->max_front, &window->max_length, position, true);
+  }
+
+  window->head = (position + 1) % window->size;
+
+  // Once per window length, so the cost stays O(1) per sample on average
+  if (++window->since_renormalize >= window->size) {
+    renormalize(window);
+  }
+}
+
+float sliding_window_mean(const sliding_window_t* window) {
+  if (window->count == 0) {
+    return 0;
+  }
+  return window->sum / (float)window->count;
+}
+
+float sliding_window_variance(const sliding_window_t* window) {
+  if (window->count == 0) {
+    return 0;
+  }
+  float mean = window->sum / (float)window->count;
+  float variance = window->sum_sq / (float)window->count - mean * mean;
+  return variance > 0 ? variance : 0;
+}
+
+float sliding_window_min(const sliding_window_t* window) {
+  if (!window->min_deque || window->min_length == 0) {
+    return 0;
+  }
+  return window->buffer[window->min_deque[window->min_front]];
+}
+
+float sliding_window_max(const sliding_window_t* window) {
+  if (!window->max_deque || window->max_length == 0) {
+    return 0;
+  }
+  return window->buffer[window->max_deque[window->max_front]];
+}
@@ -0,0 +1,71 @@
+// Sliding window filter
+//
+// Ring buffer of the last N samples with O(1) running mean and variance and
+// (optionally) amortized O(1) min/max. The running sums are recomputed from
+// the buffer once per N samples so float rounding error cannot build up.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+  float* buffer;
+  uint16_t* min_deque;  // Buffer positions of min candidates, NULL if not tracked
+  uint16_t* max_deque;  // Buffer positions of max candidates, NULL if not tracked
+  uint16_t size;
+
+  // Internal
+  uint16_t count;
+  uint16_t head;        // Position the next sample is written to
+  uint16_t since_renormalize;
+  float sum;
+  float sum_sq;
+  uint16_t min_front, min_length;
+  uint16_t max_front, max_length;
+} sliding_window_t;
+
+// Statically allocated window of `window_size` samples
+#define SLIDING_WINDOW_DEF(name, window_size)           \
+  static float name##_buffer[window_size];              \
+  static sliding_window_t name = {                      \
+    .buffer = name##_buffer,                            \
+    .size = window_size,                                \
+  }
+
+// Same, with min/max tracking (adds 4 bytes of RAM per sample)
+#define SLIDING_WINDOW_MINMAX_DEF(name, window_size)    \
+  static float name##_buffer[window_size];              \
+  static uint16_t name##_min_deque[window_size];        \
+  static uint16_t name##_max_deque[window_size];        \
+  static sliding_window_t name = {                      \
+    .buffer = name##_buffer,                            \
+    .min_deque = name##_min_deque,                      \
+    .max_deque = name##_max_deque,                      \
+    .size = window_size,                                \
+  }
+
+// Set up a window on caller-provided storage. The deques are optional (NULL)
+// and, if given, must hold `size` entries each.
+void sliding_window_init(sliding_window_t* window, float* buffer, uint16_t size,
+                         uint16_t* min_deque, uint16_t* max_deque);
+
+// Forget all samples
+void sliding_window_reset(sliding_window_t* window);
+
+// Add a sample, dropping the oldest one once the window is full
+void sliding_window_push(sliding_window_t* window, float value);
+
+// Statistics over the samples currently in the window (0 if empty)
+float sliding_window_mean(const sliding_window_t* window);
+float sliding_window_variance(const sliding_window_t* window);
+float sliding_window_min(const sliding_window_t* window);
+float sliding_window_max(const sliding_window_t* window);
+
+static inline uint16_t sliding_window_count(const sliding_window_t* window) {
+  return window->count;
+}
+
+static inline bool sliding_window_full(const sliding_window_t* window) {
+  return window->count == window->size;
+}
@@ -1,3 +1,4 @@
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "app_error.h"
@@ -12,6 +13,17 @@
 #define OP_QUEUES_SIZE          3
 #define APP_TIMER_PRESCALER     NRF_SERIAL_APP_TIMER_PRESCALER
 
+// The recognizer sends one byte per command, so EasyDMA receives one byte at
+// a time and every command raises an RX event straight away
+#define SERIAL_FIFO_TX_SIZE     1
+#define SERIAL_FIFO_RX_SIZE     16
+#define SERIAL_BUFF_TX_SIZE     1
+#define SERIAL_BUFF_RX_SIZE     1
+
+#define COMMAND_RING_MASK (SPEECH_COMMAND_RING_SIZE - 1)
+
+static void serial_event_handler(nrf_serial_t const* p_serial, nrf_serial_event_t event);
+
 NRF_SERIAL_DRV_UART_CONFIG_DEF(uart_config,
                                BUCKLER_UART_RX, BUCKLER_UART_TX,
                                0, 0,
@@ -19,28 +31,82 @@ NRF_SERIAL_DRV_UART_CONFIG_DEF(uart_config,
                                NRF_UART_BAUDRATE_9600,
                                UART_DEFAULT_CONFIG_IRQ_PRIORITY);
 
-NRF_SERIAL_CONFIG_DEF(serial_config, NRF_SERIAL_MODE_POLLING,
-                      NULL, NULL, NULL, NULL);
+NRF_SERIAL_QUEUES_DEF(serial_queues, SERIAL_FIFO_TX_SIZE, SERIAL_FIFO_RX_SIZE);
+NRF_SERIAL_BUFFERS_DEF(serial_buffs, SERIAL_BUFF_TX_SIZE, SERIAL_BUFF_RX_SIZE);
+
+NRF_SERIAL_CONFIG_DEF(serial_config, NRF_SERIAL_MODE_DMA,
+                      &serial_queues, &serial_buffs, serial_event_handler, NULL);
 
 NRF_SERIAL_UART_DEF(serial_uart, 0);
 
+// Single-producer (UART interrupt), single-consumer ring of commands
+static speech_command_t commands[SPEECH_COMMAND_RING_SIZE];
+static uint32_t commands_head = 0;
+static uint32_t commands_tail = 0;
+static volatile uint32_t dropped = 0;
+
+static speech_callback_t command_callback = NULL;
+
+static void serial_event_handler(nrf_serial_t const* p_serial, nrf_serial_event_t event) {
+    if (event == NRF_SERIAL_EVENT_DRV_ERR || event == NRF_SERIAL_EVENT_FIFO_ERR) {
+        dropped++;
+        return;
+    }
+    if (event != NRF_SERIAL_EVENT_RX_DATA) {
+        return;
+    }
+
+    uint32_t now = app_timer_cnt_get();
+    bool queued = false;
+    uint8_t id;
+    while (nrf_serial_read(&serial_uart, &id, sizeof(id), NULL, 0) == NRF_SUCCESS) {
+        uint32_t head = commands_head;
+        if (head - __atomic_load_n(&commands_tail, __ATOMIC_ACQUIRE) >= SPEECH_COMMAND_RING_SIZE) {
+            dropped++;
+            continue;
+        }
+        commands[head & COMMAND_RING_MASK].id = id;
+        commands[head & COMMAND_RING_MASK].timestamp = now;
+        __atomic_store_n(&commands_head, head + 1, __ATOMIC_RELEASE);
+        queued = true;
+    }
+
+    if (queued && command_callback) {
+        command_callback();
+    }
+}
+
 // Assumes app timer has already been started
 void speech_init(void) {
     ret_code_t ret = nrf_serial_init(&serial_uart, &uart_config, &serial_config);
     APP_ERROR_CHECK(ret);
 }
 
-uint8_t speech_read(void) {
-    ret_code_t ret;
-    uint8_t input_number = 0;
-    ret = nrf_serial_read(&serial_uart, &input_number, sizeof(input_number), NULL, 0);
+void speech_set_callback(speech_callback_t callback) {
+    command_callback = callback;
+}
 
-    if(ret == NRF_SUCCESS) {
-        return input_number;
+bool speech_next_command(speech_command_t* command) {
+    uint32_t tail = commands_tail;
+    if (tail == __atomic_load_n(&commands_head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    *command = commands[tail & COMMAND_RING_MASK];
+    __atomic_store_n(&commands_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint32_t speech_dropped_commands(void) {
+    return dropped;
+}
+
+uint8_t speech_read(void) {
+    speech_command_t command;
+    if (speech_next_command(&command)) {
+        return command.id;
     } else {
         return 255;
     }
-    
 }
 
 const char *speech_convert_reading(uint8_t reading) {
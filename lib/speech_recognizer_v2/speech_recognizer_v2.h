@@ -1,9 +1,34 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+// Recognized commands waiting to be read; must be a power of two
+#define SPEECH_COMMAND_RING_SIZE 8
+
+typedef struct {
+    uint8_t id;             // Command ID, see speech_convert_reading
+    uint32_t timestamp;     // app_timer ticks when the byte arrived
+} speech_command_t;
+
+// Called from the UART interrupt whenever a command has been queued
+typedef void (*speech_callback_t)(void);
+
 // Start serial connection with speech recognizer
+// Bytes are received by UARTE EasyDMA and queued from its interrupt, so
+// nothing needs to poll the UART.
 // Assumes app_timer has already been started
 void speech_init(void);
 
+// Register a callback for new commands (NULL to disable)
+void speech_set_callback(speech_callback_t callback);
+
+// Take the oldest queued command; false if there is none
+bool speech_next_command(speech_command_t* command);
+
+// Commands dropped because the queue was full, plus UART errors
+uint32_t speech_dropped_commands(void);
+
 // Return ID number of recognized speech, or -1 (255) if none
 uint8_t speech_read(void);
 
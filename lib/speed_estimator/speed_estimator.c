@@ -0,0 +1,103 @@
+#include "speed_estimator.h"
+
+void speed_estimator_init(speed_estimator_t* estimator, float distance_per_edge_m) {
+  estimator->accel_noise = 3.0f;
+  estimator->speed_noise = 0.3f;
+  estimator->jerk_noise = 2.0f;
+  estimator->distance_per_edge_m = distance_per_edge_m;
+
+  estimator->speed = 0;
+  estimator->accel = 0;
+  estimator->p[0][0] = 1.0f;
+  estimator->p[0][1] = 0;
+  estimator->p[1][0] = 0;
+  estimator->p[1][1] = 1.0f;
+  estimator->time_since_edge = 0;
+  estimator->have_speed = false;
+}
+
+// Measurement of the speed (H = [1 0]) with variance r
+static void correct_speed(speed_estimator_t* e, float z, float r) {
+  float s = e->p[0][0] + r;
+  float k0 = e->p[0][0] / s;
+  float k1 = e->p[1][0] / s;
+  float innovation = z - e->speed;
+
+  e->speed += k0 * innovation;
+  e->accel += k1 * innovation;
+
+  float p00 = e->p[0][0], p01 = e->p[0][1], p11 = e->p[1][1];
+  e->p[0][0] = (1.0f - k0) * p00;
+  e->p[0][1] = (1.0f - k0) * p01;
+  e->p[1][0] = e->p[0][1];
+  e->p[1][1] = p11 - k1 * p01;
+}
+
+// Measurement of the acceleration (H = [0 1]) with variance r
+static void correct_accel(speed_estimator_t* e, float z, float r) {
+  float s = e->p[1][1] + r;
+  float k0 = e->p[0][1] / s;
+  float k1 = e->p[1][1] / s;
+  float innovation = z - e->accel;
+
+  e->speed += k0 * innovation;
+  e->accel += k1 * innovation;
+
+  float p00 = e->p[0][0], p01 = e->p[0][1], p11 = e->p[1][1];
+  e->p[0][0] = p00 - k0 * p01;
+  e->p[0][1] = (1.0f - k1) * p01;
+  e->p[1][0] = e->p[0][1];
+  e->p[1][1] = (1.0f - k1) * p11;
+}
+
+void speed_estimator_update_accel(speed_estimator_t* e, float dt, float accel) {
+  // Predict with constant acceleration; white jerk as process noise
+  float q = e->jerk_noise * e->jerk_noise;
+  float dt2 = dt * dt;
+  e->speed += e->accel * dt;
+  e->p[0][0] += dt * (2.0f * e->p[0][1] + dt * e->p[1][1]) + q * dt2 * dt / 3.0f;
+  e->p[0][1] += dt * e->p[1][1] + q * dt2 / 2.0f;
+  e->p[1][0] = e->p[0][1];
+  e->p[1][1] += q * dt;
+
+  correct_accel(e, accel, e->accel_noise * e->accel_noise);
+
+  // Without a new edge the wheel can be going at most one edge per elapsed time
+  e->time_since_edge += dt;
+  if (e->have_speed && e->time_since_edge > 0) {
+    float max_speed = e->distance_per_edge_m / e->time_since_edge;
+    if (e->speed > max_speed) {
+      correct_speed(e, max_speed, e->speed_noise * e->speed_noise);
+    }
+  }
+
+  if (e->speed < 0) {
+    e->speed = 0;
+  }
+}
+
+void speed_estimator_update_speed(speed_estimator_t* e, float speed) {
+  e->time_since_edge = 0;
+  if (!e->have_speed) {
+    // First reading: take it as is
+    e->have_speed = true;
+    e->speed = speed;
+    e->p[0][0] = e->speed_noise * e->speed_noise;
+    e->p[0][1] = e->p[1][0] = 0;
+    return;
+  }
+  correct_speed(e, speed, e->speed_noise * e->speed_noise);
+}
+
+float speed_estimator_speed(const speed_estimator_t* e) {
+  return e->speed;
+}
+
+float speed_estimator_deceleration(const speed_estimator_t* e) {
+  return -e->accel;
+}
+
+float speed_estimator_confidence(const speed_estimator_t* e) {
+  float r = e->accel_noise * e->accel_noise;
+  return r / (r + e->p[1][1]);
+}
@@ -0,0 +1,46 @@
+// Longitudinal speed estimator
+//
+// Two-state Kalman filter on forward speed and acceleration. The IMU's forward
+// linear acceleration drives it on every sample, and each hall speed reading
+// corrects it, so a change in speed shows up in the acceleration estimate
+// within a few IMU samples instead of after several hall windows. While no
+// edge arrives, the time since the last one bounds the speed from above, which
+// brings the estimate down to zero when the wheel stops.
+//
+// Units are m/s and m/s^2. Pure C.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+  // Tuning, set by speed_estimator_init and adjustable afterwards
+  float accel_noise;          // Std dev of the accelerometer input, m/s^2
+  float speed_noise;          // Std dev of a hall speed reading, m/s
+  float jerk_noise;           // How fast acceleration can change, m/s^3
+  float distance_per_edge_m;
+
+  // Internal
+  float speed;
+  float accel;
+  float p[2][2];              // Covariance of (speed, accel)
+  float time_since_edge;
+  bool have_speed;
+} speed_estimator_t;
+
+void speed_estimator_init(speed_estimator_t* estimator, float distance_per_edge_m);
+
+// Advance by dt seconds and fuse a forward acceleration sample (m/s^2)
+void speed_estimator_update_accel(speed_estimator_t* estimator, float dt, float accel);
+
+// Fuse a hall speed reading (m/s) from an edge that just arrived
+void speed_estimator_update_speed(speed_estimator_t* estimator, float speed);
+
+float speed_estimator_speed(const speed_estimator_t* estimator);
+
+// Positive while slowing down, m/s^2
+float speed_estimator_deceleration(const speed_estimator_t* estimator);
+
+// 0 to 1: how well the acceleration is known (1 = exactly, 0.5 = to within accel_noise)
+float speed_estimator_confidence(const speed_estimator_t* estimator);
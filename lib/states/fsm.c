@@ -0,0 +1,59 @@
+#include <stddef.h>
+
+#include "fsm.h"
+
+void fsm_init(fsm_t* fsm, const fsm_state_t* states, uint8_t num_states, uint8_t initial, void* context, uint32_t now_ms) {
+  fsm->states = states;
+  fsm->num_states = num_states;
+  fsm->current = initial < num_states ? initial : 0;
+  fsm->entered_ms = now_ms;
+  fsm->now_ms = now_ms;
+  fsm->context = context;
+}
+
+uint32_t fsm_time_in_state(const fsm_t* fsm) {
+  return fsm->now_ms - fsm->entered_ms;
+}
+
+uint8_t fsm_update(fsm_t* fsm, const void* inputs, uint32_t now_ms) {
+  fsm->now_ms = now_ms;
+
+  const fsm_state_t* state = &fsm->states[fsm->current];
+  if (state->during) {
+    state->during(fsm, inputs);
+  }
+
+  uint32_t elapsed_ms = fsm_time_in_state(fsm);
+  for (uint8_t i = 0; i < state->num_transitions; i++) {
+    const fsm_transition_t* transition = &state->transitions[i];
+    if (elapsed_ms < transition->after_ms) {
+      continue;
+    }
+    if (transition->guard && !transition->guard(fsm, inputs, transition->param)) {
+      continue;
+    }
+
+    if (state->exit) {
+      state->exit(fsm, inputs);
+    }
+    if (transition->action) {
+      transition->action(fsm, inputs);
+    }
+    fsm->current = transition->target < fsm->num_states ? transition->target : 0;
+    fsm->entered_ms = now_ms;
+    const fsm_state_t* next = &fsm->states[fsm->current];
+    if (next->entry) {
+      next->entry(fsm, inputs);
+    }
+    break;
+  }
+
+  return fsm->current;
+}
+
+const char* fsm_state_name(const fsm_t* fsm, uint8_t state) {
+  if (state >= fsm->num_states || fsm->states[state].name == NULL) {
+    return "?";
+  }
+  return fsm->states[state].name;
+}
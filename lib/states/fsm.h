@@ -0,0 +1,64 @@
+// Table-driven state machine
+//
+// States and transitions are declared in const tables. Each update runs the
+// current state's `during` action and then checks that state's transitions in
+// table order; the first whose guard passes (and whose timer has expired)
+// fires, running the old state's exit action, the transition action and the
+// new state's entry action. Only the current state's row is looked at, so an
+// update costs the same however many states the machine has.
+//
+// Guards get a per-transition parameter, so the same predicate can enter a
+// state at one threshold and leave it at another (hysteresis).
+//
+// Pure C so machines can be unit tested on the host.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct fsm_s;
+
+// `inputs` is whatever the machine's owner passes to fsm_update
+typedef bool (*fsm_guard_t)(const struct fsm_s* fsm, const void* inputs, float param);
+typedef void (*fsm_action_t)(struct fsm_s* fsm, const void* inputs);
+
+typedef struct {
+  uint8_t target;
+  fsm_guard_t guard;       // NULL always passes
+  float param;             // Passed to the guard, e.g. a threshold
+  uint32_t after_ms;       // Only once the state has been active this long
+  fsm_action_t action;     // Optional
+} fsm_transition_t;
+
+typedef struct {
+  const char* name;
+  fsm_action_t entry;      // Optional, also run on a transition to the same state
+  fsm_action_t exit;       // Optional
+  fsm_action_t during;     // Optional, every update before the transitions
+  const fsm_transition_t* transitions;
+  uint8_t num_transitions;
+} fsm_state_t;
+
+typedef struct fsm_s {
+  const fsm_state_t* states;
+  uint8_t num_states;
+  uint8_t current;
+  uint32_t entered_ms;     // When the current state was entered
+  uint32_t now_ms;         // Time of the update in progress
+  void* context;           // Owner's data for guards and actions
+} fsm_t;
+
+// Declares a state's transitions from a fsm_transition_t array
+#define FSM_TRANSITIONS(array) (array), sizeof(array)/sizeof((array)[0])
+
+// Start in `initial` at `now_ms` without running its entry action
+void fsm_init(fsm_t* fsm, const fsm_state_t* states, uint8_t num_states, uint8_t initial, void* context, uint32_t now_ms);
+
+// Run one update at `now_ms` (monotonic) and return the current state
+uint8_t fsm_update(fsm_t* fsm, const void* inputs, uint32_t now_ms);
+
+// Milliseconds in the current state as of the update in progress
+uint32_t fsm_time_in_state(const fsm_t* fsm);
+
+const char* fsm_state_name(const fsm_t* fsm, uint8_t state);
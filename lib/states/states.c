@@ -0,0 +1,131 @@
+#include <stddef.h>
+
+#include "states.h"
+
+// How long a BRAKE signal is held, and how long a voice-triggered turn signal waits for the rider to lean
+#define BRAKE_HOLD_MS 3000
+#define VOICE_TURN_TIMEOUT_MS 10000
+
+// A turn signal stops once the rider is back within this many degrees of upright
+// (in the direction of the turn). Well below LEFT_THRESHOLD, so the smoothed roll
+// wandering around the trigger angle through a turn does not flicker the signal.
+#define TURN_RELEASE_ROLL 5.0
+
+// LEFT and RIGHT share their guards, with the roll mirrored by the state's sign
+static float turn_sign(const fsm_t* engine) {
+  return engine->current == RIGHT ? -1.0f : 1.0f;
+}
+
+static states_fsm_t* owner(const fsm_t* engine) {
+  return (states_fsm_t*) engine->context;
+}
+
+static const states_inputs_t* as_inputs(const void* inputs) {
+  return (const states_inputs_t*) inputs;
+}
+
+// Guards
+
+static bool decelerating_above(const fsm_t* engine, const void* inputs, float threshold) {
+  const states_inputs_t* in = as_inputs(inputs);
+  return in->confidence >= BRAKING_MIN_CONFIDENCE && in->deceleration > threshold;
+}
+
+static bool braking(const fsm_t* engine, const void* inputs, float threshold) {
+  return owner(engine)->voice == BRAKE || decelerating_above(engine, inputs, threshold);
+}
+
+static bool roll_above(const fsm_t* engine, const void* inputs, float threshold) {
+  return as_inputs(inputs)->smoothed_roll > threshold;
+}
+
+static bool roll_below(const fsm_t* engine, const void* inputs, float threshold) {
+  return as_inputs(inputs)->smoothed_roll < threshold;
+}
+
+static bool left_requested(const fsm_t* engine, const void* inputs, float threshold) {
+  return owner(engine)->voice == LEFT || roll_above(engine, inputs, threshold);
+}
+
+static bool right_requested(const fsm_t* engine, const void* inputs, float threshold) {
+  return owner(engine)->voice == RIGHT || roll_below(engine, inputs, threshold);
+}
+
+// A voice-triggered signal the rider has not leaned into yet
+static bool waiting_for_lean(const fsm_t* engine, const void* inputs, float unused) {
+  const states_fsm_t* fsm = owner(engine);
+  return fsm->voice == (states) engine->current && !fsm->turn_locked;
+}
+
+static bool turn_released(const fsm_t* engine, const void* inputs, float threshold) {
+  return !waiting_for_lean(engine, inputs, 0.0f) &&
+         turn_sign(engine) * as_inputs(inputs)->smoothed_roll < threshold;
+}
+
+// Actions
+
+static void clear_voice(fsm_t* engine, const void* inputs) {
+  owner(engine)->voice = IDLE;
+}
+
+static void lock_turn(fsm_t* engine, const void* inputs) {
+  if (turn_sign(engine) * as_inputs(inputs)->smoothed_roll > LEFT_THRESHOLD) {
+    owner(engine)->turn_locked = true;
+  }
+}
+
+static void leave_turn(fsm_t* engine, const void* inputs) {
+  owner(engine)->voice = IDLE;
+  owner(engine)->turn_locked = false;
+}
+
+// Transitions, checked in order
+
+static const fsm_transition_t idle_transitions[] = {
+  {BRAKE, braking, BRAKING_DECELERATION, 0, NULL},
+  {LEFT, left_requested, LEFT_THRESHOLD, 0, NULL},
+  {RIGHT, right_requested, RIGHT_THRESHOLD, 0, NULL},
+};
+
+static const fsm_transition_t turn_transitions[] = {
+  {BRAKE, decelerating_above, BRAKING_DECELERATION, 0, NULL},
+  {IDLE, waiting_for_lean, 0.0f, VOICE_TURN_TIMEOUT_MS, NULL},
+  {IDLE, turn_released, TURN_RELEASE_ROLL, 0, NULL},
+};
+
+static const fsm_transition_t brake_transitions[] = {
+  {BRAKE, braking, HARD_BRAKING_DECELERATION, BRAKE_HOLD_MS, NULL},  // Held again
+  {RIGHT, roll_below, RIGHT_THRESHOLD, BRAKE_HOLD_MS, NULL},
+  {LEFT, roll_above, LEFT_THRESHOLD, BRAKE_HOLD_MS, NULL},
+  {IDLE, NULL, 0.0f, BRAKE_HOLD_MS, NULL},
+};
+
+static const fsm_state_t state_table[] = {
+  [IDLE] = {"IDLE", NULL, NULL, NULL, FSM_TRANSITIONS(idle_transitions)},
+  [RIGHT] = {"RIGHT", NULL, leave_turn, lock_turn, FSM_TRANSITIONS(turn_transitions)},
+  [LEFT] = {"LEFT", NULL, leave_turn, lock_turn, FSM_TRANSITIONS(turn_transitions)},
+  [BRAKE] = {"BRAKE", clear_voice, NULL, NULL, FSM_TRANSITIONS(brake_transitions)},
+};
+
+#define NUM_STATES (sizeof(state_table)/sizeof(state_table[0]))
+
+void states_fsm_init(states_fsm_t* fsm) {
+  fsm_init(&fsm->engine, state_table, NUM_STATES, IDLE, fsm, 0);
+  fsm->voice = IDLE;
+  fsm->turn_locked = false;
+}
+
+void states_voice_command(states_fsm_t* fsm, states command) {
+  fsm->voice = command;
+}
+
+states states_fsm_update(states_fsm_t* fsm, const states_inputs_t* inputs) {
+  return (states) fsm_update(&fsm->engine, inputs, inputs->now_ms);
+}
+
+const char* states_name(states state) {
+  if ((unsigned) state >= NUM_STATES) {
+    return "?";
+  }
+  return state_table[state].name;
+}
@@ -1,8 +1,47 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fsm.h"
+
 typedef enum {
   IDLE,
   RIGHT,
   LEFT,
   BRAKE,
 } states;
+
+// Decision thresholds
+#define BRAKING_DECELERATION 1.0       // m/s^2
+#define HARD_BRAKING_DECELERATION 3.0  // m/s^2, extends a BRAKE signal once it has been held
+#define BRAKING_MIN_CONFIDENCE 0.5     // Ignore the deceleration estimate below this
+#define LEFT_THRESHOLD 14.0
+#define RIGHT_THRESHOLD -1 * LEFT_THRESHOLD
+
+// Main FSM: turn signals from lean angle and voice, brake light from speed drop and voice.
+// A transition table for the fsm engine; pure C so it can run both on the
+// dashboard and in the host replay tool.
+typedef struct {
+  fsm_t engine;            // Current state and when it was entered
+  states voice;            // Latest voice command not yet consumed, IDLE if none
+  bool turn_locked;        // The rider has leaned into the signalled turn
+} states_fsm_t;
+
+typedef struct {
+  float smoothed_roll;     // Degrees, positive leaning left
+  float deceleration;      // m/s^2, positive while slowing down
+  float confidence;        // 0 to 1, of the deceleration estimate
+  uint32_t now_ms;         // Monotonic milliseconds
+} states_inputs_t;
+
+void states_fsm_init(states_fsm_t* fsm);
+
+// Record a voice command (LEFT, RIGHT or BRAKE) for the next update
+void states_voice_command(states_fsm_t* fsm, states command);
+
+// Run one FSM step and return the new state
+states states_fsm_update(states_fsm_t* fsm, const states_inputs_t* inputs);
+
+// Short name for logs and traces
+const char* states_name(states state);
@@ -0,0 +1,99 @@
+#include <math.h>
+#include <string.h>
+
+#include "trip_stats.h"
+
+#define PI 3.14159265359f
+
+void trip_stats_init(trip_stats_t* stats, float pitch_offset, float pitch_sign) {
+  memset(stats, 0, sizeof(*stats));
+  stats->pitch_offset = pitch_offset;
+  stats->pitch_sign = pitch_sign;
+}
+
+void trip_stats_add_orientation(trip_stats_t* stats, float roll, float pitch) {
+  stats->window_pitch_sum += pitch;
+  stats->window_pitch_count++;
+
+  if (!stats->moving) {
+    return;
+  }
+  float lean = fabsf(roll);
+  int bin = (int)(lean / TRIP_STATS_LEAN_BIN_DEG);
+  if (bin >= TRIP_STATS_LEAN_BINS) {
+    bin = TRIP_STATS_LEAN_BINS - 1;
+  }
+  stats->lean_samples[bin]++;
+  stats->lean_total++;
+
+  if (roll > stats->max_lean_left) {
+    stats->max_lean_left = roll;
+  } else if (-roll > stats->max_lean_right) {
+    stats->max_lean_right = -roll;
+  }
+}
+
+void trip_stats_add_window(trip_stats_t* stats, float speed, float distance, uint32_t window_ms) {
+  float covered = stats->have_distance ? distance - stats->last_distance : 0.0f;
+  stats->have_distance = true;
+  stats->last_distance = distance;
+  if (covered < 0.0f) {
+    covered = 0.0f;
+  }
+  stats->distance += covered;
+
+  if (speed > stats->max_speed) {
+    stats->max_speed = speed;
+  }
+  stats->moving = speed >= TRIP_STATS_MOVING_SPEED;
+  if (stats->moving) {
+    stats->moving_ms += window_ms;
+  } else {
+    stats->stopped_ms += window_ms;
+  }
+
+  // Climb over the window from its mean pitch, which averages out most of
+  // the pitch error from accelerating and braking
+  if (stats->window_pitch_count > 0 && covered > 0.0f) {
+    float pitch = stats->pitch_sign * (stats->window_pitch_sum / stats->window_pitch_count - stats->pitch_offset);
+    float height = covered * sinf(pitch * PI / 180.0f);
+    if (height > 0.0f) {
+      stats->climb += height;
+    } else {
+      stats->descent -= height;
+    }
+  }
+  stats->window_pitch_sum = 0.0f;
+  stats->window_pitch_count = 0;
+}
+
+void trip_stats_add_braking(trip_stats_t* stats, bool braking, float deceleration) {
+  if (braking) {
+    if (!stats->braking || deceleration > stats->brake_peak) {
+      stats->brake_peak = deceleration > 0.0f ? deceleration : 0.0f;
+    }
+  } else if (stats->braking) {
+    // The event is over; file it by its peak
+    int bin = (int)(stats->brake_peak / TRIP_STATS_BRAKE_BIN_MPS2);
+    if (bin >= TRIP_STATS_BRAKE_BINS) {
+      bin = TRIP_STATS_BRAKE_BINS - 1;
+    }
+    stats->brake_events[bin]++;
+    stats->brake_total++;
+  }
+  stats->braking = braking;
+}
+
+float trip_stats_average_speed(const trip_stats_t* stats) {
+  if (stats->moving_ms == 0) {
+    return 0.0f;
+  }
+  return stats->distance / (stats->moving_ms / 1000.0f);
+}
+
+float trip_stats_lean_percent(const trip_stats_t* stats, int bin) {
+  if (bin < 0 || bin >= TRIP_STATS_LEAN_BINS || stats->lean_total == 0) {
+    return 0.0f;
+  }
+  return 100.0f * stats->lean_samples[bin] / stats->lean_total;
+}
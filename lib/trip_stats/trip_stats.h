@@ -0,0 +1,74 @@
+// Trip statistics
+//
+// Running aggregates for the current trip, updated in O(1) from the hall
+// windows, the AHRS samples and the FSM, with no stored history:
+// - max and average speed
+// - moving and stopped time
+// - cumulative climb and descent, from distance times the sine of pitch
+// - a lean angle histogram over moving time
+// - a histogram of brake events by peak deceleration
+//
+// Units are m/s, m and degrees. Pure C.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Slower than this counts as stopped
+#define TRIP_STATS_MOVING_SPEED 0.5f         // m/s
+
+// Lean histogram: |roll| in TRIP_STATS_LEAN_BIN_DEG wide bins, the last one open ended
+#define TRIP_STATS_LEAN_BINS 9
+#define TRIP_STATS_LEAN_BIN_DEG 5.0f
+
+// Brake histogram: peak deceleration in 1 m/s^2 wide bins, the last one open ended
+#define TRIP_STATS_BRAKE_BINS 6
+#define TRIP_STATS_BRAKE_BIN_MPS2 1.0f
+
+typedef struct {
+  // Configuration
+  float pitch_offset;           // Pitch of the mount on level ground, degrees
+  float pitch_sign;             // +1 if positive pitch means riding uphill
+
+  float max_speed;
+  float distance;               // Covered this trip
+  uint32_t moving_ms;
+  uint32_t stopped_ms;
+  float climb;                  // Elevation gained and lost
+  float descent;
+  float max_lean_left;          // Degrees, both positive
+  float max_lean_right;
+  uint32_t lean_samples[TRIP_STATS_LEAN_BINS];
+  uint32_t lean_total;
+  uint16_t brake_events[TRIP_STATS_BRAKE_BINS];
+  uint16_t brake_total;
+
+  // Internal
+  bool have_distance;
+  float last_distance;
+  bool moving;
+  float window_pitch_sum;       // Since the last window
+  uint32_t window_pitch_count;
+  bool braking;
+  float brake_peak;
+} trip_stats_t;
+
+// Start a new trip
+void trip_stats_init(trip_stats_t* stats, float pitch_offset, float pitch_sign);
+
+// One AHRS sample; lean counts only while moving
+void trip_stats_add_orientation(trip_stats_t* stats, float roll, float pitch);
+
+// A closed speed window: `speed` now, the total `distance` so far (any
+// origin) and the window length
+void trip_stats_add_window(trip_stats_t* stats, float speed, float distance, uint32_t window_ms);
+
+// One FSM step: whether the brake light is on and the deceleration estimate
+void trip_stats_add_braking(trip_stats_t* stats, bool braking, float deceleration);
+
+// Distance over moving time, m/s
+float trip_stats_average_speed(const trip_stats_t* stats);
+
+// Share of moving time in a lean bin, 0 to 100
+float trip_stats_lean_percent(const trip_stats_t* stats, int bin);
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "ble_link.h"
+#include "ride_log_format.h"
+
+// Air time of a link layer packet with `payload` bytes: preamble, access
+// address, header, payload, MIC (encrypted links only, so none here) and CRC
+static uint32_t air_time_us(const ble_link_config_t* config, uint16_t payload) {
+    uint32_t preamble = config->phy_mbps == 2 ? 2 : 1;
+    return (preamble + 4 + 2 + payload + 3) * 8 / config->phy_mbps;
+}
+
+#define T_IFS_US 150
+#define RAMP_UP_US 140
+
+void ble_link_init(ble_link_t* link, const ble_link_config_t* config) {
+    memset(link, 0, sizeof(*link));
+    link->config = *config;
+    if (link->config.buffers > BLE_LINK_MAX_BUFFERS) {
+        link->config.buffers = BLE_LINK_MAX_BUFFERS;
+    }
+    link->next_event_us = link->config.interval_us;
+}
+
+bool ble_link_transport(const uint8_t* data, uint16_t length, void* context) {
+    ble_link_t* link = (ble_link_t*)context;
+    if (link->num_pending >= link->config.buffers || length > link->config.att_mtu - 3) {
+        return false;
+    }
+    memcpy(link->pending[link->num_pending], data, length);
+    link->pending_length[link->num_pending] = length;
+    link->num_pending++;
+    return true;
+}
+
+// The central's side: check the sequence and decode every record
+static void central_receive(ble_link_t* link, const uint8_t* data, uint16_t length, uint64_t now_us) {
+    uint16_t sequence;
+    uint32_t start_ms;
+    if (!telemetry_packet_header(data, length, &sequence, &start_ms)) {
+        link->bad_packets++;
+        return;
+    }
+    if (link->have_sequence && sequence != link->next_sequence) {
+        link->lost_packets += (uint16_t)(sequence - link->next_sequence);
+    }
+    link->have_sequence = true;
+    link->next_sequence = sequence + 1;
+
+    ride_log_codec_t codec;
+    ride_log_codec_reset(&codec, start_ms);
+    uint16_t offset = TELEMETRY_PACKET_HEADER_SIZE;
+    while (offset < length) {
+        ride_log_record_t record;
+        size_t used = ride_log_decode(&codec, data + offset, length - offset, &record);
+        if (used == 0) {
+            link->bad_packets++;
+            return;
+        }
+        offset += used;
+        link->records++;
+
+        uint32_t latency_ms = (uint32_t)(now_us / 1000) - record.time_ms;
+        if (latency_ms > link->max_latency_ms) {
+            link->max_latency_ms = latency_ms;
+        }
+    }
+}
+
+// One connection event: the central polls, the peripheral answers with
+// queued notifications until it runs out (connection event extension)
+static uint16_t connection_event(ble_link_t* link, uint64_t now_us) {
+    const ble_link_config_t* config = &link->config;
+    uint32_t empty_us = air_time_us(config, 0);
+
+    link->events++;
+    link->radio_us += RAMP_UP_US + empty_us + T_IFS_US;   // The central's first poll
+    if (link->num_pending == 0) {
+        link->radio_us += empty_us;
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < link->num_pending; i++) {
+        // ATT notification inside L2CAP, split into link layer fragments
+        uint32_t remaining = link->pending_length[i] + 3 + 4;
+        while (remaining > 0) {
+            uint32_t fragment = remaining < config->data_length ? remaining : config->data_length;
+            link->radio_us += air_time_us(config, fragment) + T_IFS_US + empty_us + T_IFS_US;
+            remaining -= fragment;
+        }
+        link->notifications++;
+        link->payload_bytes += link->pending_length[i];
+        central_receive(link, link->pending[i], link->pending_length[i], now_us);
+    }
+    uint16_t delivered = link->num_pending;
+    link->num_pending = 0;
+    return delivered;
+}
+
+uint16_t ble_link_advance(ble_link_t* link, uint64_t now_us) {
+    uint16_t delivered = 0;
+    while (link->next_event_us <= now_us) {
+        // Slave latency: an idle peripheral may sleep through events
+        if (link->num_pending == 0 && link->skipped_events < link->config.slave_latency) {
+            link->skipped_events++;
+        } else {
+            link->skipped_events = 0;
+            delivered += connection_event(link, link->next_event_us);
+        }
+        link->next_event_us += link->config.interval_us;
+    }
+    return delivered;
+}
+
+void ble_link_print(const ble_link_t* link, double duration_s) {
+    const ble_link_config_t* config = &link->config;
+    fprintf(stderr, "\nBLE link: MTU %u, LL %u bytes, %u Mbps, interval %.2f ms, latency %u\n",
+            config->att_mtu, config->data_length, config->phy_mbps, config->interval_us / 1000.0, config->slave_latency);
+    fprintf(stderr, "%llu records in %llu notifications (%.1f records, %.0f bytes each), %.0f bytes/s\n",
+            (unsigned long long)link->records, (unsigned long long)link->notifications,
+            link->notifications ? (double)link->records / link->notifications : 0,
+            link->notifications ? (double)link->payload_bytes / link->notifications : 0,
+            duration_s > 0 ? link->payload_bytes / duration_s : 0);
+    fprintf(stderr, "%llu connection events, radio on %.2f ms/s (%.3f%%), worst latency %lu ms\n",
+            (unsigned long long)link->events, duration_s > 0 ? link->radio_us / 1000.0 / duration_s : 0,
+            duration_s > 0 ? link->radio_us / 1e4 / duration_s : 0, (unsigned long)link->max_latency_ms);
+    fprintf(stderr, "%llu packets lost, %llu did not decode\n",
+            (unsigned long long)link->lost_packets, (unsigned long long)link->bad_packets);
+}
@@ -0,0 +1,62 @@
+// Simulated BLE link and central for the telemetry queue
+//
+// Stands in for the SoftDevice and a phone. The transport takes packets into
+// a fixed number of notification buffers, as sd_ble_gatts_hvx does. Each
+// connection event sends what fits, and a simulated central decodes every
+// notification with the same code a phone would use. Radio time uses the
+// link layer packet sizes, so MTU, PHY and connection parameters can be
+// compared without hardware.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ble_telemetry_queue.h"
+
+#define BLE_LINK_MAX_BUFFERS 8
+
+typedef struct {
+    uint16_t att_mtu;
+    uint16_t data_length;      // Link layer payload: 251 with DLE, 27 without
+    uint8_t phy_mbps;          // 1 or 2
+    uint32_t interval_us;
+    uint16_t slave_latency;
+    uint8_t buffers;           // hvn_tx_queue_size
+} ble_link_config_t;
+
+typedef struct {
+    ble_link_config_t config;
+
+    // Notifications waiting for a connection event
+    uint8_t pending[BLE_LINK_MAX_BUFFERS][TELEMETRY_PACKET_MAX_SIZE];
+    uint16_t pending_length[BLE_LINK_MAX_BUFFERS];
+    uint8_t num_pending;
+    uint64_t next_event_us;
+    uint16_t skipped_events;
+
+    // Central
+    bool have_sequence;
+    uint16_t next_sequence;
+
+    // Results
+    uint64_t events;           // Connection events the peripheral woke for
+    uint64_t radio_us;         // Estimated radio on time
+    uint64_t notifications;
+    uint64_t payload_bytes;
+    uint64_t records;
+    uint64_t lost_packets;     // Sequence gaps seen by the central
+    uint64_t bad_packets;      // Notifications that did not decode
+    uint32_t max_latency_ms;   // Oldest record age on delivery
+} ble_link_t;
+
+void ble_link_init(ble_link_t* link, const ble_link_config_t* config);
+
+// telemetry_transport_t: queue a notification if a buffer is free
+bool ble_link_transport(const uint8_t* data, uint16_t length, void* context);
+
+// Run the connection events up to `now_us`. Returns the number of
+// notifications delivered, i.e. HVN_TX_COMPLETE events.
+uint16_t ble_link_advance(ble_link_t* link, uint64_t now_us);
+
+void ble_link_print(const ble_link_t* link, double duration_s);
@@ -0,0 +1,469 @@
+// Host replay of recorded sensor traces through the dashboard pipeline
+//
+// Runs the same lib/ code as dashboard/main.c (Madgwick, orientation, smoothing
+// windows, hall velocity, speed estimator and the main FSM) with the board
+// replaced by a trace file: IMU samples, hall edges and speech commands are
+// fed in timestamp order, the 250 ms hall timer and the per-sample FSM step
+// are emulated from trace time, and every FSM decision is printed or checked
+// against a golden file. With -b the telemetry the dashboard streams over BLE
+// goes through a simulated link and central (ble_link.h).
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ble_link.h"
+#include "ble_telemetry_queue.h"
+#include "hall_velocity.h"
+#include "orientation.h"
+#include "quaternion_filter.h"
+#include "rate_plan.h"
+#include "sliding_window.h"
+#include "speed_estimator.h"
+#include "states.h"
+
+// Pipeline constants, matching dashboard/main.c
+#define smooth_num RATE_PLAN_IMU_SAMPLES(1500)
+#define PI 3.14159265359
+#define bike_radius .39
+#define arc_length bike_radius * PI * (2.0 / 9.0)
+#define HALL_EFFECT_TIME_MS RATE_PLAN_HALL_WINDOW_MS
+#define HALL_MAX_SPEED_MPH 30
+#define FSM_SAMPLE_INTERVAL RATE_PLAN_FSM_DECIMATION
+#define GRAVITY 9.81f
+#define LONGITUDINAL_ACCEL_SIGN 1.0f
+
+// BLE telemetry, matching dashboard/main.c and lib/ble_telemetry
+#define TELEMETRY_SAMPLE_INTERVAL (RATE_PLAN_IMU_RATE_HZ / RATE_PLAN_TELEMETRY_HZ)
+#define TELEMETRY_MAX_LATENCY_MS 1000
+#define TELEMETRY_INTERVAL_US 200000
+#define TELEMETRY_SLAVE_LATENCY 4
+
+// Speech recognizer command IDs, matching dashboard/main.c
+#define VOICE_COMMAND_LEFT 16
+#define VOICE_COMMAND_RIGHT 17
+#define VOICE_COMMAND_STOP 18
+
+typedef enum {
+    STAGE_PARSE,
+    STAGE_MADGWICK,
+    STAGE_ORIENTATION,
+    STAGE_SMOOTHING,
+    STAGE_HALL,
+    STAGE_ESTIMATOR,
+    STAGE_FSM,
+    STAGE_TELEMETRY,
+    NUM_STAGES,
+} stage_t;
+
+static const char* stage_names[NUM_STAGES] = {"parse", "madgwick", "orientation", "smoothing", "hall", "estimator", "fsm", "telemetry"};
+
+typedef struct {
+    uint64_t calls;
+    uint64_t nsecs;
+} stage_stats_t;
+
+static stage_stats_t stats[NUM_STAGES];
+
+SLIDING_WINDOW_DEF(smooth_roll, smooth_num);
+SLIDING_WINDOW_DEF(smooth_lin_y_accel, smooth_num);
+
+typedef struct {
+    float q[4];
+    float beta;
+    hall_velocity_t hall;
+    speed_estimator_t speed_estimator;
+    uint32_t hall_readings_fused;
+    states_fsm_t fsm;
+    states last_state;
+    uint32_t IMU_read_counter;
+    bool have_IMU_time;
+    uint64_t last_IMU_time_us;
+    uint64_t next_hall_window_us;
+} pipeline_t;
+
+// Golden decisions to compare against, or NULL
+static FILE* golden = NULL;
+static FILE* decisions_out = NULL;
+static uint64_t decisions = 0;
+static uint64_t mismatches = 0;
+
+// Simulated BLE link, when streaming telemetry
+static bool stream_telemetry = false;
+static ble_link_config_t link_config;
+static telemetry_queue_t telemetry;
+static ble_link_t link;
+
+static uint64_t now_nsecs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void stage_done(stage_t stage, uint64_t start) {
+    stats[stage].calls++;
+    stats[stage].nsecs += now_nsecs() - start;
+}
+
+static void pipeline_reset(pipeline_t* p) {
+    p->q[0] = 1.0f;
+    p->q[1] = p->q[2] = p->q[3] = 0.0f;
+    float GyroMeasError = PI * (4.0f / 180.0f);
+    p->beta = sqrt(3.0f / 4.0f) * GyroMeasError;
+    hall_velocity_init(&p->hall, arc_length, 1000000, 0xFFFFFFFF, HALL_MAX_SPEED_MPH);
+    speed_estimator_init(&p->speed_estimator, arc_length);
+    p->hall_readings_fused = 0;
+    states_fsm_init(&p->fsm);
+    p->last_state = IDLE;
+    p->IMU_read_counter = 0;
+    p->have_IMU_time = false;
+    p->last_IMU_time_us = 0;
+    p->next_hall_window_us = HALL_EFFECT_TIME_MS * 1000ull;
+    sliding_window_reset(&smooth_roll);
+    sliding_window_reset(&smooth_lin_y_accel);
+    telemetry_queue_init(&telemetry, link_config.att_mtu - 3);
+    ble_link_init(&link, &link_config);
+}
+
+static void stream_record(const ride_log_record_t* record) {
+    if (!stream_telemetry) {
+        return;
+    }
+    uint64_t start = now_nsecs();
+    telemetry_queue_add(&telemetry, record);
+    stage_done(STAGE_TELEMETRY, start);
+}
+
+// Emulates ble_telemetry_send
+static void send_telemetry(uint64_t time_us) {
+    if (!stream_telemetry) {
+        return;
+    }
+    uint64_t start = now_nsecs();
+    telemetry_queue_close_older(&telemetry, (uint32_t)(time_us / 1000), TELEMETRY_MAX_LATENCY_MS);
+    telemetry_queue_send(&telemetry, ble_link_transport, &link);
+    stage_done(STAGE_TELEMETRY, start);
+}
+
+// Connection events up to `time_us`; the dashboard sends more on every HVN_TX_COMPLETE
+static void advance_link(uint64_t time_us) {
+    if (stream_telemetry && ble_link_advance(&link, time_us) > 0) {
+        send_telemetry(time_us);
+    }
+}
+
+// One decision line: "<trace> <time ms> <state>"
+static void record_decision(const char* trace_name, uint64_t time_us, states state) {
+    char line[256];
+    snprintf(line, sizeof(line), "%s %llu %s\n", trace_name, (unsigned long long)(time_us / 1000), states_name(state));
+    decisions++;
+
+    if (decisions_out) {
+        fputs(line, decisions_out);
+    }
+    if (golden) {
+        char expected[256];
+        if (!fgets(expected, sizeof(expected), golden)) {
+            expected[0] = '\0';
+        }
+        if (strcmp(line, expected) != 0) {
+            if (mismatches == 0) {
+                fprintf(stderr, "first mismatch: expected '%.*s', got '%.*s'\n",
+                        (int)strcspn(expected, "\n"), expected, (int)strcspn(line, "\n"), line);
+            }
+            mismatches++;
+        }
+    }
+}
+
+static void run_fsm(pipeline_t* p, const char* trace_name, uint64_t time_us) {
+    uint64_t start = now_nsecs();
+    states_inputs_t fsm_inputs = {
+        .smoothed_roll = sliding_window_mean(&smooth_roll),
+        .deceleration = speed_estimator_deceleration(&p->speed_estimator),
+        .confidence = speed_estimator_confidence(&p->speed_estimator),
+        .now_ms = (uint32_t)(time_us / 1000),
+    };
+    states state = states_fsm_update(&p->fsm, &fsm_inputs);
+    stage_done(STAGE_FSM, start);
+
+    if (state != p->last_state) {
+        record_decision(trace_name, time_us, state);
+        p->last_state = state;
+
+        ride_log_record_t record = {.type = RIDE_LOG_STATE, .time_ms = fsm_inputs.now_ms, .state = state};
+        stream_record(&record);
+    }
+}
+
+// Emulates the dashboard's repeated hall timer from trace time
+static void advance_hall_windows(pipeline_t* p, uint64_t time_us) {
+    while (time_us >= p->next_hall_window_us) {
+        uint64_t start = now_nsecs();
+        hall_velocity_close_window(&p->hall);
+        stage_done(STAGE_HALL, start);
+        p->next_hall_window_us += HALL_EFFECT_TIME_MS * 1000ull;
+        send_telemetry(time_us);
+    }
+}
+
+static void process_IMU_sample(pipeline_t* p, const char* trace_name, uint64_t time_us, const float* v, bool mag_valid) {
+    float ax = v[0], ay = v[1], az = v[2];
+    float gx = v[3], gy = v[4], gz = v[5];
+    float mx = v[6], my = v[7], mz = v[8];
+
+    // Integrate over the sample period in seconds, as the firmware does
+    float time_diff_sec = p->have_IMU_time ? (float)(time_us - p->last_IMU_time_us) / 1000000.0f : 0.0f;
+    p->have_IMU_time = true;
+    p->last_IMU_time_us = time_us;
+
+    uint64_t start = now_nsecs();
+    if (mag_valid) {
+        MadgwickQuaternionUpdateFast(p->q, p->beta, time_diff_sec, -ax, ay, az, gx * PI / 180.0f, -gy * PI / 180.0f, -gz * PI / 180.0f,  my,  -mx, mz);
+    } else {
+        MadgwickQuaternionUpdateIMU(p->q, p->beta, time_diff_sec, -ax, ay, az, gx * PI / 180.0f, -gy * PI / 180.0f, -gz * PI / 180.0f);
+    }
+    stage_done(STAGE_MADGWICK, start);
+
+    start = now_nsecs();
+    orientation_t orientation;
+    orientation_compute(p->q, v, 0.0f, ORIENTATION_ROLL | ORIENTATION_LINEAR_ACCEL, &orientation);
+    stage_done(STAGE_ORIENTATION, start);
+
+    float roll = orientation.roll;
+    float lin_ay = orientation.linear_accel[1];
+    start = now_nsecs();
+    sliding_window_push(&smooth_roll, roll);
+    sliding_window_push(&smooth_lin_y_accel, lin_ay);
+    stage_done(STAGE_SMOOTHING, start);
+
+    start = now_nsecs();
+    speed_estimator_update_accel(&p->speed_estimator, time_diff_sec, LONGITUDINAL_ACCEL_SIGN * lin_ay * GRAVITY);
+    stage_done(STAGE_ESTIMATOR, start);
+
+    p->IMU_read_counter++;
+    if ((p->IMU_read_counter % TELEMETRY_SAMPLE_INTERVAL) == 0) {
+        ride_log_record_t record = {
+            .type = RIDE_LOG_SAMPLE,
+            .time_ms = (uint32_t)(time_us / 1000),
+            .sample = {
+                .speed = speed_estimator_speed(&p->speed_estimator),
+                .distance = hall_velocity_distance(&p->hall),
+                .roll = roll,
+                .lin_ay = lin_ay,
+            },
+        };
+        stream_record(&record);
+    }
+    if ((p->IMU_read_counter % FSM_SAMPLE_INTERVAL) == 0) {
+        run_fsm(p, trace_name, time_us);
+    }
+}
+
+static void process_speech(pipeline_t* p, unsigned command) {
+    if (command == VOICE_COMMAND_STOP) {
+        states_voice_command(&p->fsm, BRAKE);
+    } else if (command == VOICE_COMMAND_LEFT) {
+        states_voice_command(&p->fsm, LEFT);
+    } else if (command == VOICE_COMMAND_RIGHT) {
+        states_voice_command(&p->fsm, RIGHT);
+    }
+}
+
+// Returns the trace duration in microseconds, or -1 if the file can't be read
+static double replay_trace(const char* path) {
+    FILE* trace = fopen(path, "r");
+    if (!trace) {
+        perror(path);
+        return -1;
+    }
+
+    static pipeline_t p;
+    pipeline_reset(&p);
+
+    char line[512];
+    unsigned long line_number = 0;
+    bool have_time = false;
+    uint64_t first_time_us = 0, last_time_us = 0;
+
+    while (fgets(line, sizeof(line), trace)) {
+        line_number++;
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
+            continue;
+        }
+
+        uint64_t start = now_nsecs();
+        char kind = line[0];
+        char* cursor = line + 1;
+        if (*cursor != ',') {
+            fprintf(stderr, "%s:%lu: malformed line\n", path, line_number);
+            continue;
+        }
+        unsigned long long time_us = strtoull(cursor + 1, &cursor, 10);
+        float values[10] = {0};
+        int num_values = 0;
+        while (*cursor == ',' && num_values < 10) {
+            values[num_values++] = strtof(cursor + 1, &cursor);
+        }
+        stage_done(STAGE_PARSE, start);
+
+        if (!have_time) {
+            first_time_us = time_us;
+            have_time = true;
+        }
+        if (time_us < last_time_us) {
+            fprintf(stderr, "%s:%lu: timestamp goes backwards\n", path, line_number);
+        }
+        last_time_us = time_us;
+
+        advance_hall_windows(&p, time_us);
+        advance_link(time_us);
+
+        switch (kind) {
+            case 'I':
+                if (num_values < 9) {
+                    fprintf(stderr, "%s:%lu: IMU sample needs 9 values\n", path, line_number);
+                    break;
+                }
+                process_IMU_sample(&p, path, time_us, values, num_values < 10 || values[9] != 0);
+                break;
+
+            case 'H':
+                start = now_nsecs();
+                hall_velocity_edge(&p.hall, (uint32_t)time_us);
+                stage_done(STAGE_HALL, start);
+                if (p.hall.reading_count != p.hall_readings_fused) {
+                    p.hall_readings_fused = p.hall.reading_count;
+                    start = now_nsecs();
+                    speed_estimator_update_speed(&p.speed_estimator, p.hall.latest_speed);
+                    stage_done(STAGE_ESTIMATOR, start);
+                }
+                break;
+
+            case 'S':
+                process_speech(&p, (unsigned)values[0]);
+                break;
+
+            default:
+                fprintf(stderr, "%s:%lu: unknown record '%c'\n", path, line_number, kind);
+                break;
+        }
+    }
+
+    fclose(trace);
+    if (stream_telemetry) {
+        ble_link_print(&link, (double)(last_time_us - first_time_us) / 1e6);
+        fprintf(stderr, "%lu packets dropped from the queue, %lu records too large for a packet\n",
+                (unsigned long)telemetry.packets_dropped, (unsigned long)telemetry.records_dropped);
+    }
+    return (double)(last_time_us - first_time_us);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-b mtu] [-g golden] [-o decisions] [-q] trace...\n", name);
+    fprintf(stderr, "  -b  stream telemetry over a simulated BLE link with this ATT MTU (23 to 247)\n");
+    fprintf(stderr, "  -g  compare FSM decisions against a golden file\n");
+    fprintf(stderr, "  -o  write FSM decisions to a file ('-' for stdout, the default)\n");
+    fprintf(stderr, "  -q  do not print FSM decisions\n");
+}
+
+int main(int argc, char** argv) {
+    const char* golden_path = NULL;
+    const char* output_path = "-";
+    int first_trace = 1;
+
+    for (; first_trace < argc && argv[first_trace][0] == '-' && argv[first_trace][1] != '\0'; first_trace++) {
+        const char* flag = argv[first_trace];
+        if (strcmp(flag, "-q") == 0) {
+            output_path = NULL;
+        } else if (strcmp(flag, "-b") == 0 && first_trace + 1 < argc) {
+            stream_telemetry = true;
+            link_config.att_mtu = (uint16_t)atoi(argv[++first_trace]);
+        } else if ((strcmp(flag, "-g") == 0 || strcmp(flag, "-o") == 0) && first_trace + 1 < argc) {
+            if (flag[1] == 'g') {
+                golden_path = argv[++first_trace];
+            } else {
+                output_path = argv[++first_trace];
+            }
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (first_trace >= argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // A larger MTU implies a phone with data length extension and the 2 Mbps PHY
+    if (!stream_telemetry) {
+        link_config.att_mtu = 23;
+    } else if (link_config.att_mtu < 23 || link_config.att_mtu > TELEMETRY_PACKET_MAX_SIZE + 3) {
+        usage(argv[0]);
+        return 2;
+    }
+    bool extended = link_config.att_mtu > 23;
+    link_config.data_length = extended ? 251 : 27;
+    link_config.phy_mbps = extended ? 2 : 1;
+    link_config.interval_us = TELEMETRY_INTERVAL_US;
+    link_config.slave_latency = TELEMETRY_SLAVE_LATENCY;
+    link_config.buffers = TELEMETRY_QUEUE_PACKETS;
+
+    if (golden_path) {
+        golden = fopen(golden_path, "r");
+        if (!golden) {
+            perror(golden_path);
+            return 2;
+        }
+    }
+    if (output_path) {
+        decisions_out = strcmp(output_path, "-") == 0 ? stdout : fopen(output_path, "w");
+        if (!decisions_out) {
+            perror(output_path);
+            return 2;
+        }
+    }
+
+    double trace_us = 0;
+    uint64_t start = now_nsecs();
+    for (int i = first_trace; i < argc; i++) {
+        double duration_us = replay_trace(argv[i]);
+        if (duration_us < 0) {
+            return 2;
+        }
+        trace_us += duration_us;
+    }
+    double wall_us = (double)(now_nsecs() - start) / 1000.0;
+
+    if (golden) {
+        char extra[256];
+        while (fgets(extra, sizeof(extra), golden)) {
+            mismatches++;   // Decisions the golden file expected but the replay never made
+        }
+        fclose(golden);
+    }
+    if (decisions_out && decisions_out != stdout) {
+        fclose(decisions_out);
+    }
+
+    fprintf(stderr, "\n%-12s %12s %10s %12s\n", "stage", "calls", "ns/call", "calls/s");
+    for (int i = 0; i < NUM_STAGES; i++) {
+        double ns_per_call = stats[i].calls ? (double)stats[i].nsecs / (double)stats[i].calls : 0;
+        fprintf(stderr, "%-12s %12llu %10.1f %12.0f\n", stage_names[i], (unsigned long long)stats[i].calls,
+                ns_per_call, ns_per_call > 0 ? 1e9 / ns_per_call : 0);
+    }
+    fprintf(stderr, "\n%.1f s of trace in %.3f s (%.0fx real time), %llu decisions\n",
+            trace_us / 1e6, wall_us / 1e6, wall_us > 0 ? trace_us / wall_us : 0, (unsigned long long)decisions);
+
+    if (golden_path) {
+        fprintf(stderr, "%llu mismatches against %s\n", (unsigned long long)mismatches, golden_path);
+        return mismatches ? 1 : 0;
+    }
+    return 0;
+}
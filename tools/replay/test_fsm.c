@@ -0,0 +1,202 @@
+// Host tests of the table-driven FSM engine (lib/states/fsm) and the
+// dashboard's state table (lib/states/states)
+//
+// A toy machine exercises guard parameters and hysteresis, the exit /
+// transition / entry action order, during actions and after_ms timers; the
+// dashboard table is then driven through its turn, brake and voice paths.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "states.h"
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+// Toy machine: A enters B above a threshold and B leaves below a lower one;
+// B falls through to C after 1 s, and C re-enters itself every 500 ms
+
+enum { A, B, C };
+
+typedef struct {
+    float value;
+} toy_inputs_t;
+
+typedef struct {
+    char log[64];
+    int during_calls;
+} toy_t;
+
+static void log_event(fsm_t* fsm, const char* event) {
+    toy_t* toy = (toy_t*) fsm->context;
+    strncat(toy->log, event, sizeof(toy->log) - strlen(toy->log) - 1);
+}
+
+static bool above(const fsm_t* fsm, const void* inputs, float threshold) {
+    return ((const toy_inputs_t*) inputs)->value > threshold;
+}
+
+static bool below(const fsm_t* fsm, const void* inputs, float threshold) {
+    return ((const toy_inputs_t*) inputs)->value < threshold;
+}
+
+static void exit_a(fsm_t* fsm, const void* inputs) { log_event(fsm, "xA "); }
+static void enter_b(fsm_t* fsm, const void* inputs) { log_event(fsm, "eB "); }
+static void exit_b(fsm_t* fsm, const void* inputs) { log_event(fsm, "xB "); }
+static void enter_c(fsm_t* fsm, const void* inputs) { log_event(fsm, "eC "); }
+static void a_to_b(fsm_t* fsm, const void* inputs) { log_event(fsm, "AB "); }
+
+static void count_during(fsm_t* fsm, const void* inputs) {
+    ((toy_t*) fsm->context)->during_calls++;
+}
+
+static const fsm_transition_t a_transitions[] = {
+    {B, above, 10.0f, 0, a_to_b},
+};
+
+static const fsm_transition_t b_transitions[] = {
+    {A, below, 5.0f, 0, NULL},
+    {C, NULL, 0.0f, 1000, NULL},
+};
+
+static const fsm_transition_t c_transitions[] = {
+    {C, NULL, 0.0f, 500, NULL},
+};
+
+static const fsm_state_t toy_table[] = {
+    [A] = {"A", NULL, exit_a, count_during, FSM_TRANSITIONS(a_transitions)},
+    [B] = {"B", enter_b, exit_b, NULL, FSM_TRANSITIONS(b_transitions)},
+    [C] = {"C", enter_c, NULL, NULL, FSM_TRANSITIONS(c_transitions)},
+};
+
+static uint8_t step(fsm_t* fsm, float value, uint32_t now_ms) {
+    toy_inputs_t inputs = {value};
+    return fsm_update(fsm, &inputs, now_ms);
+}
+
+static void test_engine(void) {
+    toy_t toy = {"", 0};
+    fsm_t fsm;
+    fsm_init(&fsm, toy_table, 3, A, &toy, 100);
+    CHECK(fsm.current == A);
+    CHECK(strcmp(toy.log, "") == 0);        // No entry action at init
+
+    // Guard parameter: 8 is not above 10; during runs every update
+    CHECK(step(&fsm, 8.0f, 200) == A);
+    CHECK(toy.during_calls == 1);
+
+    // Exit, transition action, then entry
+    CHECK(step(&fsm, 12.0f, 300) == B);
+    CHECK(strcmp(toy.log, "xA AB eB ") == 0);
+    CHECK(toy.during_calls == 2);           // During runs before the transitions
+
+    // Hysteresis: between the two thresholds B holds, below the lower one it leaves
+    CHECK(step(&fsm, 8.0f, 400) == B);
+    CHECK(fsm_time_in_state(&fsm) == 100);
+    CHECK(step(&fsm, 4.0f, 500) == A);
+    CHECK(step(&fsm, 8.0f, 600) == A);
+
+    // after_ms counts from entering the state
+    toy.log[0] = '\0';
+    CHECK(step(&fsm, 12.0f, 1000) == B);
+    CHECK(step(&fsm, 8.0f, 1999) == B);
+    CHECK(step(&fsm, 8.0f, 2000) == C);
+    CHECK(strcmp(toy.log, "xA AB eB xB eC ") == 0);
+
+    // A transition to the same state runs the entry action and restarts the timer
+    CHECK(step(&fsm, 0.0f, 2499) == C);
+    CHECK(step(&fsm, 0.0f, 2500) == C);
+    CHECK(strcmp(toy.log, "xA AB eB xB eC eC ") == 0);
+    CHECK(fsm_time_in_state(&fsm) == 0);
+    CHECK(step(&fsm, 0.0f, 2999) == C);
+    CHECK(strcmp(toy.log, "xA AB eB xB eC eC ") == 0);
+
+    // Timers work across the 32-bit millisecond wrap
+    fsm_init(&fsm, toy_table, 3, B, &toy, 0xFFFFFF00u);
+    CHECK(step(&fsm, 8.0f, 0xFFFFFF00u + 999) == B);
+    CHECK(step(&fsm, 8.0f, 0xFFFFFF00u + 1000) == C);
+
+    CHECK(strcmp(fsm_state_name(&fsm, B), "B") == 0);
+    CHECK(strcmp(fsm_state_name(&fsm, 7), "?") == 0);
+}
+
+// The dashboard table
+
+static states fsm_step(states_fsm_t* fsm, float roll, float deceleration, float confidence, uint32_t now_ms) {
+    states_inputs_t inputs = {
+        .smoothed_roll = roll,
+        .deceleration = deceleration,
+        .confidence = confidence,
+        .now_ms = now_ms,
+    };
+    return states_fsm_update(fsm, &inputs);
+}
+
+static void test_dashboard_table(void) {
+    states_fsm_t fsm;
+
+    // Lean turn signal with release hysteresis
+    states_fsm_init(&fsm);
+    CHECK(fsm_step(&fsm, 10.0f, 0.0f, 1.0f, 0) == IDLE);
+    CHECK(fsm_step(&fsm, LEFT_THRESHOLD + 1.0f, 0.0f, 1.0f, 10) == LEFT);
+    CHECK(fsm_step(&fsm, 8.0f, 0.0f, 1.0f, 20) == LEFT);       // Below the trigger, above the release
+    CHECK(fsm_step(&fsm, 3.0f, 0.0f, 1.0f, 30) == IDLE);
+    CHECK(fsm_step(&fsm, -LEFT_THRESHOLD - 1.0f, 0.0f, 1.0f, 40) == RIGHT);
+    CHECK(fsm_step(&fsm, -8.0f, 0.0f, 1.0f, 50) == RIGHT);
+    CHECK(fsm_step(&fsm, -3.0f, 0.0f, 1.0f, 60) == IDLE);
+
+    // Braking needs a confident estimate, and is held for 3 s
+    states_fsm_init(&fsm);
+    CHECK(fsm_step(&fsm, 0.0f, 2.0f, 0.2f, 0) == IDLE);
+    CHECK(fsm_step(&fsm, 0.0f, 2.0f, 1.0f, 100) == BRAKE);
+    CHECK(fsm_step(&fsm, 0.0f, 0.0f, 1.0f, 3099) == BRAKE);
+    CHECK(fsm_step(&fsm, 0.0f, 0.0f, 1.0f, 3100) == IDLE);
+
+    // Hard braking at the end of the hold extends it
+    CHECK(fsm_step(&fsm, 0.0f, 2.0f, 1.0f, 4000) == BRAKE);
+    CHECK(fsm_step(&fsm, 0.0f, HARD_BRAKING_DECELERATION + 1.0f, 1.0f, 7000) == BRAKE);
+    CHECK(fsm_step(&fsm, 0.0f, 0.0f, 1.0f, 9999) == BRAKE);
+    CHECK(fsm_step(&fsm, 0.0f, 0.0f, 1.0f, 10000) == IDLE);
+
+    // Braking overrides a turn signal
+    CHECK(fsm_step(&fsm, LEFT_THRESHOLD + 1.0f, 0.0f, 1.0f, 11000) == LEFT);
+    CHECK(fsm_step(&fsm, LEFT_THRESHOLD + 1.0f, 2.0f, 1.0f, 11010) == BRAKE);
+
+    // A voice turn signal waits 10 s for the rider to lean, then gives up
+    states_fsm_init(&fsm);
+    states_voice_command(&fsm, RIGHT);
+    CHECK(fsm_step(&fsm, 0.0f, 0.0f, 1.0f, 0) == RIGHT);
+    CHECK(fsm_step(&fsm, 0.0f, 0.0f, 1.0f, 9999) == RIGHT);
+    CHECK(fsm_step(&fsm, 0.0f, 0.0f, 1.0f, 10000) == IDLE);
+    CHECK(fsm_step(&fsm, 0.0f, 0.0f, 1.0f, 10010) == IDLE);    // The command was consumed
+
+    // Once the rider leans into it, it releases on the way back up
+    states_voice_command(&fsm, LEFT);
+    CHECK(fsm_step(&fsm, 0.0f, 0.0f, 1.0f, 20000) == LEFT);
+    CHECK(fsm_step(&fsm, LEFT_THRESHOLD + 1.0f, 0.0f, 1.0f, 21000) == LEFT);
+    CHECK(fsm_step(&fsm, 3.0f, 0.0f, 1.0f, 22000) == IDLE);
+
+    // A voice brake skips the confidence check
+    states_voice_command(&fsm, BRAKE);
+    CHECK(fsm_step(&fsm, 0.0f, 0.0f, 0.0f, 23000) == BRAKE);
+
+    CHECK(strcmp(states_name(BRAKE), "BRAKE") == 0);
+}
+
+int main(void) {
+    test_engine();
+    test_dashboard_table();
+    if (failures) {
+        printf("FAIL: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,166 @@
+// Accuracy check of the fast Madgwick updates against the float reference
+//
+// Runs MadgwickQuaternionUpdateFast next to MadgwickQuaternionUpdate, and
+// MadgwickQuaternionUpdateIMU next to the gravity-only step from Madgwick's
+// report (with sqrtf and divides), on the same synthetic input sequence:
+// slowly varying rotation rates with the matching gravity and magnetic field
+// in the sensor frame, plus noise. Fails if any quaternion component drifts
+// further than MAX_QUATERNION_ERROR from the reference.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "quaternion_filter.h"
+
+#define PI 3.14159265359f
+#define NUM_SAMPLES 100000
+#define DELTAT 0.005f               // s, the step the firmware passes at 200 Hz
+#define BETA 0.0604600f             // sqrt(3/4) * 4 degrees/s, as on the dashboard
+
+// Measured about 2e-6 for the full update and 1e-5 for the IMU-only one, whose
+// reference gradient assumes a unit quaternion; the margin is for other compilers
+#define MAX_QUATERNION_ERROR 1e-4f
+
+// Reference 6-DoF update, MadgwickAHRSupdateIMU from the x-io sources
+static void reference_update_imu(float* q, float beta, float deltat, float ax, float ay, float az, float gx, float gy, float gz) {
+    float q1 = q[0], q2 = q[1], q3 = q[2], q4 = q[3];
+    float norm, s1, s2, s3, s4;
+
+    float qDot1 = 0.5f * (-q2 * gx - q3 * gy - q4 * gz);
+    float qDot2 = 0.5f * (q1 * gx + q3 * gz - q4 * gy);
+    float qDot3 = 0.5f * (q1 * gy - q2 * gz + q4 * gx);
+    float qDot4 = 0.5f * (q1 * gz + q2 * gy - q3 * gx);
+
+    norm = sqrtf(ax * ax + ay * ay + az * az);
+    if (norm == 0.0f) return;
+    ax /= norm;
+    ay /= norm;
+    az /= norm;
+
+    float _2q1 = 2.0f * q1, _2q2 = 2.0f * q2, _2q3 = 2.0f * q3, _2q4 = 2.0f * q4;
+    float _4q1 = 4.0f * q1, _4q2 = 4.0f * q2, _4q3 = 4.0f * q3;
+    float _8q2 = 8.0f * q2, _8q3 = 8.0f * q3;
+    float q1q1 = q1 * q1, q2q2 = q2 * q2, q3q3 = q3 * q3, q4q4 = q4 * q4;
+
+    s1 = _4q1 * q3q3 + _2q3 * ax + _4q1 * q2q2 - _2q2 * ay;
+    s2 = _4q2 * q4q4 - _2q4 * ax + 4.0f * q1q1 * q2 - _2q1 * ay - _4q2 + _8q2 * q2q2 + _8q2 * q3q3 + _4q2 * az;
+    s3 = 4.0f * q1q1 * q3 + _2q1 * ax + _4q3 * q4q4 - _2q4 * ay - _4q3 + _8q3 * q2q2 + _8q3 * q3q3 + _4q3 * az;
+    s4 = 4.0f * q2q2 * q4 - _2q2 * ax + 4.0f * q3q3 * q4 - _2q3 * ay;
+    norm = sqrtf(s1 * s1 + s2 * s2 + s3 * s3 + s4 * s4);
+    if (norm > 0.0f) {
+        qDot1 -= beta * s1 / norm;
+        qDot2 -= beta * s2 / norm;
+        qDot3 -= beta * s3 / norm;
+        qDot4 -= beta * s4 / norm;
+    }
+
+    q1 += qDot1 * deltat;
+    q2 += qDot2 * deltat;
+    q3 += qDot3 * deltat;
+    q4 += qDot4 * deltat;
+    norm = sqrtf(q1 * q1 + q2 * q2 + q3 * q3 + q4 * q4);
+    q[0] = q1 / norm;
+    q[1] = q2 / norm;
+    q[2] = q3 / norm;
+    q[3] = q4 / norm;
+}
+
+// Deterministic noise in [-1, 1]
+static uint32_t noise_state = 12345;
+static float noise(void) {
+    noise_state = noise_state * 1664525u + 1013904223u;
+    return (noise_state >> 8) / 8388608.0f - 1.0f;
+}
+
+// Rotates the earth frame vector v into the sensor frame of the true
+// orientation q (conjugate rotation)
+static void to_sensor_frame(const double* q, const double* v, float* out) {
+    double w = q[0], x = -q[1], y = -q[2], z = -q[3];
+    double r[3][3] = {
+        {1 - 2 * (y * y + z * z), 2 * (x * y - w * z), 2 * (x * z + w * y)},
+        {2 * (x * y + w * z), 1 - 2 * (x * x + z * z), 2 * (y * z - w * x)},
+        {2 * (x * z - w * y), 2 * (y * z + w * x), 1 - 2 * (x * x + y * y)},
+    };
+    for (int i = 0; i < 3; i++) {
+        out[i] = (float)(r[i][0] * v[0] + r[i][1] * v[1] + r[i][2] * v[2]);
+    }
+}
+
+static float max_error(const float* a, const float* b) {
+    float error = 0.0f;
+    for (int i = 0; i < 4; i++) {
+        float e = fabsf(a[i] - b[i]);
+        if (e > error) {
+            error = e;
+        }
+    }
+    return error;
+}
+
+int main(void) {
+    const double gravity[3] = {0.0, 0.0, 1.0};          // g
+    const double field[3] = {226.0, 0.0, -424.0};       // mG, roughly the Bay Area
+
+    double truth[4] = {1.0, 0.0, 0.0, 0.0};
+    float q_reference[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+    float q_fast[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+    float q_imu_reference[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+    float q_imu[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+    float worst_fast = 0.0f, worst_imu = 0.0f;
+
+    for (int n = 0; n < NUM_SAMPLES; n++) {
+        double t = n * DELTAT;
+
+        // Body rates in rad/s, slow enough for the filter to track
+        double w[3] = {0.8 * sin(0.31 * t), 0.5 * sin(0.17 * t + 1.0), 1.2 * sin(0.07 * t + 2.0)};
+        double dq[4] = {
+            0.5 * (-truth[1] * w[0] - truth[2] * w[1] - truth[3] * w[2]),
+            0.5 * (truth[0] * w[0] + truth[2] * w[2] - truth[3] * w[1]),
+            0.5 * (truth[0] * w[1] - truth[1] * w[2] + truth[3] * w[0]),
+            0.5 * (truth[0] * w[2] + truth[1] * w[1] - truth[2] * w[0]),
+        };
+        double norm = 0.0;
+        for (int i = 0; i < 4; i++) {
+            truth[i] += dq[i] * DELTAT;
+            norm += truth[i] * truth[i];
+        }
+        for (int i = 0; i < 4; i++) {
+            truth[i] /= sqrt(norm);
+        }
+
+        float a[3], m[3];
+        to_sensor_frame(truth, gravity, a);
+        to_sensor_frame(truth, field, m);
+        float gx = (float) w[0] + 0.01f * noise();
+        float gy = (float) w[1] + 0.01f * noise();
+        float gz = (float) w[2] + 0.01f * noise();
+        for (int i = 0; i < 3; i++) {
+            a[i] += 0.02f * noise();
+            m[i] += 5.0f * noise();
+        }
+
+        MadgwickQuaternionUpdate(q_reference, BETA, DELTAT, a[0], a[1], a[2], gx, gy, gz, m[0], m[1], m[2]);
+        MadgwickQuaternionUpdateFast(q_fast, BETA, DELTAT, a[0], a[1], a[2], gx, gy, gz, m[0], m[1], m[2]);
+        reference_update_imu(q_imu_reference, BETA, DELTAT, a[0], a[1], a[2], gx, gy, gz);
+        MadgwickQuaternionUpdateIMU(q_imu, BETA, DELTAT, a[0], a[1], a[2], gx, gy, gz);
+
+        float error = max_error(q_fast, q_reference);
+        if (error > worst_fast) {
+            worst_fast = error;
+        }
+        error = max_error(q_imu, q_imu_reference);
+        if (error > worst_imu) {
+            worst_imu = error;
+        }
+    }
+
+    printf("MadgwickQuaternionUpdateFast: max component error %.2g\n", worst_fast);
+    printf("MadgwickQuaternionUpdateIMU:  max component error %.2g\n", worst_imu);
+    if (worst_fast > MAX_QUATERNION_ERROR || worst_imu > MAX_QUATERNION_ERROR) {
+        printf("FAIL: bound is %.2g\n", MAX_QUATERNION_ERROR);
+        return 1;
+    }
+    printf("OK (bound %.2g)\n", MAX_QUATERNION_ERROR);
+    return 0;
+}
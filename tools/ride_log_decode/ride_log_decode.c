@@ -0,0 +1,178 @@
+// Decodes a dump of the dashboard's ride log flash region into CSV
+//
+// Pages are put back in the order they were written using their header
+// sequence numbers, so a dump taken after the ring has wrapped still comes out
+// oldest first. Erased and corrupt pages are skipped.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ride_log_format.h"
+#include "states.h"
+
+typedef struct {
+    const uint8_t* data;
+    ride_log_page_t header;
+} page_t;
+
+static int compare_pages(const void* a, const void* b) {
+    const page_t* pa = (const page_t*)a;
+    const page_t* pb = (const page_t*)b;
+    int32_t difference = (int32_t)(pa->header.sequence - pb->header.sequence);
+    return (difference > 0) - (difference < 0);
+}
+
+static const char* record_name(ride_log_record_type_t type) {
+    switch (type) {
+        case RIDE_LOG_SAMPLE:
+            return "sample";
+        case RIDE_LOG_ENVIRONMENT:
+            return "environment";
+        case RIDE_LOG_STATE:
+            return "state";
+    }
+    return "?";
+}
+
+static void print_record(FILE* out, uint32_t sequence, const ride_log_record_t* record) {
+    fprintf(out, "%lu,%lu,%s,", (unsigned long)sequence, (unsigned long)record->time_ms, record_name(record->type));
+    switch (record->type) {
+        case RIDE_LOG_SAMPLE:
+            fprintf(out, "%.2f,%.1f,%.1f,%.3f,,,\n", record->sample.speed, record->sample.distance,
+                    record->sample.roll, record->sample.lin_ay);
+            break;
+        case RIDE_LOG_ENVIRONMENT:
+            fprintf(out, ",,,,%.1f,%.1f,\n", record->environment.temperature, record->environment.humidity);
+            break;
+        case RIDE_LOG_STATE:
+            fprintf(out, ",,,,,,%s\n", states_name((states)record->state));
+            break;
+    }
+}
+
+// Returns the number of records, or -1 if a chunk is malformed
+static long decode_page(FILE* out, const page_t* page, unsigned long* bytes) {
+    ride_log_codec_t codec;
+    ride_log_codec_reset(&codec, page->header.start_ms);
+    long records = 0;
+
+    for (size_t c = 0; c < RIDE_LOG_CHUNKS_PER_PAGE; c++) {
+        const uint8_t* chunk = page->data + sizeof(ride_log_page_t) + c * RIDE_LOG_CHUNK_SIZE;
+        size_t offset = 0;
+        while (offset < RIDE_LOG_CHUNK_SIZE) {
+            ride_log_record_t record;
+            size_t used = ride_log_decode(&codec, chunk + offset, RIDE_LOG_CHUNK_SIZE - offset, &record);
+            if (used == 0) {
+                break;
+            }
+            offset += used;
+            records++;
+            print_record(out, page->header.sequence, &record);
+        }
+        // Anything after the records must be padding
+        for (size_t i = offset; i < RIDE_LOG_CHUNK_SIZE; i++) {
+            if (chunk[i] != 0xFF) {
+                return -1;
+            }
+        }
+        *bytes += offset;
+    }
+    return records;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-o csv] dump.bin\n", name);
+    fprintf(stderr, "  -o  write CSV to a file ('-' for stdout, the default)\n");
+}
+
+int main(int argc, char** argv) {
+    const char* output_path = "-";
+    int first_dump = 1;
+
+    for (; first_dump < argc && argv[first_dump][0] == '-' && argv[first_dump][1] != '\0'; first_dump++) {
+        if (strcmp(argv[first_dump], "-o") == 0 && first_dump + 1 < argc) {
+            output_path = argv[++first_dump];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (first_dump != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    const char* dump_path = argv[first_dump];
+    FILE* dump = fopen(dump_path, "rb");
+    if (!dump) {
+        perror(dump_path);
+        return 2;
+    }
+    fseek(dump, 0, SEEK_END);
+    long size = ftell(dump);
+    rewind(dump);
+    if (size < RIDE_LOG_PAGE_SIZE || size % RIDE_LOG_PAGE_SIZE != 0) {
+        fprintf(stderr, "%s: size %ld is not a whole number of %d byte pages\n", dump_path, size, RIDE_LOG_PAGE_SIZE);
+        fclose(dump);
+        return 2;
+    }
+    uint8_t* data = malloc(size);
+    if (!data || fread(data, 1, size, dump) != (size_t)size) {
+        perror(dump_path);
+        fclose(dump);
+        return 2;
+    }
+    fclose(dump);
+
+    size_t num_pages = size / RIDE_LOG_PAGE_SIZE;
+    page_t* pages = malloc(num_pages * sizeof(page_t));
+    size_t valid = 0;
+    uint32_t min_erase = UINT32_MAX, max_erase = 0;
+    for (size_t i = 0; i < num_pages; i++) {
+        page_t page = {.data = data + i * RIDE_LOG_PAGE_SIZE};
+        memcpy(&page.header, page.data, sizeof(page.header));
+        if (!ride_log_page_valid(&page.header)) {
+            continue;
+        }
+        pages[valid++] = page;
+        min_erase = page.header.erase_count < min_erase ? page.header.erase_count : min_erase;
+        max_erase = page.header.erase_count > max_erase ? page.header.erase_count : max_erase;
+    }
+    qsort(pages, valid, sizeof(page_t), compare_pages);
+
+    FILE* out = strcmp(output_path, "-") == 0 ? stdout : fopen(output_path, "w");
+    if (!out) {
+        perror(output_path);
+        return 2;
+    }
+    fprintf(out, "page,time_ms,record,speed_mps,distance_m,roll_deg,lin_ay_g,temperature,humidity,state\n");
+
+    unsigned long records = 0, bytes = 0, bad_pages = 0;
+    for (size_t i = 0; i < valid; i++) {
+        long page_records = decode_page(out, &pages[i], &bytes);
+        if (page_records < 0) {
+            fprintf(stderr, "page %lu: malformed record, rest of the page skipped\n",
+                    (unsigned long)pages[i].header.sequence);
+            bad_pages++;
+            continue;
+        }
+        records += page_records;
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    fprintf(stderr, "%lu of %lu pages in use, %lu records in %lu bytes (%.1f bytes/record), %lu malformed pages\n",
+            (unsigned long)valid, (unsigned long)num_pages, records, bytes,
+            records ? (double)bytes / records : 0.0, bad_pages);
+    if (valid > 0) {
+        fprintf(stderr, "erase counts %lu to %lu\n", (unsigned long)min_erase, (unsigned long)max_erase);
+    }
+
+    free(pages);
+    free(data);
+    return bad_pages ? 1 : 0;
+}